@@ -0,0 +1,432 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <cstdint>
+#include <algorithm>
+
+#include "culling.hh"
+#include "parallel.hh"
+#include "bvh.hh"
+#include "profiler.hh"
+
+struct ao_bake_settings {
+    unsigned rays_per_vertex = 128;
+    float max_distance = 0.05f; // fraction of the model's longest side a ray looks for occluders within
+};
+
+/**
+ * \brief Baked ambient occlusion of every vertex of a static model
+ * Each vertex casts cosine weighted rays over the hemisphere around its normal against the model's
+ * triangles, and stores the fraction that escape within max_distance. Vertices are triangle corners,
+ * corners sharing a position and normal are baked once. Everything is in the model's object space
+ */
+struct ambient_occlusion {
+    uint64_t layout_hash = 0;    // hash of the vertices the values were baked from, stale files are ignored
+    std::vector<uint8_t> values; // one per vertex, 255 where nothing is in the way
+
+    // of the last bake
+    uint64_t rays_cast = 0;
+    unsigned unique_vertices = 0;
+
+    bool empty() const { return values.empty(); }
+
+    float value(size_t vertex) const { return values[vertex] / 255.0f; }
+
+    /**
+     * \brief Hash of the vertices, used to tell whether saved values still match the model
+     */
+    static uint64_t hash_layout(const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &normals) {
+        // FNV-1a over the vertex count, positions and normals
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&](const void *bytes, size_t size) {
+            for (size_t i = 0; i < size; ++i)
+                hash = (hash ^ static_cast<const uint8_t *>(bytes)[i]) * 1099511628211ull;
+        };
+        uint64_t count = positions.size();
+        add(&count, sizeof(count));
+        add(positions.data(), positions.size() * sizeof(glm::vec3));
+        add(normals.data(), normals.size() * sizeof(glm::vec3));
+        return hash;
+    }
+
+    /**
+     * \brief Bake the occlusion of a triangle list
+     * \param positions, normals three corners per triangle, a zero normal is replaced by the face normal
+     * \param triangle_casts whether each triangle blocks rays, transparent and alpha tested ones should not
+     */
+    static ambient_occlusion bake(const std::vector<glm::vec3> &positions, const std::vector<glm::vec3> &normals,
+                                  const std::vector<uint8_t> &triangle_casts,
+                                  const ao_bake_settings &settings = ao_bake_settings()) {
+        PROFILE_ZONE("bake ambient occlusion");
+        ambient_occlusion result;
+        result.layout_hash = hash_layout(positions, normals);
+        result.values.assign(positions.size(), 255);
+        unsigned triangle_count = positions.size() / 3;
+
+        aabb model_bounds;
+        std::vector<aabb> triangle_bounds;
+        std::vector<unsigned> casters; // triangle of each bvh primitive
+        for (unsigned triangle = 0; triangle < triangle_count; ++triangle) {
+            aabb box;
+            for (unsigned corner = 0; corner < 3; ++corner)
+                box.expand(positions[triangle * 3 + corner]);
+            model_bounds.expand(box);
+            if (!triangle_casts[triangle])
+                continue;
+            triangle_bounds.push_back(box);
+            casters.push_back(triangle);
+        }
+        if (casters.empty())
+            return result;
+
+        // leaves of up to 4 triangles, stored in leaf order so a leaf is one simd test, and nodes of 4 children
+        bvh triangle_bvh;
+        triangle_bvh.build(triangle_bounds, 4);
+        triangle_soa triangles;
+        for (unsigned index : triangle_bvh.indices) {
+            const glm::vec3 *corners = &positions[casters[index] * 3];
+            triangles.push_back(corners[0], corners[1], corners[2]);
+        }
+        triangles.pad();
+        wide_bvh tree;
+        tree.build(triangle_bvh);
+
+        glm::vec3 size = model_bounds.max - model_bounds.min;
+        float max_distance = std::max({size.x, size.y, size.z}) * settings.max_distance;
+        // rays start a little above the surface so they do not hit the triangles around their own vertex
+        float bias = max_distance * 1e-3f;
+
+        // corners that share a position and normal get the same value, so only the first of each is baked
+        std::vector<glm::vec3> vertex_normals(positions.size());
+        for (unsigned triangle = 0; triangle < triangle_count; ++triangle) {
+            const glm::vec3 *corners = &positions[triangle * 3];
+            glm::vec3 face_normal = glm::cross(corners[1] - corners[0], corners[2] - corners[0]);
+            face_normal = glm::dot(face_normal, face_normal) > 0.0f ? glm::normalize(face_normal) : glm::vec3(0.0f);
+            for (unsigned corner = triangle * 3; corner < triangle * 3 + 3; ++corner)
+                vertex_normals[corner] = glm::dot(normals[corner], normals[corner]) > 1e-12f
+                                             ? glm::normalize(normals[corner])
+                                             : face_normal;
+        }
+        std::vector<unsigned> order(positions.size());
+        for (unsigned i = 0; i < order.size(); ++i)
+            order[i] = i;
+        auto vertex_less = [&](unsigned a, unsigned b) {
+            for (int axis = 0; axis < 3; ++axis) {
+                if (positions[a][axis] != positions[b][axis])
+                    return positions[a][axis] < positions[b][axis];
+                if (vertex_normals[a][axis] != vertex_normals[b][axis])
+                    return vertex_normals[a][axis] < vertex_normals[b][axis];
+            }
+            return false;
+        };
+        std::sort(order.begin(), order.end(), vertex_less);
+        std::vector<unsigned> unique; // positions in order where a new vertex starts
+        for (unsigned i = 0; i < order.size(); ++i)
+            if (i == 0 || vertex_less(order[i - 1], order[i]))
+                unique.push_back(i);
+        unique.push_back(order.size());
+        result.unique_vertices = unique.size() - 1;
+
+        parallel_for(0, result.unique_vertices, 64, [&](size_t begin, size_t end) {
+            for (size_t vertex = begin; vertex < end; ++vertex) {
+                unsigned first = order[unique[vertex]];
+                glm::vec3 normal = vertex_normals[first];
+                if (normal == glm::vec3(0.0f))
+                    continue;
+                glm::vec3 origin = positions[first] + normal * bias;
+                glm::vec3 tangent = glm::normalize(std::abs(normal.x) > 0.9f ? glm::cross(normal, glm::vec3(0, 1, 0))
+                                                                             : glm::cross(normal, glm::vec3(1, 0, 0)));
+                glm::vec3 bitangent = glm::cross(normal, tangent);
+
+                // stratified over a grid of the unit square, then mapped onto the hemisphere
+                std::mt19937 rng(first);
+                std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+                unsigned strata = std::max(unsigned(std::sqrt(float(settings.rays_per_vertex))), 1u);
+                unsigned open = 0;
+                for (unsigned ray = 0; ray < settings.rays_per_vertex; ++ray) {
+                    float u = ((ray % strata) + unit(rng)) / strata;
+                    float v = ((ray / strata % strata) + unit(rng)) / strata;
+                    // cosine weighted, so the fraction of rays that escape is the occlusion term directly
+                    float radius = std::sqrt(u), angle = 6.2831853f * v;
+                    glm::vec3 direction = tangent * (radius * std::cos(angle)) +
+                                          bitangent * (radius * std::sin(angle)) +
+                                          normal * std::sqrt(std::max(1.0f - u, 0.0f));
+                    open += !tree.occluded(origin, direction, max_distance,
+                                           [&](unsigned leaf_first, unsigned count, float &t_max) {
+                                               return triangles.intersect(leaf_first, count, origin, direction, t_max);
+                                           });
+                }
+                uint8_t value = uint8_t(open * 255.0f / settings.rays_per_vertex + 0.5f);
+                for (unsigned i = unique[vertex]; i < unique[vertex + 1]; ++i)
+                    result.values[order[i]] = value;
+            }
+        });
+        result.rays_cast = uint64_t(result.unique_vertices) * settings.rays_per_vertex;
+        return result;
+    }
+
+    bool save(const std::string &path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            std::cout << "Failed to open file: " << path << std::endl;
+            return false;
+        }
+        uint32_t header[] = {MAGIC, uint32_t(values.size())};
+        file.write(reinterpret_cast<const char *>(header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(&layout_hash), sizeof(layout_hash));
+        file.write(reinterpret_cast<const char *>(values.data()), values.size());
+        return file.good();
+    }
+
+    /**
+     * \brief Load values saved by save(), if they were baked from vertices with the given layout hash
+     */
+    bool load(const std::string &path, uint64_t expected_hash) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+            return false;
+        uint32_t header[2];
+        uint64_t hash;
+        file.read(reinterpret_cast<char *>(header), sizeof(header));
+        file.read(reinterpret_cast<char *>(&hash), sizeof(hash));
+        if (!file || header[0] != MAGIC || hash != expected_hash) {
+            std::cout << path << " does not match the model, ignoring it" << std::endl;
+            return false;
+        }
+        std::vector<uint8_t> loaded(header[1]);
+        file.read(reinterpret_cast<char *>(loaded.data()), loaded.size());
+        if (!file) {
+            std::cout << "Failed to read " << path << std::endl;
+            return false;
+        }
+        layout_hash = hash;
+        values = std::move(loaded);
+        return true;
+    }
+
+  private:
+    static const uint32_t MAGIC = 0x31304f41; // "AO01"
+
+    /**
+     * \brief Triangles as a corner and two edges in separate arrays, so 4 can be tested against a ray at once
+     */
+    struct triangle_soa {
+        std::vector<float> a_x, a_y, a_z, edge1_x, edge1_y, edge1_z, edge2_x, edge2_y, edge2_z;
+
+        void push_back(glm::vec3 a, glm::vec3 b, glm::vec3 c) {
+            glm::vec3 edge1 = b - a, edge2 = c - a;
+            a_x.push_back(a.x), a_y.push_back(a.y), a_z.push_back(a.z);
+            edge1_x.push_back(edge1.x), edge1_y.push_back(edge1.y), edge1_z.push_back(edge1.z);
+            edge2_x.push_back(edge2.x), edge2_y.push_back(edge2.y), edge2_z.push_back(edge2.z);
+        }
+
+        // degenerate triangles after the last one, so a group of 4 starting at any triangle can be loaded
+        void pad() {
+            for (unsigned i = 0; i < 3; ++i)
+                push_back(glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(0.0f));
+        }
+
+        /**
+         * \brief Test the triangles [first, first + count) against a ray, two sided like ray_intersects()
+         * \return whether one was hit within (0, t_max), t_max is then shortened to the nearest hit
+         */
+        bool intersect(unsigned first, unsigned count, glm::vec3 origin, glm::vec3 direction, float &t_max) const {
+            bool hit = false;
+            unsigned i = first;
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+            __m128 origin_x = _mm_set1_ps(origin.x), origin_y = _mm_set1_ps(origin.y);
+            __m128 origin_z = _mm_set1_ps(origin.z);
+            __m128 direction_x = _mm_set1_ps(direction.x), direction_y = _mm_set1_ps(direction.y);
+            __m128 direction_z = _mm_set1_ps(direction.z);
+            __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f);
+            for (; i < first + count; i += 4) {
+                __m128 e1x = _mm_loadu_ps(&edge1_x[i]), e1y = _mm_loadu_ps(&edge1_y[i]);
+                __m128 e1z = _mm_loadu_ps(&edge1_z[i]);
+                __m128 e2x = _mm_loadu_ps(&edge2_x[i]), e2y = _mm_loadu_ps(&edge2_y[i]);
+                __m128 e2z = _mm_loadu_ps(&edge2_z[i]);
+                // p = direction x edge2
+                __m128 px = _mm_sub_ps(_mm_mul_ps(direction_y, e2z), _mm_mul_ps(direction_z, e2y));
+                __m128 py = _mm_sub_ps(_mm_mul_ps(direction_z, e2x), _mm_mul_ps(direction_x, e2z));
+                __m128 pz = _mm_sub_ps(_mm_mul_ps(direction_x, e2y), _mm_mul_ps(direction_y, e2x));
+                __m128 determinant =
+                    _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+                // |determinant| >= 1e-12, the sign bit cleared
+                __m128 valid = _mm_cmpge_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), determinant), _mm_set1_ps(1e-12f));
+                __m128 inverse_determinant = _mm_div_ps(one, determinant);
+                __m128 tx = _mm_sub_ps(origin_x, _mm_loadu_ps(&a_x[i]));
+                __m128 ty = _mm_sub_ps(origin_y, _mm_loadu_ps(&a_y[i]));
+                __m128 tz = _mm_sub_ps(origin_z, _mm_loadu_ps(&a_z[i]));
+                __m128 u = _mm_mul_ps(
+                    _mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)),
+                    inverse_determinant);
+                // q = to_origin x edge1
+                __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+                __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+                __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+                __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(direction_x, qx), _mm_mul_ps(direction_y, qy)),
+                                                 _mm_mul_ps(direction_z, qz)),
+                                      inverse_determinant);
+                __m128 t = _mm_mul_ps(
+                    _mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)),
+                    inverse_determinant);
+                valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpge_ps(u, zero), _mm_cmpge_ps(v, zero)));
+                valid = _mm_and_ps(valid, _mm_cmple_ps(_mm_add_ps(u, v), one));
+                valid = _mm_and_ps(valid, _mm_and_ps(_mm_cmpgt_ps(t, zero), _mm_cmplt_ps(t, _mm_set1_ps(t_max))));
+                // lanes past the end of the range belong to the next leaf or the padding
+                int mask = _mm_movemask_ps(valid) & ((1 << std::min(first + count - i, 4u)) - 1);
+                if (mask == 0)
+                    continue;
+                float t_lanes[4];
+                _mm_storeu_ps(t_lanes, t);
+                for (int lane = 0; lane < 4; ++lane)
+                    if (mask & (1 << lane))
+                        t_max = std::min(t_max, t_lanes[lane]);
+                hit = true;
+            }
+#endif
+            // remaining triangles one at a time
+            for (; i < first + count; ++i) {
+                glm::vec3 a(a_x[i], a_y[i], a_z[i]);
+                glm::vec3 b = a + glm::vec3(edge1_x[i], edge1_y[i], edge1_z[i]);
+                glm::vec3 c = a + glm::vec3(edge2_x[i], edge2_y[i], edge2_z[i]);
+                float t;
+                if (ray_intersects(a, b, c, origin, direction, t_max, t)) {
+                    t_max = t;
+                    hit = true;
+                }
+            }
+            return hit;
+        }
+    };
+
+    /**
+     * \brief A bvh collapsed to 4 children per node, so a ray is tested against 4 child boxes at once
+     * Each node takes the children of its largest inner children until it has 4. The bake only asks whether
+     * a ray hits anything, so the children are visited in any order
+     */
+    struct wide_bvh {
+        struct node {
+            float min_x[4], min_y[4], min_z[4], max_x[4], max_y[4], max_z[4];
+            unsigned first[4]; // leaf: first primitive, inner node: child node
+            unsigned count[4]; // primitives in a leaf, 0 for inner nodes
+            unsigned lanes;    // children in use
+        };
+
+        std::vector<node> nodes;
+
+        void build(const bvh &tree) {
+            nodes.clear();
+            if (!tree.nodes.empty())
+                collapse(tree, 0);
+        }
+
+        /**
+         * \brief Whether a ray hits anything within (0, t_max)
+         * \param intersect_leaf bool(first, count, float &t_max) tests the primitives of a leaf
+         */
+        template <typename intersect_type>
+        bool occluded(glm::vec3 origin, glm::vec3 direction, float t_max, intersect_type intersect_leaf) const {
+            if (nodes.empty())
+                return false;
+            glm::vec3 inverse_direction = 1.0f / direction;
+            // every node pops one entry and pushes at most 4, and is at most as deep as the node it came from
+            unsigned stack[bvh::MAX_DEPTH * 3 + 4];
+            unsigned stack_size = 0;
+            stack[stack_size++] = 0;
+            while (stack_size > 0) {
+                const node &node = nodes[stack[--stack_size]];
+                int mask = 0;
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+                __m128 origin_x = _mm_set1_ps(origin.x), origin_y = _mm_set1_ps(origin.y);
+                __m128 origin_z = _mm_set1_ps(origin.z);
+                __m128 inverse_x = _mm_set1_ps(inverse_direction.x), inverse_y = _mm_set1_ps(inverse_direction.y);
+                __m128 inverse_z = _mm_set1_ps(inverse_direction.z);
+                __m128 t0x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.min_x), origin_x), inverse_x);
+                __m128 t1x = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.max_x), origin_x), inverse_x);
+                __m128 t0y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.min_y), origin_y), inverse_y);
+                __m128 t1y = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.max_y), origin_y), inverse_y);
+                __m128 t0z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.min_z), origin_z), inverse_z);
+                __m128 t1z = _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(node.max_z), origin_z), inverse_z);
+                __m128 t_near = _mm_max_ps(_mm_max_ps(_mm_min_ps(t0x, t1x), _mm_min_ps(t0y, t1y)),
+                                           _mm_max_ps(_mm_min_ps(t0z, t1z), _mm_setzero_ps()));
+                __m128 t_far = _mm_min_ps(_mm_min_ps(_mm_max_ps(t0x, t1x), _mm_max_ps(t0y, t1y)),
+                                          _mm_min_ps(_mm_max_ps(t0z, t1z), _mm_set1_ps(t_max)));
+                mask = _mm_movemask_ps(_mm_cmple_ps(t_near, t_far)) & ((1 << node.lanes) - 1);
+#else
+                for (unsigned lane = 0; lane < node.lanes; ++lane) {
+                    aabb box;
+                    box.min = glm::vec3(node.min_x[lane], node.min_y[lane], node.min_z[lane]);
+                    box.max = glm::vec3(node.max_x[lane], node.max_y[lane], node.max_z[lane]);
+                    float t_near;
+                    if (ray_intersects(box, origin, inverse_direction, t_max, t_near))
+                        mask |= 1 << lane;
+                }
+#endif
+                for (unsigned lane = 0; lane < node.lanes; ++lane) {
+                    if (!(mask & (1 << lane)))
+                        continue;
+                    if (node.count[lane] == 0)
+                        stack[stack_size++] = node.first[lane];
+                    else if (intersect_leaf(node.first[lane], node.count[lane], t_max))
+                        return true;
+                }
+            }
+            return false;
+        }
+
+      private:
+        // adds the node made of the subtree of tree at root and returns its index
+        unsigned collapse(const bvh &tree, unsigned root) {
+            unsigned children[4] = {root};
+            unsigned child_count = 1;
+            while (child_count < 4) {
+                int widest = -1;
+                float widest_area = -1.0f;
+                for (unsigned i = 0; i < child_count; ++i) {
+                    const bvh::node &child = tree.nodes[children[i]];
+                    glm::vec3 size = child.bounds.max - child.bounds.min;
+                    float area = size.x * size.y + size.y * size.z + size.z * size.x;
+                    if (!child.leaf() && area > widest_area) {
+                        widest = i;
+                        widest_area = area;
+                    }
+                }
+                if (widest < 0)
+                    break;
+                unsigned left = tree.nodes[children[widest]].first;
+                children[widest] = left;
+                children[child_count++] = left + 1;
+            }
+
+            unsigned index = nodes.size();
+            nodes.emplace_back();
+            nodes[index].lanes = child_count;
+            for (unsigned lane = 0; lane < 4; ++lane) {
+                // unused lanes are masked out by lanes, their boxes only have to be numbers
+                aabb bounds;
+                bounds.min = bounds.max = glm::vec3(0.0f);
+                unsigned first = 0, count = 0;
+                if (lane < child_count) {
+                    const bvh::node &child = tree.nodes[children[lane]];
+                    bounds = child.bounds;
+                    first = child.leaf() ? child.first : collapse(tree, children[lane]);
+                    count = child.count;
+                }
+                // collapse() may have moved the nodes
+                node &node = nodes[index];
+                node.min_x[lane] = bounds.min.x, node.min_y[lane] = bounds.min.y, node.min_z[lane] = bounds.min.z;
+                node.max_x[lane] = bounds.max.x, node.max_y[lane] = bounds.max.y, node.max_z[lane] = bounds.max.z;
+                node.first[lane] = first;
+                node.count[lane] = count;
+            }
+            return index;
+        }
+    };
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+struct atlas_rect {
+    int x, y;
+    int width, height;
+};
+
+/**
+ * \brief Skyline bin packer
+ * Keeps the top edge of the packed area as a list of horizontal segments
+ * and places each rect on the segment where it ends up lowest
+ */
+struct skyline_packer {
+    struct segment {
+        int x, y, width;
+    };
+
+    int width, height;
+    std::vector<segment> skyline;
+    long used_area = 0;
+
+    skyline_packer(int width, int height) : width(width), height(height) { skyline.push_back({0, 0, width}); }
+
+    bool insert(int rect_width, int rect_height, atlas_rect &out) {
+        int best_index = -1;
+        int best_y = height;
+        int best_width = width;
+        for (unsigned i = 0; i < skyline.size(); ++i) {
+            int y = fit(i, rect_width, rect_height);
+            if (y >= 0 && (y < best_y || (y == best_y && skyline[i].width < best_width))) {
+                best_index = i;
+                best_y = y;
+                best_width = skyline[i].width;
+            }
+        }
+        if (best_index < 0)
+            return false;
+
+        out = {skyline[best_index].x, best_y, rect_width, rect_height};
+        used_area += long(rect_width) * rect_height;
+
+        // raise the skyline under the new rect, then trim the segments it covers
+        skyline.insert(skyline.begin() + best_index, {out.x, out.y + rect_height, rect_width});
+        for (unsigned i = best_index + 1; i < skyline.size();) {
+            segment &prev = skyline[i - 1];
+            if (skyline[i].x >= prev.x + prev.width)
+                break;
+            int shrink = prev.x + prev.width - skyline[i].x;
+            skyline[i].x += shrink;
+            skyline[i].width -= shrink;
+            if (skyline[i].width > 0)
+                break;
+            skyline.erase(skyline.begin() + i);
+        }
+        // merge neighbouring segments at the same height
+        for (unsigned i = 0; i + 1 < skyline.size();) {
+            if (skyline[i].y == skyline[i + 1].y) {
+                skyline[i].width += skyline[i + 1].width;
+                skyline.erase(skyline.begin() + i + 1);
+            } else {
+                ++i;
+            }
+        }
+        return true;
+    }
+
+    float fill_ratio() const { return float(used_area) / (float(width) * height); }
+
+  private:
+    // returns the y a rect would sit at when placed on segment i, or -1 if it does not fit
+    int fit(unsigned i, int rect_width, int rect_height) const {
+        if (skyline[i].x + rect_width > width)
+            return -1;
+        int y = 0;
+        for (int remaining = rect_width; remaining > 0; ++i) {
+            y = std::max(y, skyline[i].y);
+            if (y + rect_height > height)
+                return -1;
+            remaining -= skyline[i].width;
+        }
+        return y;
+    }
+};
+
+/**
+ * \brief Packs small RGBA8 images into shared atlas pages
+ * Each image is surrounded by a border of replicated edge texels so
+ * filtering and the first few mip levels do not bleed between neighbours
+ */
+struct texture_atlas {
+    struct page {
+        skyline_packer packer;
+        std::vector<uint8_t> pixels;
+        GLuint texture_id = 0;
+    };
+
+    struct entry {
+        unsigned page;
+        atlas_rect rect; // location of the image, excluding padding
+    };
+
+    int page_size;
+    int padding;
+    std::vector<page> pages;
+
+    texture_atlas(int page_size, int padding) : page_size(page_size), padding(padding) {}
+
+    /**
+     * \brief Copy an image into the first page it fits in, opening a new page if needed
+     * \return false if the image is too big for a single page
+     */
+    bool add(const uint8_t *data, int width, int height, entry &out) {
+        int padded_width = width + 2 * padding;
+        int padded_height = height + 2 * padding;
+        if (padded_width > page_size || padded_height > page_size)
+            return false;
+
+        atlas_rect rect;
+        unsigned page_index = 0;
+        while (page_index < pages.size() && !pages[page_index].packer.insert(padded_width, padded_height, rect))
+            ++page_index;
+        if (page_index == pages.size()) {
+            pages.push_back({skyline_packer(page_size, page_size), std::vector<uint8_t>(page_size * page_size * 4)});
+            pages.back().packer.insert(padded_width, padded_height, rect);
+        }
+
+        // blit with clamped source coordinates to fill the padding
+        std::vector<uint8_t> &pixels = pages[page_index].pixels;
+        for (int y = 0; y < padded_height; ++y) {
+            int src_y = std::clamp(y - padding, 0, height - 1);
+            for (int x = 0; x < padded_width; ++x) {
+                int src_x = std::clamp(x - padding, 0, width - 1);
+                std::memcpy(&pixels[((rect.y + y) * page_size + rect.x + x) * 4], &data[(src_y * width + src_x) * 4],
+                            4);
+            }
+        }
+
+        out = {page_index, {rect.x + padding, rect.y + padding, width, height}};
+        return true;
+    }
+
+    /**
+     * \brief Map a texture coordinate in [0, 1] on the source image into the atlas page
+     */
+    glm::vec2 remap(const entry &entry, glm::vec2 tex_coord) const {
+        return (glm::vec2(entry.rect.x, entry.rect.y) + tex_coord * glm::vec2(entry.rect.width, entry.rect.height)) /
+               float(page_size);
+    }
+
+    /**
+     * \brief Create the GL textures for every page and release the cpu copies
+     */
+    void upload() {
+        // only keep the mip levels that are still separated by the padding
+        int max_level = 0;
+        while ((2 << max_level) <= padding)
+            ++max_level;
+
+        for (page &page : pages) {
+            glGenTextures(1, &page.texture_id);
+            glBindTexture(GL_TEXTURE_2D, page.texture_id);
+
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+            // texels stay sharp up close like the unpacked textures, minified ones read the padded mips
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, max_level);
+
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, page_size, page_size, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                         page.pixels.data());
+            glGenerateMipmap(GL_TEXTURE_2D);
+
+            page.pixels.clear();
+            page.pixels.shrink_to_fit();
+        }
+    }
+
+    float fill_ratio() const {
+        long used = 0;
+        for (const page &page : pages)
+            used += page.packer.used_area;
+        return pages.empty() ? 0.0f : float(used) / (float(page_size) * page_size * pages.size());
+    }
+};
@@ -0,0 +1,546 @@
+// benchmarks for the cpu side of the engine, these do not need a window or an OpenGL context
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <random>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <thread>
+#include <cmath>
+
+#include "scene.hh"
+#include "culling.hh"
+#include "bvh.hh"
+#include "occlusion.hh"
+#include "sort.hh"
+#include "jobs.hh"
+#include "clusters.hh"
+#include "ao.hh"
+#include "profiler.hh"
+
+/**
+ * \brief Run a function repeatedly and return the average time of one run in milliseconds
+ */
+template <typename function> double time_ms(unsigned iterations, function f) {
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < iterations; ++i)
+        f();
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / iterations;
+}
+
+void report(const std::string &name, double ms, const std::string &note = "") {
+    std::cout << std::left << std::setw(48) << name << std::right << std::setw(10) << std::fixed
+              << std::setprecision(3) << ms << " ms" << (note.empty() ? "" : "  " + note) << '\n';
+}
+
+void bench_scene_graph() {
+    const unsigned level_sizes[] = {1000, 10000, 90000};
+    std::mt19937 rng(1);
+
+    // props grouped under randomly chosen parents, three levels deep
+    scene_graph scene;
+    std::vector<unsigned> handles, parents;
+    std::vector<unsigned> previous_level;
+    for (unsigned level_size : level_sizes) {
+        std::vector<unsigned> level;
+        for (unsigned i = 0; i < level_size; ++i) {
+            unsigned parent = previous_level.empty() ? scene_graph::NO_PARENT
+                                                     : previous_level[rng() % previous_level.size()];
+            glm::mat4 local = glm::translate(glm::mat4(1.0f), glm::vec3(rng() % 16, rng() % 16, rng() % 16));
+            level.push_back(scene.add_node(parent, glm::rotate(local, 0.1f, glm::vec3(0.0f, 1.0f, 0.0f))));
+            parents.push_back(parent);
+        }
+        handles.insert(handles.end(), level.begin(), level.end());
+        previous_level = level;
+    }
+    const unsigned node_count = handles.size();
+    scene.update();
+
+    std::cout << "scene graph, " << node_count << " nodes, " << worker_count() << " worker(s)\n";
+    report("  update, no changes", time_ms(100, [&] { scene.update(); }));
+
+    for (unsigned percent : {1, 10, 100}) {
+        unsigned moved = node_count * percent / 100;
+        // only the update is timed, not marking the nodes
+        double ms = 0;
+        for (unsigned iteration = 0; iteration < 100; ++iteration) {
+            for (unsigned i = 0; i < moved; ++i) {
+                unsigned handle = handles[(i * 7919u) % node_count];
+                scene.set_local(handle, scene.get_local(handle));
+            }
+            ms += time_ms(1, [&] { scene.update(); }) / 100;
+        }
+        unsigned recomputed = 0;
+        for (unsigned handle : handles)
+            recomputed += scene.get_world_changed(handle);
+        report("  update, " + std::to_string(percent) + "% of locals changed", ms,
+               std::to_string(recomputed) + " world transforms recomputed, " +
+                   (ms < 1.0 ? "within the 1 ms budget" : "OVER the 1 ms budget"));
+    }
+
+    // move a few nodes so the last update only visits the changed ones, then compare every world transform
+    // against its parent's, handles are created parents first
+    for (unsigned i = 0; i < node_count / 100; ++i) {
+        unsigned handle = handles[(i * 7919u) % node_count];
+        scene.set_local(handle, glm::translate(scene.get_local(handle), glm::vec3(1.0f, 0.0f, 0.0f)));
+    }
+    scene.update();
+    float max_error = 0.0f;
+    for (unsigned i = 0; i < node_count; ++i) {
+        glm::mat4 expected = parents[i] == scene_graph::NO_PARENT
+                                 ? scene.get_local(handles[i])
+                                 : scene.get_world(parents[i]) * scene.get_local(handles[i]);
+        const glm::mat4 &world = scene.get_world(handles[i]);
+        for (int column = 0; column < 4; ++column)
+            for (int row = 0; row < 4; ++row)
+                max_error = std::max(max_error, std::abs(expected[column][row] - world[column][row]));
+    }
+    // a node added after an update has to follow its parent like the others
+    scene_graph small;
+    unsigned root = small.add_node(scene_graph::NO_PARENT, glm::mat4(1.0f));
+    unsigned a = small.add_node(root, glm::translate(glm::mat4(1.0f), glm::vec3(1.0f, 0.0f, 0.0f)));
+    small.update();
+    unsigned b = small.add_node(root, glm::translate(glm::mat4(1.0f), glm::vec3(2.0f, 0.0f, 0.0f)));
+    small.set_local(root, glm::translate(glm::mat4(1.0f), glm::vec3(10.0f, 0.0f, 0.0f)));
+    small.update();
+    std::ostringstream check;
+    check << "largest world error " << max_error << ", added after an update x = " << small.get_world(b)[3].x
+          << " (expected 12), its sibling x = " << small.get_world(a)[3].x << " (expected 11)";
+    report("  check", 0.0, check.str());
+
+    // a full update reads every local and writes every world transform, so it can not beat copying them
+    std::vector<glm::mat4> locals(node_count), worlds(node_count);
+    double copy_ms = time_ms(100, [&] { std::copy(locals.begin(), locals.end(), worlds.begin()); });
+    report("  copy of every local, memory bound", copy_ms);
+}
+
+void bench_frustum_culling() {
+    const unsigned box_count = 1000000;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.5f, 5.0f);
+
+    bounds_soa bounds;
+    std::vector<aabb> boxes;
+    for (unsigned i = 0; i < box_count; ++i) {
+        glm::vec3 center(position(rng), position(rng) * 0.1f, position(rng));
+        glm::vec3 extents(size(rng), size(rng), size(rng));
+        boxes.push_back({center - extents, center + extents});
+        bounds.push_back(boxes.back());
+    }
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(1.0f, 10.0f, 1.0f), glm::vec3(0, 1, 0));
+    frustum frustum = frustum::from_matrix(projection * view);
+
+    std::vector<uint8_t> visible(box_count);
+    unsigned visible_count = 0;
+    std::cout << "frustum culling, " << box_count << " boxes\n";
+    double ms = time_ms(20, [&] { visible_count = frustum_cull(frustum, bounds, 0, box_count, visible.data()); });
+    report("  simd kernel", ms, std::to_string(visible_count) + " visible");
+
+    unsigned scalar_count = 0;
+    ms = time_ms(20, [&] {
+        scalar_count = 0;
+        for (const aabb &box : boxes)
+            scalar_count += frustum.intersects(box);
+    });
+    report("  scalar reference", ms, std::to_string(scalar_count) + " visible");
+}
+
+void bench_bvh() {
+    const unsigned primitive_count = 1000000;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+    std::uniform_real_distribution<float> size(0.5f, 5.0f);
+    std::uniform_real_distribution<float> jitter(-1.0f, 1.0f);
+
+    std::vector<aabb> primitives;
+    for (unsigned i = 0; i < primitive_count; ++i) {
+        glm::vec3 center(position(rng), position(rng) * 0.1f, position(rng));
+        glm::vec3 extents(size(rng), size(rng), size(rng));
+        primitives.push_back({center - extents, center + extents});
+    }
+
+    std::cout << "bvh, " << primitive_count << " primitives, " << worker_count() << " worker(s)\n";
+    bvh tree;
+    double ms = time_ms(1, [&] { tree.build(primitives); });
+    report("  binned sah build", ms, std::to_string(tree.nodes.size()) + " nodes");
+
+    for (aabb &box : primitives) {
+        glm::vec3 offset(jitter(rng), jitter(rng), jitter(rng));
+        box = {box.min + offset, box.max + offset};
+    }
+    report("  refit after every primitive moved", time_ms(5, [&] { tree.refit(primitives); }));
+
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 10.0f, 0.0f), glm::vec3(1.0f, 10.0f, 1.0f), glm::vec3(0, 1, 0));
+    frustum frustum = frustum::from_matrix(projection * view);
+    unsigned visible = 0, visited = 0;
+    ms = time_ms(20, [&] {
+        visible = 0;
+        visited = tree.cull(frustum, [&](unsigned) { ++visible; });
+    });
+    unsigned expected = 0;
+    for (const aabb &box : primitives)
+        expected += frustum.intersects(box);
+    report("  hierarchical frustum cull", ms,
+           std::to_string(visible) + " visible (brute force " + std::to_string(expected) + "), " +
+               std::to_string(visited) + " nodes visited");
+
+    const unsigned query_count = 10000;
+    unsigned found = 0;
+    ms = time_ms(1, [&] {
+        for (unsigned i = 0; i < query_count; ++i) {
+            glm::vec3 center(position(rng), 0.0f, position(rng));
+            tree.query({center - glm::vec3(10.0f), center + glm::vec3(10.0f)}, [&](unsigned) { ++found; });
+        }
+    });
+    report("  " + std::to_string(query_count) + " box queries", ms, std::to_string(found) + " primitives found");
+
+    const unsigned ray_count = 100000;
+    unsigned hits = 0;
+    ms = time_ms(1, [&] {
+        for (unsigned i = 0; i < ray_count; ++i) {
+            glm::vec3 origin(position(rng), 0.0f, position(rng));
+            glm::vec3 direction = glm::normalize(glm::vec3(jitter(rng), jitter(rng) * 0.1f, jitter(rng)));
+            float t_max = 1000.0f;
+            hits += tree.raycast(origin, direction, t_max, [&](unsigned primitive, float &t) {
+                float t_near;
+                if (!ray_intersects(primitives[primitive], origin, 1.0f / direction, t, t_near))
+                    return false;
+                t = t_near;
+                return true;
+            });
+        }
+    });
+    report("  " + std::to_string(ray_count) + " closest hit rays", ms, std::to_string(hits) + " hits");
+}
+
+void bench_occlusion() {
+    const unsigned box_count = 100000;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(-60.0f, 60.0f);
+    std::uniform_real_distribution<float> depth(-200.0f, -1.0f);
+    std::uniform_real_distribution<float> size(0.2f, 2.0f);
+
+    // a wall at z = -20 with a doorway in the middle, built from 1x1 quads so there are plenty of triangles
+    const float wall_z = -20.0f;
+    std::vector<glm::vec3> wall;
+    for (int y = -20; y < 20; ++y) {
+        for (int x = -40; x < 40; ++x) {
+            if (x >= -2 && x < 2 && y >= -20 && y < 2)
+                continue;
+            glm::vec3 a(x, y, wall_z), b(x + 1, y, wall_z), c(x + 1, y + 1, wall_z), d(x, y + 1, wall_z);
+            wall.insert(wall.end(), {a, b, c, a, c, d});
+        }
+    }
+
+    std::vector<aabb> boxes;
+    for (unsigned i = 0; i < box_count; ++i) {
+        glm::vec3 center(position(rng), position(rng) * 0.3f, depth(rng));
+        glm::vec3 extents(size(rng), size(rng), size(rng));
+        boxes.push_back({center - extents, center + extents});
+    }
+
+    glm::mat4 projection = glm::perspective(glm::radians(60.0f), 16.0f / 9.0f, 0.1f, 300.0f);
+    glm::mat4 view = glm::lookAt(glm::vec3(0.0f), glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0, 1, 0));
+    glm::mat4 view_projection = projection * view;
+
+    occlusion_buffer occlusion(256, 128);
+    std::cout << "occlusion culling, " << wall.size() / 3 << " occluder triangles, " << box_count << " boxes, "
+              << occlusion.width << "x" << occlusion.height << " depth buffer\n";
+    double ms = time_ms(100, [&] {
+        occlusion.clear();
+        occlusion.add_occluder(wall, view_projection);
+        occlusion.rasterize();
+    });
+    report("  clear, bin and rasterize", ms, std::to_string(occlusion.triangles_added) + " triangles on screen");
+
+    std::vector<uint8_t> visible(box_count);
+    ms = time_ms(20, [&] {
+        for (unsigned i = 0; i < box_count; ++i)
+            visible[i] = occlusion.test(boxes[i], view_projection);
+    });
+    // a box reaching in front of the wall must never be culled
+    unsigned occluded = 0, wrongly_occluded = 0;
+    for (unsigned i = 0; i < box_count; ++i) {
+        occluded += !visible[i];
+        wrongly_occluded += !visible[i] && boxes[i].max.z > wall_z;
+    }
+    report("  test boxes", ms,
+           std::to_string(occluded) + " occluded, " + std::to_string(wrongly_occluded) + " in front of the wall");
+}
+
+void bench_sorting() {
+    const unsigned item_count = 20000;
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> position(-500.0f, 500.0f);
+
+    std::vector<glm::vec3> centers(item_count);
+    for (glm::vec3 &center : centers)
+        center = glm::vec3(position(rng), position(rng) * 0.1f, position(rng));
+    auto fill_keys = [&](std::vector<sort_item> &items, glm::vec3 camera) {
+        for (sort_item &item : items)
+            item.key = float_sort_key(glm::distance(centers[item.index], camera));
+    };
+
+    std::vector<sort_item> unsorted(item_count), items, scratch;
+    for (unsigned i = 0; i < item_count; ++i)
+        unsorted[i] = {0, i};
+    fill_keys(unsorted, glm::vec3(0.0f));
+
+    std::cout << "depth sorting, " << item_count << " draws\n";
+    double ms = time_ms(20, [&] {
+        items = unsorted;
+        std::sort(items.begin(), items.end(), [](sort_item a, sort_item b) { return a.key < b.key; });
+    });
+    report("  std::sort from scratch", ms);
+    ms = time_ms(20, [&] {
+        items = unsorted;
+        radix_sort(items, scratch);
+    });
+    report("  radix sort from scratch", ms);
+
+    glm::vec3 camera(0.0f);
+    report("  key update alone", time_ms(20, [&] { fill_keys(items, camera); }));
+
+    // last frame's order is resorted after the camera moves by a different amount each time, a step of 1 moves
+    // items about 17 places, past the insertion sort's budget of 2, where a radix sort is the cheaper one
+    for (float step : {0.0f, 0.001f, 0.1f, 1.0f}) {
+        unsigned fallbacks = 0;
+        ms = time_ms(100, [&] {
+            camera += glm::vec3(step, 0.0f, step * 0.5f);
+            fill_keys(items, camera);
+            fallbacks += coherent_sort(items, scratch);
+        });
+        bool sorted =
+            std::is_sorted(items.begin(), items.end(), [](sort_item a, sort_item b) { return a.key < b.key; });
+        std::ostringstream name;
+        name << "  coherent resort, camera step " << step;
+        report(name.str(), ms,
+               "key update included, " + std::to_string(fallbacks) + "/100 radix" +
+                   (fallbacks > 0 ? " as items moved past the insertion budget" : "") + (sorted ? "" : ", NOT SORTED"));
+    }
+}
+
+void bench_jobs() {
+    const unsigned empty_jobs = 100000;
+    const size_t item_count = 1 << 20, items_per_job = 1024;
+    std::vector<float> output(item_count);
+    auto work = [&output](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i)
+            output[i] = std::sqrt(float(i)) * std::sin(float(i));
+    };
+
+    // a system of one thread has no workers and runs every job as it is started, so it would measure nothing,
+    // the smallest one that really queues jobs has one worker besides the waiting thread
+    unsigned hardware_threads = std::thread::hardware_concurrency();
+    std::vector<unsigned> thread_counts{2, 4, std::max(2u, hardware_threads)};
+    std::sort(thread_counts.begin(), thread_counts.end());
+    thread_counts.erase(std::unique(thread_counts.begin(), thread_counts.end()), thread_counts.end());
+
+    std::cout << "job system, " << hardware_threads << " hardware thread(s)"
+              << (hardware_threads < 2 ? ", every system below has more threads than cores" : "") << "\n";
+    auto per_job = [&](double ms) {
+        std::ostringstream note;
+        note << std::fixed << std::setprecision(1) << ms * 1e6 / empty_jobs << " ns/job";
+        return note.str();
+    };
+    work(0, item_count); // the first pass also faults the output pages in
+    double loop_ms = time_ms(10, [&] { work(0, item_count); });
+    report("  " + std::to_string(item_count) + " items in a plain loop", loop_ms);
+    for (unsigned thread_count : thread_counts) {
+        job_system system(thread_count);
+        std::string threads = std::to_string(thread_count) + " threads";
+
+        // jobs started by a thread outside the system go through the shared queue
+        double ms = time_ms(5, [&] {
+            job_counter counter;
+            for (unsigned i = 0; i < empty_jobs; ++i)
+                system.run([] {}, counter);
+            system.wait(counter);
+        });
+        report("  empty jobs from outside, " + threads, ms, per_job(ms));
+
+        // jobs started by a job go on its worker's deque, and the other workers steal them
+        ms = time_ms(5, [&] {
+            job_counter root;
+            system.run(
+                [&] {
+                    job_counter counter;
+                    for (unsigned i = 0; i < empty_jobs; ++i)
+                        system.run([] {}, counter);
+                    system.wait(counter);
+                },
+                root);
+            system.wait(root);
+        });
+        report("  empty jobs from a job, " + threads, ms, per_job(ms));
+
+        // fine grained work, a thousand items of a few dozen cycles each per job
+        ms = time_ms(5, [&] {
+            job_counter counter;
+            for (size_t begin = 0; begin < item_count; begin += items_per_job)
+                system.run([&work, begin, items_per_job] { work(begin, begin + items_per_job); }, counter);
+            system.wait(counter);
+        });
+        std::ostringstream speedup;
+        speedup << std::fixed << std::setprecision(2) << loop_ms / ms << "x the plain loop";
+        report("  " + std::to_string(item_count / items_per_job) + " fine grained jobs, " + threads, ms,
+               speedup.str());
+    }
+}
+
+void bench_clusters() {
+    glm::vec3 eye(0.0f, 5.0f, 0.0f);
+    glm::mat4 view = glm::lookAt(eye, eye + glm::vec3(0.0f, 0.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.1f, 100.0f);
+    std::mt19937 rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+
+    std::cout << "clustered lighting, " << light_clusters::CLUSTER_COUNT << " clusters\n";
+    for (unsigned light_count : {256, 1024, 4096}) {
+        // lights scattered over a level in front of the camera
+        std::vector<light> lights(light_count);
+        for (light &light : lights) {
+            light.position = glm::vec3(unit(rng) * 200.0f - 100.0f, unit(rng) * 20.0f, -unit(rng) * 100.0f);
+            light.radius = 2.0f + unit(rng) * 4.0f;
+            light.color = glm::vec3(1.0f);
+        }
+        light_clusters clusters;
+        double ms = time_ms(20, [&] { clusters.bin(lights, view, projection); });
+
+        // every light around a point in view has to be in the list of the cluster the shader looks up for it
+        const unsigned grid_x = light_clusters::GRID_X, grid_y = light_clusters::GRID_Y;
+        const unsigned grid_z = light_clusters::GRID_Z;
+        unsigned missed = 0, samples = 10000, most = 0;
+        float depth_scale = grid_z / std::log(100.0f / 0.1f);
+        for (unsigned i = 0; i < samples; ++i) {
+            glm::vec3 ndc(unit(rng) * 2.0f - 1.0f, unit(rng) * 2.0f - 1.0f, 0.0f);
+            float depth = 0.1f * std::pow(1000.0f, unit(rng));
+            glm::vec3 view_point(ndc.x * depth / projection[0][0], ndc.y * depth / projection[1][1], -depth);
+            glm::vec3 world_point = glm::vec3(glm::inverse(view) * glm::vec4(view_point, 1.0f));
+            unsigned x = std::min(unsigned((ndc.x * 0.5f + 0.5f) * grid_x), grid_x - 1);
+            unsigned y = std::min(unsigned((ndc.y * 0.5f + 0.5f) * grid_y), grid_y - 1);
+            unsigned z = std::min(unsigned(std::max(std::log(depth / 0.1f) * depth_scale, 0.0f)), grid_z - 1);
+            unsigned cluster = x + grid_x * (y + grid_y * z);
+            uint32_t first = clusters.ranges[cluster * 2], count = clusters.ranges[cluster * 2 + 1];
+            most = std::max(most, count);
+            for (uint32_t l = 0; l < light_count; ++l) {
+                if (glm::distance(lights[l].position, world_point) >= lights[l].radius)
+                    continue;
+                const uint32_t *list = clusters.indices.data() + first;
+                missed += std::find(list, list + count, l) == list + count;
+            }
+        }
+        // lights only go missing from clusters that overflowed
+        report("  bin " + std::to_string(light_count) + " lights", ms,
+               std::to_string(clusters.indices.size()) + " indices, up to " + std::to_string(most) +
+                   " per sampled cluster, " + std::to_string(clusters.overflowed) + " clusters overflowed, " +
+                   std::to_string(missed) + " lights missed");
+    }
+}
+
+void bench_ao() {
+    // a floor of 1x1 quads with boxes standing on it, each box side split into quads as well
+    std::vector<glm::vec3> positions, normals;
+    auto add_quad = [&](glm::vec3 corner, glm::vec3 edge1, glm::vec3 edge2) {
+        glm::vec3 b = corner + edge1, c = corner + edge1 + edge2, d = corner + edge2;
+        positions.insert(positions.end(), {corner, b, c, corner, c, d});
+        normals.insert(normals.end(), 6, glm::normalize(glm::cross(edge1, edge2)));
+    };
+    const int floor_size = 64;
+    for (int z = 0; z < floor_size; ++z)
+        for (int x = 0; x < floor_size; ++x)
+            add_quad(glm::vec3(x, 0, z), glm::vec3(0, 0, 1), glm::vec3(1, 0, 0));
+    for (int box_z = 8; box_z < floor_size; box_z += 16) {
+        for (int box_x = 8; box_x < floor_size; box_x += 16) {
+            glm::vec3 origin(box_x, 0, box_z);
+            for (int i = 0; i < 4; ++i) {
+                for (int j = 0; j < 4; ++j) {
+                    add_quad(origin + glm::vec3(i, j, 0), glm::vec3(0, 1, 0), glm::vec3(1, 0, 0));
+                    add_quad(origin + glm::vec3(i, j, 4), glm::vec3(1, 0, 0), glm::vec3(0, 1, 0));
+                    add_quad(origin + glm::vec3(0, j, i), glm::vec3(0, 0, 1), glm::vec3(0, 1, 0));
+                    add_quad(origin + glm::vec3(4, j, i), glm::vec3(0, 1, 0), glm::vec3(0, 0, 1));
+                    add_quad(origin + glm::vec3(i, 4, j), glm::vec3(0, 0, 1), glm::vec3(1, 0, 0));
+                }
+            }
+        }
+    }
+    std::vector<uint8_t> casts(positions.size() / 3, true);
+
+    std::cout << "ambient occlusion, " << positions.size() / 3 << " triangles\n";
+    ao_bake_settings settings;
+    ambient_occlusion occlusion;
+    double ms = time_ms(1, [&] { occlusion = ambient_occlusion::bake(positions, normals, casts, settings); });
+    std::ostringstream throughput;
+    throughput << std::setprecision(2) << occlusion.rays_cast / ms / 1e3 << " Mrays/s, " << occlusion.unique_vertices
+               << " unique vertices";
+    report("  bake", ms, throughput.str());
+
+    // floor corners next to a box are partly occluded, ones out in the open not at all
+    float next_to_box = 1.0f, open = 0.0f;
+    for (size_t i = 0; i < positions.size(); ++i) {
+        if (normals[i].y < 0.5f || positions[i].y > 0.0f)
+            continue;
+        if (positions[i] == glm::vec3(7, 0, 10))
+            next_to_box = std::min(next_to_box, occlusion.value(i));
+        if (positions[i] == glm::vec3(0, 0, 0))
+            open = std::max(open, occlusion.value(i));
+    }
+    std::ostringstream values;
+    values << std::setprecision(2) << "next to a box " << next_to_box << ", in the open " << open;
+    report("  check", 0.0, values.str());
+}
+
+void bench_profiler() {
+    const unsigned zone_count = 1 << 20;
+    std::cout << "profiler, " << zone_count << " zones\n";
+    volatile unsigned sink = 0;
+    double baseline_ms = time_ms(5, [&] {
+        for (unsigned i = 0; i < zone_count; ++i)
+            sink = sink + i;
+    });
+    double disabled_ms = time_ms(5, [&] {
+        for (unsigned i = 0; i < zone_count; ++i) {
+            PROFILE_ZONE("bench");
+            sink = sink + i;
+        }
+    });
+    profile().start();
+    double enabled_ms = time_ms(5, [&] {
+        for (unsigned i = 0; i < zone_count; ++i) {
+            PROFILE_ZONE("bench");
+            sink = sink + i;
+        }
+    });
+    profile().stop();
+    auto per_zone = [&](double ms) {
+        std::ostringstream note;
+        note << std::fixed << std::setprecision(1) << std::max(ms - baseline_ms, 0.0) * 1e6 / zone_count
+             << " ns per zone";
+        return note.str();
+    };
+    report("  stopped", disabled_ms, per_zone(disabled_ms));
+    report("  recording", enabled_ms, per_zone(enabled_ms));
+}
+
+int main() {
+    bench_scene_graph();
+    bench_frustum_culling();
+    bench_bvh();
+    bench_occlusion();
+    bench_sorting();
+    bench_jobs();
+    bench_clusters();
+    bench_ao();
+    bench_profiler();
+    return 0;
+}
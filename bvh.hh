@@ -0,0 +1,484 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <vector>
+#include <atomic>
+#include <limits>
+#include <cstdint>
+#include <algorithm>
+
+#include "culling.hh"
+#include "parallel.hh"
+#include "profiler.hh"
+
+/**
+ * \brief Slab test of a ray against a box
+ * \param t_near set to the distance the ray enters the box at, if it hits within [0, t_max]
+ */
+inline bool ray_intersects(const aabb &box, glm::vec3 origin, glm::vec3 inverse_direction, float t_max,
+                           float &t_near) {
+    glm::vec3 t0 = (box.min - origin) * inverse_direction;
+    glm::vec3 t1 = (box.max - origin) * inverse_direction;
+    glm::vec3 t_enter = glm::min(t0, t1), t_exit = glm::max(t0, t1);
+    t_near = std::max(std::max(t_enter.x, t_enter.y), std::max(t_enter.z, 0.0f));
+    float t_far = std::min(std::min(t_exit.x, t_exit.y), std::min(t_exit.z, t_max));
+    return t_near <= t_far;
+}
+
+/**
+ * \brief Two sided Moller-Trumbore test of a ray against the triangle abc
+ * \param t set to the hit distance, if the ray hits within (0, t_max)
+ */
+inline bool ray_intersects(glm::vec3 a, glm::vec3 b, glm::vec3 c, glm::vec3 origin, glm::vec3 direction,
+                           float t_max, float &t) {
+    glm::vec3 edge1 = b - a, edge2 = c - a;
+    glm::vec3 p = glm::cross(direction, edge2);
+    float determinant = glm::dot(edge1, p);
+    if (std::abs(determinant) < 1e-12f)
+        return false;
+    float inverse_determinant = 1.0f / determinant;
+    glm::vec3 to_origin = origin - a;
+    float u = glm::dot(to_origin, p) * inverse_determinant;
+    if (u < 0.0f || u > 1.0f)
+        return false;
+    glm::vec3 q = glm::cross(to_origin, edge1);
+    float v = glm::dot(direction, q) * inverse_determinant;
+    if (v < 0.0f || u + v > 1.0f)
+        return false;
+    t = glm::dot(edge2, q) * inverse_determinant;
+    return t > 0.0f && t < t_max;
+}
+
+inline bool overlaps(const aabb &a, const aabb &b) {
+    return glm::all(glm::lessThanEqual(a.min, b.max)) && glm::all(glm::lessThanEqual(b.min, a.max));
+}
+
+/**
+ * \brief Bounding volume hierarchy over a set of primitive boxes
+ * Built top down with a binned surface area heuristic, large ranges are binned and built on several threads.
+ * Children are always stored after their parent, so refitting is a single reverse pass
+ */
+struct bvh {
+    static const unsigned BIN_COUNT = 16;
+    static const unsigned MAX_LEAF_SIZE = 64;
+    static const unsigned MAX_DEPTH = 160; // below SAH_MAX_DEPTH nodes are split at the median, which bounds this
+
+    struct node {
+        aabb bounds;
+        unsigned first; // leaf: first position in indices, inner node: left child, the right child follows it
+        unsigned count; // primitives in a leaf, 0 for inner nodes
+
+        bool leaf() const { return count > 0; }
+    };
+
+    std::vector<node> nodes;
+    std::vector<unsigned> indices;  // primitive indices, each leaf references a contiguous range
+    bounds_soa ordered_bounds;      // primitive bounds in the same order as indices, for the simd leaf tests
+    unsigned max_leaf_size = 8;
+
+    /**
+     * \brief Build the hierarchy, primitive i of the queries is primitives[i]
+     */
+    void build(const std::vector<aabb> &primitives, unsigned leaf_size = 8) {
+        PROFILE_ZONE("build bvh");
+        max_leaf_size = std::clamp(leaf_size, 1u, MAX_LEAF_SIZE);
+        indices.resize(primitives.size());
+        for (unsigned i = 0; i < indices.size(); ++i)
+            indices[i] = i;
+        nodes.clear();
+        ordered_bounds.clear();
+        if (primitives.empty())
+            return;
+
+        // the build partitions copies of the primitives, so every pass reads memory in order
+        std::vector<build_primitive> work(primitives.size());
+        parallel_for(0, primitives.size(), 1 << 16, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                work[i] = {primitives[i], primitives[i].center(), unsigned(i)};
+        });
+
+        nodes.resize(2 * primitives.size() - 1);
+        std::atomic<unsigned> node_count{1};
+        build_node(0, 0, primitives.size(), work, node_count, 0);
+        nodes.resize(node_count);
+
+        for (unsigned i = 0; i < work.size(); ++i) {
+            indices[i] = work[i].index;
+            ordered_bounds.push_back(work[i].bounds);
+        }
+    }
+
+    /**
+     * \brief Recompute the node bounds after primitives moved, keeping the tree structure
+     * Cheaper than a rebuild, but the tree gets less efficient the further primitives move
+     */
+    void refit(const std::vector<aabb> &primitives) {
+        parallel_for(0, indices.size(), 1 << 16, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i)
+                ordered_bounds.set(i, primitives[indices[i]]);
+        });
+        parallel_for(0, nodes.size(), 1 << 16, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                node &node = nodes[i];
+                if (!node.leaf())
+                    continue;
+                node.bounds = aabb();
+                for (unsigned j = node.first; j < node.first + node.count; ++j)
+                    node.bounds.expand(primitives[indices[j]]);
+            }
+        });
+        for (size_t i = nodes.size(); i-- > 0;) {
+            node &node = nodes[i];
+            if (node.leaf())
+                continue;
+            node.bounds = nodes[node.first].bounds;
+            node.bounds.expand(nodes[node.first + 1].bounds);
+        }
+    }
+
+    /**
+     * \brief Call visible(primitive) for every primitive whose box intersects the frustum
+     * Subtrees entirely outside are skipped, and planes a subtree is entirely inside of are not tested again below it
+     * \param root node to start at, subtrees() splits the tree into roots that can be culled on separate threads
+     * \return the number of nodes visited
+     */
+    template <typename callback_type>
+    unsigned cull(const frustum &frustum, callback_type visible, unsigned root = 0) const {
+        if (nodes.empty())
+            return 0;
+        struct entry {
+            unsigned node;
+            unsigned plane_mask; // planes the node still straddles
+        };
+        std::vector<entry> stack{{root, (1u << 6) - 1}};
+        uint8_t leaf_visible[MAX_LEAF_SIZE];
+        unsigned visited = 0;
+
+        while (!stack.empty()) {
+            entry entry = stack.back();
+            stack.pop_back();
+            const node &node = nodes[entry.node];
+            ++visited;
+
+            glm::vec3 center = node.bounds.center(), extents = node.bounds.extents();
+            bool outside = false;
+            for (unsigned plane_index = 0; plane_index < 6 && !outside; ++plane_index) {
+                if (!(entry.plane_mask & (1u << plane_index)))
+                    continue;
+                const glm::vec4 &plane = frustum.planes[plane_index];
+                float distance = glm::dot(glm::vec3(plane), center) + plane.w;
+                float radius = glm::dot(glm::abs(glm::vec3(plane)), extents);
+                if (distance + radius < 0.0f)
+                    outside = true;
+                else if (distance - radius >= 0.0f)
+                    entry.plane_mask &= ~(1u << plane_index);
+            }
+            if (outside)
+                continue;
+
+            if (!node.leaf()) {
+                stack.push_back({node.first + 1, entry.plane_mask});
+                stack.push_back({node.first, entry.plane_mask});
+            } else if (entry.plane_mask == 0) {
+                for (unsigned i = node.first; i < node.first + node.count; ++i)
+                    visible(indices[i]);
+            } else {
+                frustum_cull(frustum, ordered_bounds, node.first, node.first + node.count, leaf_visible);
+                for (unsigned i = 0; i < node.count; ++i)
+                    if (leaf_visible[i])
+                        visible(indices[node.first + i]);
+            }
+        }
+        return visited;
+    }
+
+    /**
+     * \brief Disjoint subtrees that together cover every primitive, at least min_count of them unless
+     * the tree runs out of inner nodes. The biggest subtree is split first so they end up similar in size
+     */
+    std::vector<unsigned> subtrees(unsigned min_count) const {
+        std::vector<unsigned> roots;
+        if (nodes.empty())
+            return roots;
+        roots.push_back(0);
+        while (roots.size() < min_count) {
+            // the root with the largest bounds stands in for the one with the most primitives
+            auto biggest = roots.end();
+            float biggest_area = -1.0f;
+            for (auto root = roots.begin(); root != roots.end(); ++root) {
+                if (nodes[*root].leaf())
+                    continue;
+                glm::vec3 size = nodes[*root].bounds.max - nodes[*root].bounds.min;
+                float area = size.x * size.y + size.y * size.z + size.z * size.x;
+                if (area > biggest_area) {
+                    biggest_area = area;
+                    biggest = root;
+                }
+            }
+            if (biggest == roots.end())
+                break;
+            unsigned left = nodes[*biggest].first;
+            *biggest = left;
+            roots.push_back(left + 1);
+        }
+        return roots;
+    }
+
+    /**
+     * \brief Call callback(primitive) for every primitive whose box overlaps the query box
+     */
+    template <typename callback_type> void query(const aabb &box, callback_type callback) const {
+        if (nodes.empty())
+            return;
+        std::vector<unsigned> stack{0};
+        while (!stack.empty()) {
+            const node &node = nodes[stack.back()];
+            stack.pop_back();
+            if (!overlaps(node.bounds, box))
+                continue;
+            if (!node.leaf()) {
+                stack.push_back(node.first + 1);
+                stack.push_back(node.first);
+                continue;
+            }
+            for (unsigned i = node.first; i < node.first + node.count; ++i)
+                if (overlaps(primitive_bounds(i), box))
+                    callback(indices[i]);
+        }
+    }
+
+    /**
+     * \brief Find the closest hit along a ray, visiting nearer children first
+     * \param intersect bool(primitive, float &t_max) tests a primitive, on a hit it shortens t_max and returns true
+     * \param any_hit stop at the first hit found instead of the closest, for occlusion rays
+     * \return whether anything was hit, t_max is the distance to the hit
+     */
+    template <typename intersect_type>
+    bool raycast(glm::vec3 origin, glm::vec3 direction, float &t_max, intersect_type intersect,
+                 bool any_hit = false) const {
+        auto intersect_leaf = [&](unsigned first, unsigned count, float &leaf_t_max) {
+            bool hit = false;
+            for (unsigned i = first; i < first + count; ++i) {
+                if (intersect(indices[i], leaf_t_max)) {
+                    hit = true;
+                    if (any_hit)
+                        return true;
+                }
+            }
+            return hit;
+        };
+        return raycast_leaves(origin, direction, t_max, intersect_leaf, any_hit);
+    }
+
+    /**
+     * \brief raycast() that tests a whole leaf at once, primitives stored in the order of indices can be
+     * tested several at a time
+     * \param intersect_leaf bool(first, count, float &t_max) tests the primitives at indices[first, first + count)
+     */
+    template <typename intersect_type>
+    bool raycast_leaves(glm::vec3 origin, glm::vec3 direction, float &t_max, intersect_type intersect_leaf,
+                        bool any_hit = false) const {
+        if (nodes.empty())
+            return false;
+        glm::vec3 inverse_direction = 1.0f / direction;
+        float t_near;
+        if (!ray_intersects(nodes[0].bounds, origin, inverse_direction, t_max, t_near))
+            return false;
+
+        struct entry {
+            unsigned node;
+            float t_near;
+        };
+        entry stack[MAX_DEPTH + 2];
+        unsigned stack_size = 0;
+        stack[stack_size++] = {0, t_near};
+        bool hit = false;
+
+        while (stack_size > 0) {
+            entry entry = stack[--stack_size];
+            if (entry.t_near > t_max)
+                continue;
+            const node &node = nodes[entry.node];
+            if (node.leaf()) {
+                if (intersect_leaf(node.first, node.count, t_max)) {
+                    hit = true;
+                    if (any_hit)
+                        return true;
+                }
+                continue;
+            }
+
+            float t_left, t_right;
+            bool hit_left = ray_intersects(nodes[node.first].bounds, origin, inverse_direction, t_max, t_left);
+            bool hit_right = ray_intersects(nodes[node.first + 1].bounds, origin, inverse_direction, t_max, t_right);
+            // push the farther child first so the nearer one is visited next
+            if (hit_left && hit_right) {
+                bool left_first = t_left <= t_right;
+                stack[stack_size++] = {left_first ? node.first + 1 : node.first, left_first ? t_right : t_left};
+                stack[stack_size++] = {left_first ? node.first : node.first + 1, left_first ? t_left : t_right};
+            } else if (hit_left) {
+                stack[stack_size++] = {node.first, t_left};
+            } else if (hit_right) {
+                stack[stack_size++] = {node.first + 1, t_right};
+            }
+        }
+        return hit;
+    }
+
+  private:
+    static const unsigned SAH_MAX_DEPTH = 96;
+
+    struct build_primitive {
+        aabb bounds;
+        glm::vec3 centroid;
+        unsigned index;
+    };
+
+    // bins for one axis while searching for a split
+    struct bin {
+        aabb bounds;
+        unsigned count = 0;
+    };
+
+    static float surface_area(const aabb &box) {
+        if (box.empty())
+            return 0.0f;
+        glm::vec3 size = box.max - box.min;
+        return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+    }
+
+    aabb primitive_bounds(unsigned i) const {
+        glm::vec3 center(ordered_bounds.center_x[i], ordered_bounds.center_y[i], ordered_bounds.center_z[i]);
+        glm::vec3 extents(ordered_bounds.extent_x[i], ordered_bounds.extent_y[i], ordered_bounds.extent_z[i]);
+        return {center - extents, center + extents};
+    }
+
+    void build_node(unsigned node_index, unsigned begin, unsigned end, std::vector<build_primitive> &work,
+                    std::atomic<unsigned> &node_count, unsigned depth) {
+        const unsigned parallel_threshold = 1 << 15;
+        const unsigned count = end - begin;
+        node &node = nodes[node_index];
+
+        // bounds of the primitives and of their centroids, bins for all three axes are filled in the same pass
+        struct range_info {
+            aabb bounds, centroid_bounds;
+        };
+        auto gather_bounds = [&](size_t slice_begin, size_t slice_end) {
+            range_info info;
+            for (size_t i = slice_begin; i < slice_end; ++i) {
+                info.bounds.expand(work[i].bounds);
+                info.centroid_bounds.expand(work[i].centroid);
+            }
+            return info;
+        };
+        range_info info = parallel_reduce(begin, end, parallel_threshold, gather_bounds,
+                                          [](range_info &a, const range_info &b) {
+                                              a.bounds.expand(b.bounds);
+                                              a.centroid_bounds.expand(b.centroid_bounds);
+                                          });
+        node.bounds = info.bounds;
+
+        if (count <= max_leaf_size) {
+            node.first = begin;
+            node.count = count;
+            return;
+        }
+
+        glm::vec3 centroid_size = info.centroid_bounds.max - info.centroid_bounds.min;
+        glm::vec3 bin_scale = glm::vec3(BIN_COUNT) / glm::max(centroid_size, glm::vec3(1e-20f));
+        auto bin_of = [&](glm::vec3 centroid, int axis) {
+            int b = int((centroid[axis] - info.centroid_bounds.min[axis]) * bin_scale[axis]);
+            return std::clamp(b, 0, int(BIN_COUNT) - 1);
+        };
+
+        struct bin_set {
+            bin bins[3][BIN_COUNT];
+        };
+        auto fill_bins = [&](size_t slice_begin, size_t slice_end) {
+            bin_set set;
+            for (size_t i = slice_begin; i < slice_end; ++i) {
+                for (int axis = 0; axis < 3; ++axis) {
+                    bin &bin = set.bins[axis][bin_of(work[i].centroid, axis)];
+                    bin.bounds.expand(work[i].bounds);
+                    ++bin.count;
+                }
+            }
+            return set;
+        };
+        bin_set bins = parallel_reduce(begin, end, parallel_threshold, fill_bins, [](bin_set &a, const bin_set &b) {
+            for (int axis = 0; axis < 3; ++axis) {
+                for (unsigned i = 0; i < BIN_COUNT; ++i) {
+                    a.bins[axis][i].bounds.expand(b.bins[axis][i].bounds);
+                    a.bins[axis][i].count += b.bins[axis][i].count;
+                }
+            }
+        });
+
+        // sweep the planes between bins, cost = area(left) * count(left) + area(right) * count(right)
+        float best_cost = std::numeric_limits<float>::max();
+        int best_axis = -1;
+        unsigned best_split = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (centroid_size[axis] <= 0.0f)
+                continue;
+            float right_cost[BIN_COUNT];
+            aabb right_bounds;
+            unsigned right_count = 0;
+            for (unsigned i = BIN_COUNT - 1; i > 0; --i) {
+                right_bounds.expand(bins.bins[axis][i].bounds);
+                right_count += bins.bins[axis][i].count;
+                right_cost[i] = surface_area(right_bounds) * right_count;
+            }
+            aabb left_bounds;
+            unsigned left_count = 0;
+            for (unsigned i = 1; i < BIN_COUNT; ++i) {
+                left_bounds.expand(bins.bins[axis][i - 1].bounds);
+                left_count += bins.bins[axis][i - 1].count;
+                float cost = surface_area(left_bounds) * left_count + right_cost[i];
+                if (left_count > 0 && left_count < count && cost < best_cost) {
+                    best_cost = cost;
+                    best_axis = axis;
+                    best_split = i;
+                }
+            }
+        }
+
+        unsigned middle;
+        if (depth >= SAH_MAX_DEPTH) {
+            // the heuristic keeps producing lopsided splits, fall back to the median so the depth stays bounded
+            int axis = centroid_size.x >= centroid_size.y && centroid_size.x >= centroid_size.z ? 0
+                       : centroid_size.y >= centroid_size.z                                   ? 1
+                                                                                               : 2;
+            middle = begin + count / 2;
+            std::nth_element(work.begin() + begin, work.begin() + middle, work.begin() + end,
+                             [&](const build_primitive &a, const build_primitive &b) {
+                                 return a.centroid[axis] < b.centroid[axis];
+                             });
+        } else if (best_axis >= 0) {
+            middle = std::partition(work.begin() + begin, work.begin() + end,
+                                    [&](const build_primitive &primitive) {
+                                        return unsigned(bin_of(primitive.centroid, best_axis)) < best_split;
+                                    }) -
+                     work.begin();
+        } else {
+            // every centroid is in the same place, any split is as good as another
+            middle = begin + count / 2;
+        }
+
+        unsigned children = node_count.fetch_add(2);
+        node.first = children;
+        node.count = 0;
+
+        auto build_left = [&] { build_node(children, begin, middle, work, node_count, depth + 1); };
+        auto build_right = [&] { build_node(children + 1, middle, end, work, node_count, depth + 1); };
+        // only the top few levels fork, a few subtrees per worker so idle workers can steal from uneven splits
+        if (count >= parallel_threshold && (1u << depth) < worker_count() * 4) {
+            parallel_invoke(build_left, build_right);
+        } else {
+            build_left();
+            build_right();
+        }
+    }
+};
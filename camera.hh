@@ -0,0 +1,192 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+
+// controls held during a frame, the bits of the input a camera is updated with
+enum camera_control : unsigned {
+    CAMERA_FORWARD = 1 << 0,
+    CAMERA_BACK = 1 << 1,
+    CAMERA_LEFT = 1 << 2,
+    CAMERA_RIGHT = 1 << 3,
+    CAMERA_UP = 1 << 4,
+    CAMERA_DOWN = 1 << 5,
+    CAMERA_TURN_LEFT = 1 << 6,
+    CAMERA_TURN_RIGHT = 1 << 7,
+    CAMERA_TURN_UP = 1 << 8,
+    CAMERA_TURN_DOWN = 1 << 9,
+    CAMERA_FAST = 1 << 10, // moves twice as fast
+};
+
+struct camera_pose {
+    glm::vec3 position{0.0f};
+    float yaw = 0.0f, pitch = 0.0f; // radians
+};
+
+/**
+ * \brief Fly camera that looks down -axis_z(), yaw turns it around world y and pitch tilts it up and down
+ */
+struct camera {
+    camera_pose pose;
+    float fov = glm::radians(45.0f); // vertical fov in radians
+    float move_speed = 2.5f;          // units per second
+    float turn_speed = glm::radians(90.0f);
+
+    glm::vec3 axis_z() const {
+        return glm::vec3(std::sin(pose.yaw) * std::cos(pose.pitch), -std::sin(pose.pitch),
+                         std::cos(pose.yaw) * std::cos(pose.pitch));
+    }
+
+    glm::vec3 axis_x() const { return glm::normalize(glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), axis_z())); }
+
+    /**
+     * \brief Turn and then move by the controls held for delta_time seconds
+     * \param controls camera_control bits
+     */
+    void update(unsigned controls, float delta_time) {
+        float move = delta_time * move_speed * (controls & CAMERA_FAST ? 2.0f : 1.0f);
+        float turn = delta_time * turn_speed;
+        if (controls & CAMERA_TURN_LEFT)
+            pose.yaw += turn;
+        if (controls & CAMERA_TURN_RIGHT)
+            pose.yaw -= turn;
+        if (controls & CAMERA_TURN_UP)
+            pose.pitch += turn;
+        if (controls & CAMERA_TURN_DOWN)
+            pose.pitch -= turn;
+        pose.pitch = std::clamp(pose.pitch, glm::radians(-89.9f), glm::radians(89.9f));
+
+        glm::vec3 world_axis_y(0.0f, 1.0f, 0.0f);
+        if (controls & CAMERA_FORWARD)
+            pose.position -= move * axis_z();
+        if (controls & CAMERA_LEFT)
+            pose.position -= move * axis_x();
+        if (controls & CAMERA_BACK)
+            pose.position += move * axis_z();
+        if (controls & CAMERA_RIGHT)
+            pose.position += move * axis_x();
+        if (controls & CAMERA_UP)
+            pose.position += move * world_axis_y;
+        if (controls & CAMERA_DOWN)
+            pose.position -= move * world_axis_y;
+    }
+
+    glm::mat4 view() const {
+        return glm::lookAt(pose.position, pose.position - axis_z(), glm::vec3(0.0f, 1.0f, 0.0f));
+    }
+
+    glm::mat4 projection(float aspect) const { return glm::perspective(fov, aspect, 0.1f, 100.0f); }
+};
+
+/**
+ * \brief Keyframes a camera is moved through, steps frames apart
+ * With one step per keyframe every frame gets a keyframe as it is, which replays a recording exactly.
+ * In between frames follow a Catmull-Rom spline through the keyframes, which passes through each of
+ * them and keeps the speed continuous, so a handful of keyframes make a smooth fly-through. Angles are
+ * interpolated as they are, a turn across +-180 degrees has to be written as going past it
+ */
+struct camera_path {
+    std::vector<camera_pose> keyframes;
+    unsigned steps = 1; // frames from one keyframe to the next
+
+    unsigned frame_count() const { return keyframes.empty() ? 0 : (keyframes.size() - 1) * steps + 1; }
+
+    /**
+     * \brief The pose of a frame, paths loop once they end
+     */
+    camera_pose at(unsigned frame) const {
+        frame %= frame_count();
+        size_t index = frame / steps;
+        float t = float(frame % steps) / steps;
+        if (t == 0.0f)
+            return keyframes[index];
+        // the ends repeat the first and last keyframe as their outer control points
+        const camera_pose &p0 = keyframes[index > 0 ? index - 1 : 0];
+        const camera_pose &p1 = keyframes[index];
+        const camera_pose &p2 = keyframes[index + 1];
+        const camera_pose &p3 = keyframes[std::min(index + 2, keyframes.size() - 1)];
+        camera_pose pose;
+        pose.position = catmull_rom(p0.position, p1.position, p2.position, p3.position, t);
+        pose.yaw = catmull_rom(p0.yaw, p1.yaw, p2.yaw, p3.yaw, t);
+        pose.pitch = catmull_rom(p0.pitch, p1.pitch, p2.pitch, p3.pitch, t);
+        return pose;
+    }
+
+  private:
+    template <typename T> static T catmull_rom(const T &p0, const T &p1, const T &p2, const T &p3, float t) {
+        float t2 = t * t, t3 = t2 * t;
+        return 0.5f * (2.0f * p1 + (p2 - p0) * t + (2.0f * p0 - 5.0f * p1 + 4.0f * p2 - p3) * t2 +
+                       (3.0f * p1 - p0 - 3.0f * p2 + p3) * t3);
+    }
+};
+
+// a camera path line after which the angles are in radians instead of degrees
+const char *const CAMERA_PATH_RADIANS = "# angles in radians";
+
+/**
+ * \brief Read a camera path with one pose per line, `x y z yaw pitch` with the angles in degrees
+ * Lines starting with # are comments, and columns after the pose are ignored. After a `# angles in radians`
+ * line the angles are read as radians, which recordings use so they load back bit for bit
+ */
+inline bool load_camera_path(const std::string &path, std::vector<camera_pose> &poses) {
+    std::ifstream file(path);
+    if (!file.is_open()) {
+        std::cout << "Failed to open file: " << path << std::endl;
+        return false;
+    }
+    poses.clear();
+    std::string line;
+    unsigned line_no = 0;
+    bool radians = false;
+    while (std::getline(file, line)) {
+        ++line_no;
+        std::istringstream line_ss(line);
+        camera_pose pose;
+        float yaw, pitch;
+        if (line == CAMERA_PATH_RADIANS)
+            radians = true;
+        if (line.empty() || line[0] == '#')
+            continue;
+        if (!(line_ss >> pose.position.x >> pose.position.y >> pose.position.z >> yaw >> pitch)) {
+            std::cout << path << "(" << line_no << ") bad camera pose" << '\n';
+            continue;
+        }
+        pose.yaw = radians ? yaw : glm::radians(yaw);
+        pose.pitch = radians ? pitch : glm::radians(pitch);
+        poses.push_back(pose);
+    }
+    return !poses.empty();
+}
+
+/**
+ * \brief Writes the camera of every frame as a camera path, followed by the frame's time step and controls
+ * Angles are written in radians with every digit a float needs, so playing the file back gives the same poses
+ */
+struct camera_recorder {
+    std::ofstream file;
+
+    bool open(const std::string &path) {
+        file.open(path);
+        if (!file.is_open()) {
+            std::cout << "Failed to open file: " << path << std::endl;
+            return false;
+        }
+        file.precision(std::numeric_limits<float>::max_digits10);
+        file << CAMERA_PATH_RADIANS << "\n# x y z yaw pitch (radians), delta time (seconds), controls\n";
+        return true;
+    }
+
+    void record(const camera_pose &pose, float delta_time, unsigned controls) {
+        file << pose.position.x << ' ' << pose.position.y << ' ' << pose.position.z << ' '
+             << pose.yaw << ' ' << pose.pitch << ' ' << delta_time << ' ' << controls << '\n';
+    }
+};
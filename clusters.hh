@@ -0,0 +1,302 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "ring_buffer.hh"
+#include "parallel.hh"
+#include "profiler.hh"
+#include "telemetry.hh"
+
+// shader storage buffer bindings read by fragment.glsl
+const GLuint LIGHT_LIST_BINDING = 0;
+const GLuint CLUSTER_GRID_BINDING = 1;
+const GLuint CLUSTER_INDEX_BINDING = 2;
+
+// a point light, or a spot light when spot_cos is above -1, laid out like the std430 struct in fragment.glsl
+struct light {
+    glm::vec3 position; // world space
+    float radius;       // the light fades out to nothing at this distance
+    glm::vec3 color;    // scaled by the intensity
+    float spot_cos = -1.0f;                 // cosine of the cone's half angle
+    glm::vec3 direction{0.0f, -1.0f, 0.0f}; // the cone's axis
+    float spot_blend = 0.05f;               // the cone's edge fades in over this much of its cosine
+};
+static_assert(sizeof(light) == 48, "light must match the std430 layout of the shader's struct");
+
+/**
+ * \brief The lights of a scene, uploaded once to a buffer the fragment shader indexes
+ */
+struct light_list {
+    std::vector<light> lights;
+    GLuint SSBO_id = 0;
+
+    void upload() {
+        if (SSBO_id == 0)
+            glGenBuffers(1, &SSBO_id);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, SSBO_id);
+        // an empty buffer cannot be bound, so there is always room for at least one light
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(light) * std::max<size_t>(lights.size(), 1), lights.data(),
+                     GL_STATIC_DRAW);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, LIGHT_LIST_BINDING, SSBO_id);
+    }
+};
+
+/**
+ * \brief Lights binned into a grid of view space clusters for clustered forward shading
+ * The view frustum is split into GRID_X by GRID_Y screen tiles and GRID_Z depth slices that get
+ * exponentially deeper, so clusters stay roughly cube shaped. bin() lists for every cluster the lights
+ * whose bounding sphere touches its box, and the fragment shader only walks the list of the cluster it
+ * is in, so the cost of a pixel depends on the lights near it rather than on every light in the scene.
+ * Lists are capped at MAX_LIGHTS_PER_CLUSTER to bound that cost, keeping the lights brightest in the cluster
+ */
+struct light_clusters {
+    static const unsigned GRID_X = 16, GRID_Y = 9, GRID_Z = 24;
+    static const unsigned SLICE_CLUSTERS = GRID_X * GRID_Y;
+    static const unsigned CLUSTER_COUNT = SLICE_CLUSTERS * GRID_Z;
+    static const unsigned MAX_LIGHTS_PER_CLUSTER = 64;
+
+    std::vector<uint32_t> ranges;  // first index and index count of each cluster, x fastest, then y, then z
+    std::vector<uint32_t> indices; // light list indices of every cluster, one after another
+    unsigned overflowed = 0;       // clusters that touched more lights than they can list
+
+    float near_plane = 0.0f, far_plane = 0.0f; // of the projection last binned with
+
+    GLuint grid_SSBO_id = 0, index_SSBO_id = 0; // used when there is no ring buffer
+
+    /**
+     * \brief Bin the lights for a view, only touches cpu side data so it can run on another thread
+     * \param projection a symmetric perspective projection, as made by glm::perspective
+     */
+    void bin(const std::vector<light> &lights, const glm::mat4 &view, const glm::mat4 &projection) {
+        PROFILE_ZONE("bin lights");
+        if (projection != binned_projection)
+            build_boxes(projection);
+
+        view_spheres.resize(lights.size());
+        for (size_t i = 0; i < lights.size(); ++i)
+            view_spheres[i] = glm::vec4(glm::vec3(view * glm::vec4(lights[i].position, 1.0f)), lights[i].radius);
+
+        // slices are binned independently into lists of their own, then joined
+        ranges.resize(CLUSTER_COUNT * 2);
+        parallel_for(0, GRID_Z, 1, [&](size_t begin, size_t end) {
+            for (size_t slice = begin; slice < end; ++slice)
+                bin_slice(slice);
+        });
+
+        indices.clear();
+        overflowed = 0;
+        for (unsigned slice = 0; slice < GRID_Z; ++slice) {
+            uint32_t base = indices.size();
+            for (unsigned cluster = slice * SLICE_CLUSTERS; cluster < (slice + 1) * SLICE_CLUSTERS; ++cluster)
+                ranges[cluster * 2] += base;
+            indices.insert(indices.end(), slice_indices[slice].begin(), slice_indices[slice].end());
+            overflowed += slice_overflowed[slice];
+        }
+    }
+
+    /**
+     * \brief Copy the lists into this frame's part of a ring buffer and bind them for the fragment shader
+     * \param viewport_width,viewport_height in pixels, to map fragment coordinates to tiles
+     * \return false if the ring had no room, nothing was bound then
+     */
+    bool upload(ring_buffer &ring, int viewport_width, int viewport_height) {
+        static GLint alignment = 0;
+        if (alignment == 0)
+            glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+
+        grid_header header = make_header(viewport_width, viewport_height);
+        size_t grid_size = sizeof(header) + ranges.size() * sizeof(uint32_t);
+        size_t index_size = std::max<size_t>(indices.size(), 1) * sizeof(uint32_t);
+        ring_buffer::allocation grid = ring.allocate(grid_size, alignment);
+        ring_buffer::allocation index = ring.allocate(index_size, alignment);
+        if (grid.pointer == nullptr || index.pointer == nullptr)
+            return false;
+        std::memcpy(grid.pointer, &header, sizeof(header));
+        std::memcpy(static_cast<uint8_t *>(grid.pointer) + sizeof(header), ranges.data(),
+                    ranges.size() * sizeof(uint32_t));
+        std::memcpy(index.pointer, indices.data(), indices.size() * sizeof(uint32_t));
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, ring.buffer_id, grid.offset, grid_size);
+        glBindBufferRange(GL_SHADER_STORAGE_BUFFER, CLUSTER_INDEX_BINDING, ring.buffer_id, index.offset, index_size);
+        return true;
+    }
+
+    /**
+     * \brief Copy the lists into buffers of their own and bind them for the fragment shader
+     */
+    void upload(int viewport_width, int viewport_height) {
+        if (grid_SSBO_id == 0) {
+            glGenBuffers(1, &grid_SSBO_id);
+            glGenBuffers(1, &index_SSBO_id);
+        }
+        grid_header header = make_header(viewport_width, viewport_height);
+        size_t grid_size = sizeof(header) + ranges.size() * sizeof(uint32_t);
+        // (re)specifying the storage orphans the old one, so the driver does not wait for draws still reading it
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, grid_SSBO_id);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, grid_size, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), &header);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(header), ranges.size() * sizeof(uint32_t), ranges.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, index_SSBO_id);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(indices.size(), 1) * sizeof(uint32_t), NULL,
+                     GL_STREAM_DRAW);
+        glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, indices.size() * sizeof(uint32_t), indices.data());
+        render_count().bytes_uploaded += grid_size + indices.size() * sizeof(uint32_t);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_GRID_BINDING, grid_SSBO_id);
+        glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CLUSTER_INDEX_BINDING, index_SSBO_id);
+    }
+
+  private:
+    // start of the cluster grid buffer, followed by the ranges
+    struct grid_header {
+        uint32_t size[4];  // clusters along x, y and z
+        float scale[4];    // tiles per pixel along x and y, then slice = log(view depth) * scale[2] - scale[3]
+    };
+
+    glm::mat4 binned_projection{0.0f};
+
+    // view space boxes of the clusters, each coordinate in an array of its own so 4 clusters load at once
+    std::vector<float> min_x, min_y, min_z, max_x, max_y, max_z;
+
+    std::vector<glm::vec4> view_spheres; // view space center and radius of every light
+    std::vector<uint32_t> slice_indices[GRID_Z];
+    std::vector<uint32_t> slice_candidates[GRID_Z];
+    unsigned slice_overflowed[GRID_Z] = {};
+
+    grid_header make_header(int viewport_width, int viewport_height) const {
+        float depth_scale = GRID_Z / std::log(far_plane / near_plane);
+        return {{GRID_X, GRID_Y, GRID_Z, 0},
+                {float(GRID_X) / std::max(viewport_width, 1), float(GRID_Y) / std::max(viewport_height, 1),
+                 depth_scale, std::log(near_plane) * depth_scale}};
+    }
+
+    float slice_depth(unsigned slice) const {
+        return near_plane * std::pow(far_plane / near_plane, float(slice) / GRID_Z);
+    }
+
+    void build_boxes(const glm::mat4 &projection) {
+        binned_projection = projection;
+        // glm::perspective puts -2 * far * near / (far - near) and -(far + near) / (far - near) here
+        near_plane = projection[3][2] / (projection[2][2] - 1.0f);
+        far_plane = projection[3][2] / (projection[2][2] + 1.0f);
+
+        for (std::vector<float> *coordinate : {&min_x, &min_y, &min_z, &max_x, &max_y, &max_z})
+            coordinate->resize(CLUSTER_COUNT);
+        for (unsigned z = 0; z < GRID_Z; ++z) {
+            float near_depth = slice_depth(z), far_depth = slice_depth(z + 1);
+            for (unsigned y = 0; y < GRID_Y; ++y) {
+                for (unsigned x = 0; x < GRID_X; ++x) {
+                    unsigned cluster = x + GRID_X * (y + GRID_Y * z);
+                    // the tile's sides in normalized device coordinates, scaled out to view space at either depth
+                    float ndc_x[] = {-1.0f + 2.0f * x / GRID_X, -1.0f + 2.0f * (x + 1) / GRID_X};
+                    float ndc_y[] = {-1.0f + 2.0f * y / GRID_Y, -1.0f + 2.0f * (y + 1) / GRID_Y};
+                    auto extent = [&](const float ndc[2], float scale, float &low, float &high) {
+                        float corners[] = {ndc[0] * near_depth, ndc[0] * far_depth, ndc[1] * near_depth,
+                                           ndc[1] * far_depth};
+                        low = *std::min_element(corners, corners + 4) / scale;
+                        high = *std::max_element(corners, corners + 4) / scale;
+                    };
+                    extent(ndc_x, projection[0][0], min_x[cluster], max_x[cluster]);
+                    extent(ndc_y, projection[1][1], min_y[cluster], max_y[cluster]);
+                    min_z[cluster] = -far_depth;
+                    max_z[cluster] = -near_depth;
+                }
+            }
+        }
+    }
+
+    void bin_slice(unsigned slice) {
+        // only lights reaching into the slice's depth range are tested against its clusters
+        std::vector<uint32_t> &candidates = slice_candidates[slice];
+        candidates.clear();
+        float near_depth = slice_depth(slice), far_depth = slice_depth(slice + 1);
+        for (uint32_t i = 0; i < view_spheres.size(); ++i) {
+            float depth = -view_spheres[i].z, radius = view_spheres[i].w;
+            if (depth + radius >= near_depth && depth - radius <= far_depth)
+                candidates.push_back(i);
+        }
+
+        std::vector<uint32_t> &output = slice_indices[slice];
+        output.clear();
+        slice_overflowed[slice] = 0;
+        std::vector<uint32_t> lists[4];
+        for (unsigned first = slice * SLICE_CLUSTERS; first < (slice + 1) * SLICE_CLUSTERS; first += 4) {
+            for (std::vector<uint32_t> &list : lists)
+                list.clear();
+            for (uint32_t candidate : candidates) {
+                unsigned touched = touches(view_spheres[candidate], first);
+                for (unsigned k = 0; k < 4; ++k)
+                    if (touched & (1u << k))
+                        lists[k].push_back(candidate);
+            }
+            for (unsigned k = 0; k < 4; ++k) {
+                if (lists[k].size() > MAX_LIGHTS_PER_CLUSTER) {
+                    keep_brightest(lists[k], first + k);
+                    ++slice_overflowed[slice];
+                }
+                ranges[(first + k) * 2] = output.size(); // relative to the slice until the slices are joined
+                ranges[(first + k) * 2 + 1] = lists[k].size();
+                output.insert(output.end(), lists[k].begin(), lists[k].end());
+            }
+        }
+    }
+
+    /**
+     * \brief Cut a cluster's list down to the MAX_LIGHTS_PER_CLUSTER lights that are brightest at its center
+     * The falloff in fragment.glsl is 1 - distance^2 / radius^2, so the lights with the smallest ratio are kept,
+     * rather than whichever came first in the light list
+     */
+    void keep_brightest(std::vector<uint32_t> &list, unsigned cluster) const {
+        glm::vec3 center = 0.5f * glm::vec3(min_x[cluster] + max_x[cluster], min_y[cluster] + max_y[cluster],
+                                            min_z[cluster] + max_z[cluster]);
+        auto dimming = [&](uint32_t light) {
+            glm::vec3 offset = glm::vec3(view_spheres[light]) - center;
+            return glm::dot(offset, offset) / (view_spheres[light].w * view_spheres[light].w);
+        };
+        std::nth_element(list.begin(), list.begin() + MAX_LIGHTS_PER_CLUSTER, list.end(),
+                         [&](uint32_t a, uint32_t b) { return dimming(a) < dimming(b); });
+        list.resize(MAX_LIGHTS_PER_CLUSTER);
+    }
+
+    /**
+     * \brief Test a sphere against the boxes of 4 consecutive clusters
+     * \return a mask with bit k set if the sphere touches cluster first + k
+     */
+    unsigned touches(glm::vec4 sphere, unsigned first) const {
+#if defined(__SSE2__) || defined(_M_X64)
+        const __m128 zero = _mm_setzero_ps();
+        // distance from the center to each box along an axis, zero inside it
+        auto axis_distance = [&](const std::vector<float> &low, const std::vector<float> &high, float center) {
+            __m128 c = _mm_set1_ps(center);
+            __m128 below = _mm_sub_ps(_mm_loadu_ps(&low[first]), c);
+            __m128 above = _mm_sub_ps(c, _mm_loadu_ps(&high[first]));
+            __m128 d = _mm_max_ps(_mm_max_ps(below, above), zero);
+            return _mm_mul_ps(d, d);
+        };
+        __m128 distance_squared = _mm_add_ps(_mm_add_ps(axis_distance(min_x, max_x, sphere.x),
+                                                        axis_distance(min_y, max_y, sphere.y)),
+                                             axis_distance(min_z, max_z, sphere.z));
+        return _mm_movemask_ps(_mm_cmple_ps(distance_squared, _mm_set1_ps(sphere.w * sphere.w)));
+#else
+        unsigned mask = 0;
+        for (unsigned k = 0; k < 4; ++k) {
+            unsigned c = first + k;
+            glm::vec3 closest = glm::clamp(glm::vec3(sphere), glm::vec3(min_x[c], min_y[c], min_z[c]),
+                                           glm::vec3(max_x[c], max_y[c], max_z[c]));
+            glm::vec3 offset = closest - glm::vec3(sphere);
+            mask |= unsigned(glm::dot(offset, offset) <= sphere.w * sphere.w) << k;
+        }
+        return mask;
+#endif
+    }
+};
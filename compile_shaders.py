@@ -1,16 +1,46 @@
-""" Compiles all shader files within the folder to a single C header file """
+""" Compiles all shader files within the folder to a single C header file
+
+A shader can declare feature flags with a line such as `// features: TEXTURED ALPHA_TEST`. It is then
+expanded into one variant per combination of flags, each with `#define`s for its enabled flags after the
+#version line, in an array indexed by the mask of enabled flags. The bit of each flag is an enum constant
+named after the file and the flag, such as FRAGMENT_GLSL_TEXTURED.
+"""
 
 import os
 import sys
 
+
+def string_literal(lines):
+    return [f"\"{line}\\n\"\n" for line in lines] + ["\"\\0\""]
+
+
 _, folder = sys.argv
 with open(f"{os.path.dirname(folder)}.h", "w") as ofile:
     print(ofile.name)
     for path, _, files in os.walk(folder):
-        for file in files:
+        for file in sorted(files):
             with open(os.path.join(path, file), "r") as ifile:
                 print(ifile.name)
-                data = [f"// {ifile.name}\nconst char *{file.replace('.', '_')} =\n"] \
-                    + [f"\"{line}\\n\"\n" for line in ifile.read().splitlines()] \
-                    + ["\"\\0\";\n"]
+                lines = ifile.read().splitlines()
+                name = file.replace('.', '_')
+                features = [line.split(":", 1)[1].split() for line in lines
+                            if line.strip().startswith("// features:")]
+                if not features:
+                    data = [f"// {ifile.name}\nconst char *{name} =\n"] + string_literal(lines) + [";\n"]
+                    ofile.writelines(data)
+                    continue
+
+                features = features[0]
+                version = next((i + 1 for i, line in enumerate(lines) if line.startswith("#version")), 0)
+                data = [f"// {ifile.name}, variants indexed by a mask of its features\n",
+                        f"enum {name}_features {{\n"]
+                data += [f"    {name.upper()}_{feature} = 1 << {bit},\n" for bit, feature in enumerate(features)]
+                data += [f"    {name.upper()}_VARIANT_COUNT = {1 << len(features)}\n", "};\n",
+                         f"const char *{name}_variants[] = {{\n"]
+                for mask in range(1 << len(features)):
+                    enabled = [feature for bit, feature in enumerate(features) if mask & (1 << bit)]
+                    defines = [f"#define {feature}" for feature in enabled]
+                    data += [f"// {' '.join(enabled) if enabled else 'no features'}\n"]
+                    data += string_literal(lines[:version] + defines + lines[version:]) + [",\n"]
+                data += ["};\n"]
                 ofile.writelines(data)
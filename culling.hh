@@ -0,0 +1,215 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <cstddef>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+struct aabb {
+    glm::vec3 min{std::numeric_limits<float>::max()};
+    glm::vec3 max{std::numeric_limits<float>::lowest()};
+
+    void expand(glm::vec3 point) {
+        min = glm::min(min, point);
+        max = glm::max(max, point);
+    }
+
+    void expand(const aabb &other) {
+        min = glm::min(min, other.min);
+        max = glm::max(max, other.max);
+    }
+
+    bool empty() const { return min.x > max.x; }
+    glm::vec3 center() const { return (min + max) * 0.5f; }
+    glm::vec3 extents() const { return (max - min) * 0.5f; }
+
+    /**
+     * \brief Bounds of this box after an affine transform
+     */
+    aabb transformed(const glm::mat4 &matrix) const {
+        glm::vec3 new_center = glm::vec3(matrix * glm::vec4(center(), 1.0f));
+        glm::vec3 new_extents = glm::abs(glm::mat3(matrix)[0]) * extents().x +
+                                glm::abs(glm::mat3(matrix)[1]) * extents().y +
+                                glm::abs(glm::mat3(matrix)[2]) * extents().z;
+        return {new_center - new_extents, new_center + new_extents};
+    }
+};
+
+struct bounding_sphere {
+    glm::vec3 center{0.0f};
+    float radius = 0.0f;
+};
+
+/**
+ * \brief The six planes of a view volume, inside is dot(plane.xyz, point) + plane.w >= 0
+ */
+struct frustum {
+    enum plane_index { PLANE_LEFT, PLANE_RIGHT, PLANE_BOTTOM, PLANE_TOP, PLANE_NEAR, PLANE_FAR };
+    glm::vec4 planes[6];
+
+    /**
+     * \brief Extract the planes of a projection * view (* model) matrix
+     * The planes end up in the space the matrix transforms from, so passing the model matrix
+     * in as well lets object space bounds be tested directly
+     */
+    static frustum from_matrix(const glm::mat4 &m) {
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        frustum f;
+        f.planes[PLANE_LEFT] = row3 + row0;
+        f.planes[PLANE_RIGHT] = row3 - row0;
+        f.planes[PLANE_BOTTOM] = row3 + row1;
+        f.planes[PLANE_TOP] = row3 - row1;
+        f.planes[PLANE_NEAR] = row3 + row2;
+        f.planes[PLANE_FAR] = row3 - row2;
+        for (glm::vec4 &plane : f.planes)
+            plane /= glm::length(glm::vec3(plane));
+        return f;
+    }
+
+    bool intersects(const aabb &box) const {
+        glm::vec3 center = box.center(), extents = box.extents();
+        for (const glm::vec4 &plane : planes)
+            if (glm::dot(glm::vec3(plane), center) + glm::dot(glm::abs(glm::vec3(plane)), extents) + plane.w < 0.0f)
+                return false;
+        return true;
+    }
+
+    bool intersects(const bounding_sphere &sphere) const {
+        for (const glm::vec4 &plane : planes)
+            if (glm::dot(glm::vec3(plane), sphere.center) + plane.w < -sphere.radius)
+                return false;
+        return true;
+    }
+};
+
+struct cull_stats {
+    unsigned tested = 0;
+    unsigned visible = 0;
+    unsigned occluded = 0;   // inside the frustum but hidden behind occluders, not counted as visible
+    unsigned pvs_hidden = 0; // inside the frustum but not in the camera cell's potentially visible set
+
+    cull_stats &operator+=(const cull_stats &other) {
+        tested += other.tested;
+        visible += other.visible;
+        occluded += other.occluded;
+        pvs_hidden += other.pvs_hidden;
+        return *this;
+    }
+};
+
+/**
+ * \brief Boxes stored as separate center and extent arrays so the culling kernel can test several at once
+ */
+struct bounds_soa {
+    std::vector<float> center_x, center_y, center_z;
+    std::vector<float> extent_x, extent_y, extent_z;
+
+    void clear() {
+        for (std::vector<float> *array : {&center_x, &center_y, &center_z, &extent_x, &extent_y, &extent_z})
+            array->clear();
+    }
+
+    void push_back(const aabb &box) {
+        glm::vec3 center = box.center(), extents = box.extents();
+        center_x.push_back(center.x);
+        center_y.push_back(center.y);
+        center_z.push_back(center.z);
+        extent_x.push_back(extents.x);
+        extent_y.push_back(extents.y);
+        extent_z.push_back(extents.z);
+    }
+
+    void set(size_t i, const aabb &box) {
+        glm::vec3 center = box.center(), extents = box.extents();
+        center_x[i] = center.x;
+        center_y[i] = center.y;
+        center_z[i] = center.z;
+        extent_x[i] = extents.x;
+        extent_y[i] = extents.y;
+        extent_z[i] = extents.z;
+    }
+
+    size_t size() const { return center_x.size(); }
+};
+
+/**
+ * \brief Test boxes [begin, end) against the frustum
+ * Writes 1 to visible[i - begin] for boxes that intersect it, and 0 otherwise
+ * \return the number of visible boxes
+ */
+inline unsigned frustum_cull(const frustum &frustum, const bounds_soa &bounds, size_t begin, size_t end,
+                             uint8_t *visible) {
+    unsigned visible_count = 0;
+    size_t i = begin;
+
+#if defined(__AVX__)
+    // 8 boxes per iteration
+    for (; i + 8 <= end; i += 8) {
+        __m256 cx = _mm256_loadu_ps(&bounds.center_x[i]);
+        __m256 cy = _mm256_loadu_ps(&bounds.center_y[i]);
+        __m256 cz = _mm256_loadu_ps(&bounds.center_z[i]);
+        __m256 ex = _mm256_loadu_ps(&bounds.extent_x[i]);
+        __m256 ey = _mm256_loadu_ps(&bounds.extent_y[i]);
+        __m256 ez = _mm256_loadu_ps(&bounds.extent_z[i]);
+        __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+        for (const glm::vec4 &plane : frustum.planes) {
+            __m256 distance = _mm256_add_ps(
+                _mm256_add_ps(_mm256_mul_ps(cx, _mm256_set1_ps(plane.x)), _mm256_mul_ps(cy, _mm256_set1_ps(plane.y))),
+                _mm256_add_ps(_mm256_mul_ps(cz, _mm256_set1_ps(plane.z)), _mm256_set1_ps(plane.w)));
+            __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ex, _mm256_set1_ps(std::abs(plane.x))),
+                                                        _mm256_mul_ps(ey, _mm256_set1_ps(std::abs(plane.y)))),
+                                          _mm256_mul_ps(ez, _mm256_set1_ps(std::abs(plane.z))));
+            __m256 in_front = _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_GE_OQ);
+            inside = _mm256_and_ps(inside, in_front);
+        }
+        int mask = _mm256_movemask_ps(inside);
+        for (int lane = 0; lane < 8; ++lane)
+            visible_count += visible[i - begin + lane] = (mask >> lane) & 1;
+    }
+#endif
+#if defined(__AVX__) || defined(__SSE2__) || defined(_M_X64)
+    // 4 boxes per iteration
+    for (; i + 4 <= end; i += 4) {
+        __m128 cx = _mm_loadu_ps(&bounds.center_x[i]);
+        __m128 cy = _mm_loadu_ps(&bounds.center_y[i]);
+        __m128 cz = _mm_loadu_ps(&bounds.center_z[i]);
+        __m128 ex = _mm_loadu_ps(&bounds.extent_x[i]);
+        __m128 ey = _mm_loadu_ps(&bounds.extent_y[i]);
+        __m128 ez = _mm_loadu_ps(&bounds.extent_z[i]);
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (const glm::vec4 &plane : frustum.planes) {
+            __m128 distance =
+                _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(plane.x)), _mm_mul_ps(cy, _mm_set1_ps(plane.y))),
+                           _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(plane.z)), _mm_set1_ps(plane.w)));
+            __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, _mm_set1_ps(std::abs(plane.x))),
+                                                  _mm_mul_ps(ey, _mm_set1_ps(std::abs(plane.y)))),
+                                       _mm_mul_ps(ez, _mm_set1_ps(std::abs(plane.z))));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+        }
+        int mask = _mm_movemask_ps(inside);
+        for (int lane = 0; lane < 4; ++lane)
+            visible_count += visible[i - begin + lane] = (mask >> lane) & 1;
+    }
+#endif
+
+    // remaining boxes one at a time
+    for (; i < end; ++i) {
+        glm::vec3 center(bounds.center_x[i], bounds.center_y[i], bounds.center_z[i]);
+        glm::vec3 extents(bounds.extent_x[i], bounds.extent_y[i], bounds.extent_z[i]);
+        visible_count += visible[i - begin] = frustum.intersects(aabb{center - extents, center + extents});
+    }
+    return visible_count;
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include "material.hh"
+#include "shader.hh"
+#include "telemetry.hh"
+
+// everything the gl thread needs to issue one draw, so submitting does not touch the meshes
+struct draw_command {
+    GLuint VAO_id;
+    GLuint depth_VAO_id; // positions only
+    GLsizei vertex_count;
+    unsigned material_index;
+};
+
+/**
+ * \brief Draw commands in submission order, built as one partial list per worker
+ * Each worker encodes a contiguous part of the sorted draw order into its own slice, so the slices
+ * only have to be submitted one after another to keep the order
+ */
+struct draw_list {
+    std::vector<std::vector<draw_command>> slices;
+
+    /**
+     * \brief Make room for slice_count partial lists, keeping their allocations from earlier frames
+     */
+    void reset(size_t slice_count) {
+        if (slices.size() < slice_count)
+            slices.resize(slice_count);
+        for (std::vector<draw_command> &slice : slices)
+            slice.clear();
+    }
+
+    size_t size() const {
+        size_t count = 0;
+        for (const std::vector<draw_command> &slice : slices)
+            count += slice.size();
+        return count;
+    }
+
+    /**
+     * \brief Issue every command on the gl thread, materials are only bound when they change
+     * \param programs the variants of the program to draw with, each material picks the one it needs
+     */
+    void submit(const std::vector<material> &materials, const program_variants &programs) const {
+        unsigned bound_material = -1;
+        for (const std::vector<draw_command> &slice : slices) {
+            for (const draw_command &command : slice) {
+                if (command.material_index != bound_material) {
+                    // a new program has none of the material's uniforms, so switch before binding
+                    programs.use(materials.at(command.material_index).shader_features);
+                    materials.at(command.material_index).bind();
+                    bound_material = command.material_index;
+                }
+                glBindVertexArray(command.VAO_id);
+                glDrawArrays(GL_TRIANGLES, 0, command.vertex_count);
+                ++render_count().state_changes;
+                render_count().draw(command.vertex_count);
+            }
+        }
+    }
+
+    /**
+     * \brief Issue every command from the position only stream, for a program that just writes depth
+     */
+    void submit_depth() const {
+        for (const std::vector<draw_command> &slice : slices) {
+            for (const draw_command &command : slice) {
+                glBindVertexArray(command.depth_VAO_id);
+                glDrawArrays(GL_TRIANGLES, 0, command.vertex_count);
+                ++render_count().state_changes;
+                render_count().draw(command.vertex_count);
+            }
+        }
+    }
+};
+
+// the draw lists of one frame, opaque meshes are drawn before alpha tested ones and those before transparent ones
+struct frame_draws {
+    draw_list opaque, alpha_tested, transparent;
+};
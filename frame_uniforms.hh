@@ -0,0 +1,57 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstring>
+
+#include "ring_buffer.hh"
+#include "telemetry.hh"
+
+// uniform buffer binding of the per frame constants read by the vertex shaders, see frame_uniforms
+const GLuint FRAME_UNIFORM_BINDING = 1;
+
+/**
+ * \brief Constants every draw of a frame shares, in the frame_data uniform block of the vertex shaders
+ * They are written once per frame for all programs, instead of with glUniform into every program variant.
+ * Laid out like the block in std140, where a mat4 is four vec4 columns
+ */
+struct frame_uniforms {
+    glm::mat4 model;
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 normal_matrix; // inverse transpose of model, keeps normals perpendicular under non uniform scale
+
+    /**
+     * \brief Copy the constants into this frame's part of a ring buffer and bind them
+     * \return false if the ring had no room, nothing was uploaded then
+     */
+    bool upload(ring_buffer &ring) const {
+        static GLint alignment = 0;
+        if (alignment == 0)
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        ring_buffer::allocation allocation = ring.allocate(sizeof(*this), alignment);
+        if (allocation.pointer == nullptr)
+            return false;
+        std::memcpy(allocation.pointer, this, sizeof(*this));
+        glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, ring.buffer_id, allocation.offset, sizeof(*this));
+        return true;
+    }
+
+    /**
+     * \brief Copy the constants into a buffer of their own and bind it
+     */
+    void upload() const {
+        static GLuint UBO_id = 0;
+        if (UBO_id == 0) {
+            glGenBuffers(1, &UBO_id);
+            glBindBuffer(GL_UNIFORM_BUFFER, UBO_id);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(*this), NULL, GL_STREAM_DRAW);
+        }
+        // frames the ring had room for bound a range of it instead
+        glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, UBO_id);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(*this), this);
+        render_count().bytes_uploaded += sizeof(*this);
+    }
+};
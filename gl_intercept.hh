@@ -0,0 +1,360 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <iomanip>
+#include <iostream>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+#include <type_traits>
+
+// the entry points the engine calls, each is wrapped when the interceptor is installed
+#define GL_INTERCEPTED_ENTRY_POINTS(X)                                                                                 \
+    X(glActiveTexture) X(glAttachShader) X(glBeginQuery) X(glBindBuffer) X(glBindBufferBase) X(glBindBufferRange)      \
+    X(glBindFramebuffer) X(glBindRenderbuffer) X(glBindTexture) X(glBindVertexArray) X(glBlendFunc)                    \
+    X(glBlitFramebuffer) X(glBufferData) X(glBufferStorage) X(glBufferSubData) X(glCheckFramebufferStatus) X(glClear)  \
+    X(glClearColor) X(glClientWaitSync) X(glColorMask) X(glCompileShader) X(glCreateProgram) X(glCreateShader)         \
+    X(glDeleteBuffers) X(glDeleteProgram) X(glDeleteShader) X(glDeleteSync) X(glDepthFunc) X(glDepthMask)              \
+    X(glDisable) X(glDrawArrays) X(glDrawArraysInstanced) X(glDrawBuffer) X(glEnable) X(glEnableVertexAttribArray)     \
+    X(glEndQuery) X(glFenceSync) X(glFinish) X(glFramebufferRenderbuffer) X(glFramebufferTexture2D)                    \
+    X(glFramebufferTextureLayer) X(glGenBuffers) X(glGenFramebuffers) X(glGenQueries) X(glGenRenderbuffers)            \
+    X(glGenTextures) X(glGenVertexArrays) X(glGenerateMipmap) X(glGetActiveUniform) X(glGetInteger64v)                 \
+    X(glGetIntegerv) X(glGetProgramBinary) X(glGetProgramInfoLog) X(glGetProgramiv) X(glGetQueryObjectiv)              \
+    X(glGetQueryObjectui64v) X(glGetShaderInfoLog) X(glGetShaderiv) X(glGetString) X(glGetUniformLocation)             \
+    X(glLinkProgram) X(glMapBufferRange) X(glPolygonMode) X(glPolygonOffset) X(glProgramBinary)                        \
+    X(glProgramParameteri) X(glProgramUniform1i) X(glProgramUniformMatrix4fv) X(glQueryCounter) X(glReadBuffer)        \
+    X(glRenderbufferStorage) X(glShaderSource) X(glTexImage2D) X(glTexImage3D) X(glTexParameterfv) X(glTexParameteri)  \
+    X(glUniform1f) X(glUniform1i) X(glUniform3fv) X(glUniformMatrix4fv) X(glUseProgram) X(glVertexAttribDivisor)       \
+    X(glVertexAttribPointer) X(glViewport)
+
+// gl calls of one frame, or of many
+struct gl_call_summary {
+    std::vector<uint32_t> calls;     // per entry point, indexed like gl_interceptor::names
+    std::vector<uint32_t> redundant; // calls that set state to what it already was, per entry point
+    uint64_t bytes_uploaded = 0;     // through glBufferData, glBufferSubData and glTexImage*
+
+    uint64_t total_calls() const { return std::accumulate(calls.begin(), calls.end(), uint64_t(0)); }
+    uint64_t total_redundant() const { return std::accumulate(redundant.begin(), redundant.end(), uint64_t(0)); }
+
+    void clear() {
+        std::fill(calls.begin(), calls.end(), 0);
+        std::fill(redundant.begin(), redundant.end(), 0);
+        bytes_uploaded = 0;
+    }
+
+    gl_call_summary &operator+=(const gl_call_summary &other) {
+        for (size_t i = 0; i < calls.size(); ++i) {
+            calls[i] += other.calls[i];
+            redundant[i] += other.redundant[i];
+        }
+        bytes_uploaded += other.bytes_uploaded;
+        return *this;
+    }
+};
+
+/**
+ * \brief Counts what the engine sends to the driver by wrapping the function pointers glad loaded
+ * Once installed every call of an entry point in GL_INTERCEPTED_ENTRY_POINTS is counted before it is
+ * forwarded, the bytes handed to buffer and texture uploads are added up, and binds and state sets that
+ * do not change anything are flagged as redundant. Data written to mapped buffers, like the ring buffer's,
+ * never passes through a call and is not counted. Until install() is called nothing is wrapped and it
+ * costs nothing. Only the gl thread may make gl calls, so the counters take no locks
+ */
+struct gl_interceptor {
+    bool installed = false;
+    std::vector<const char *> names; // of the wrapped entry points, by id
+
+    gl_call_summary frame;      // counted since begin_frame()
+    gl_call_summary last_frame; // of the frame ended last
+    gl_call_summary frames;     // of every frame so far
+    unsigned frame_count = 0;
+
+    /**
+     * \brief Wrap the loaded entry points, call once after loading gl
+     */
+    void install();
+
+    /**
+     * \brief Start counting a frame, calls made since the last one ended (like loading) are left out
+     */
+    void begin_frame() { frame.clear(); }
+
+    void end_frame() {
+        last_frame.calls.assign(frame.calls.begin(), frame.calls.end());
+        last_frame.redundant.assign(frame.redundant.begin(), frame.redundant.end());
+        last_frame.bytes_uploaded = frame.bytes_uploaded;
+        frames += frame;
+        ++frame_count;
+        frame.clear();
+    }
+
+    /**
+     * \return the id of an entry point by name, like "glDrawArrays", or -1 if it is not wrapped
+     */
+    unsigned entry_point(const std::string &name) const {
+        for (unsigned id = 0; id < names.size(); ++id)
+            if (name == names[id])
+                return id;
+        return -1;
+    }
+
+    /**
+     * \brief Print the count entry points called most, and how many of their calls were redundant
+     * \param per divides the numbers, the frame count prints them per frame
+     */
+    void print(const gl_call_summary &summary, unsigned count, unsigned per = 1) const {
+        std::vector<unsigned> order(names.size());
+        std::iota(order.begin(), order.end(), 0);
+        std::sort(order.begin(), order.end(),
+                  [&](unsigned a, unsigned b) { return summary.calls[a] > summary.calls[b]; });
+        for (unsigned i = 0; i < std::min<size_t>(count, order.size()) && summary.calls[order[i]] > 0; ++i)
+            std::cout << "  " << std::left << std::setw(28) << names[order[i]] << std::right << std::setw(10)
+                      << summary.calls[order[i]] / double(per) << " calls, "
+                      << summary.redundant[order[i]] / double(per) << " redundant" << std::endl;
+    }
+
+    // what the last calls set the state to, -1 while it is unknown
+    struct state_shadow {
+        GLuint program = -1, vertex_array = -1, read_framebuffer = -1, draw_framebuffer = -1, active_texture = -1;
+        GLuint array_buffer = -1, uniform_buffer = -1, storage_buffer = -1;
+        GLuint textures[16][2]; // per unit, GL_TEXTURE_2D and GL_TEXTURE_2D_ARRAY
+        GLint depth_func = -1, blend_source = -1, blend_destination = -1;
+        GLint depth_mask = -1, color_mask = -1;
+        GLint viewport[4] = {-1, -1, -1, -1};
+        std::vector<std::pair<GLenum, bool>> capabilities;
+
+        state_shadow() { std::fill(&textures[0][0], &textures[0][0] + 32, GLuint(-1)); }
+
+        GLuint *buffer(GLenum target) {
+            switch (target) {
+            case GL_ARRAY_BUFFER:
+                return &array_buffer;
+            case GL_UNIFORM_BUFFER:
+                return &uniform_buffer;
+            case GL_SHADER_STORAGE_BUFFER:
+                return &storage_buffer;
+            default:
+                return nullptr; // element array bindings belong to the vertex array, the rest are not used
+            }
+        }
+
+        GLuint *texture(GLenum target) {
+            unsigned unit = active_texture - GL_TEXTURE0;
+            if (active_texture == GLuint(-1) || unit >= 16)
+                return nullptr;
+            if (target == GL_TEXTURE_2D)
+                return &textures[unit][0];
+            if (target == GL_TEXTURE_2D_ARRAY)
+                return &textures[unit][1];
+            return nullptr;
+        }
+
+        /**
+         * \brief Set a value of the shadow
+         * \return true if it already had that value
+         */
+        template <typename T> static bool set(T *value, T next) {
+            if (value == nullptr)
+                return false;
+            bool same = *value == next;
+            *value = next;
+            return same;
+        }
+
+        bool set_capability(GLenum capability, bool enabled) {
+            for (auto &[known, value] : capabilities)
+                if (known == capability)
+                    return set(&value, enabled);
+            capabilities.push_back({capability, enabled});
+            return false;
+        }
+    } state;
+};
+
+/**
+ * \brief The interceptor the engine shares
+ */
+inline gl_interceptor &gl_intercept() {
+    static gl_interceptor instance;
+    return instance;
+}
+
+// bytes of one pixel, for counting texture uploads
+inline size_t gl_pixel_size(GLenum format, GLenum type) {
+    size_t channels = format == GL_RGBA ? 4 : format == GL_RGB ? 3 : format == GL_RG ? 2 : 1;
+    size_t channel_size = type == GL_FLOAT || type == GL_UNSIGNED_INT ? 4
+                          : type == GL_HALF_FLOAT || type == GL_UNSIGNED_SHORT ? 2
+                                                                                 : 1;
+    return channels * channel_size;
+}
+
+/**
+ * \brief Looks at the arguments of a call before it is forwarded
+ * \return true if the call changes no state
+ * Entry points without a specialization are only counted
+ */
+template <auto *slot> struct gl_inspect {
+    template <typename... Args> static bool call(Args...) { return false; }
+};
+
+#define GL_INSPECT(entry_point, ...)                                                                                   \
+    template <> struct gl_inspect<&glad_##entry_point> {                                                               \
+        static bool call(__VA_ARGS__);                                                                                 \
+    };                                                                                                                 \
+    inline bool gl_inspect<&glad_##entry_point>::call(__VA_ARGS__)
+
+GL_INSPECT(glUseProgram, GLuint program) {
+    return gl_interceptor::state_shadow::set(&gl_intercept().state.program, program);
+}
+
+GL_INSPECT(glBindVertexArray, GLuint vertex_array) {
+    return gl_interceptor::state_shadow::set(&gl_intercept().state.vertex_array, vertex_array);
+}
+
+GL_INSPECT(glBindBuffer, GLenum target, GLuint buffer) {
+    return gl_interceptor::state_shadow::set(gl_intercept().state.buffer(target), buffer);
+}
+
+// binding to an indexed target binds the generic target too, but is never redundant itself
+GL_INSPECT(glBindBufferBase, GLenum target, GLuint, GLuint buffer) {
+    gl_interceptor::state_shadow::set(gl_intercept().state.buffer(target), buffer);
+    return false;
+}
+
+GL_INSPECT(glBindBufferRange, GLenum target, GLuint, GLuint buffer, GLintptr, GLsizeiptr) {
+    gl_interceptor::state_shadow::set(gl_intercept().state.buffer(target), buffer);
+    return false;
+}
+
+GL_INSPECT(glDeleteBuffers, GLsizei count, const GLuint *buffers) {
+    // deleting a bound buffer unbinds it, so binding a new one with the same name is not redundant
+    gl_interceptor::state_shadow &state = gl_intercept().state;
+    for (GLsizei i = 0; i < count; ++i)
+        for (GLuint *binding : {&state.array_buffer, &state.uniform_buffer, &state.storage_buffer})
+            if (*binding == buffers[i])
+                *binding = -1;
+    return false;
+}
+
+GL_INSPECT(glBindFramebuffer, GLenum target, GLuint framebuffer) {
+    gl_interceptor::state_shadow &state = gl_intercept().state;
+    bool read_same = state.read_framebuffer == framebuffer, draw_same = state.draw_framebuffer == framebuffer;
+    if (target != GL_DRAW_FRAMEBUFFER)
+        state.read_framebuffer = framebuffer;
+    if (target != GL_READ_FRAMEBUFFER)
+        state.draw_framebuffer = framebuffer;
+    if (target == GL_READ_FRAMEBUFFER)
+        return read_same;
+    if (target == GL_DRAW_FRAMEBUFFER)
+        return draw_same;
+    return read_same && draw_same;
+}
+
+GL_INSPECT(glActiveTexture, GLenum unit) {
+    return gl_interceptor::state_shadow::set(&gl_intercept().state.active_texture, GLuint(unit));
+}
+
+GL_INSPECT(glBindTexture, GLenum target, GLuint texture) {
+    return gl_interceptor::state_shadow::set(gl_intercept().state.texture(target), texture);
+}
+
+GL_INSPECT(glEnable, GLenum capability) { return gl_intercept().state.set_capability(capability, true); }
+GL_INSPECT(glDisable, GLenum capability) { return gl_intercept().state.set_capability(capability, false); }
+
+GL_INSPECT(glDepthFunc, GLenum function) {
+    return gl_interceptor::state_shadow::set(&gl_intercept().state.depth_func, GLint(function));
+}
+
+GL_INSPECT(glDepthMask, GLboolean mask) {
+    return gl_interceptor::state_shadow::set(&gl_intercept().state.depth_mask, GLint(mask));
+}
+
+GL_INSPECT(glColorMask, GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha) {
+    return gl_interceptor::state_shadow::set(&gl_intercept().state.color_mask,
+                                             GLint(red | green << 1 | blue << 2 | alpha << 3));
+}
+
+GL_INSPECT(glBlendFunc, GLenum source, GLenum destination) {
+    gl_interceptor::state_shadow &state = gl_intercept().state;
+    bool same_source = gl_interceptor::state_shadow::set(&state.blend_source, GLint(source));
+    return gl_interceptor::state_shadow::set(&state.blend_destination, GLint(destination)) && same_source;
+}
+
+GL_INSPECT(glViewport, GLint x, GLint y, GLsizei width, GLsizei height) {
+    GLint *viewport = gl_intercept().state.viewport;
+    bool same = viewport[0] == x && viewport[1] == y && viewport[2] == width && viewport[3] == height;
+    viewport[0] = x, viewport[1] = y, viewport[2] = width, viewport[3] = height;
+    return same;
+}
+
+GL_INSPECT(glBufferData, GLenum, GLsizeiptr size, const void *data, GLenum) {
+    if (data != nullptr)
+        gl_intercept().frame.bytes_uploaded += size;
+    return false;
+}
+
+GL_INSPECT(glBufferSubData, GLenum, GLintptr, GLsizeiptr size, const void *) {
+    gl_intercept().frame.bytes_uploaded += size;
+    return false;
+}
+
+GL_INSPECT(glTexImage2D, GLenum, GLint, GLint, GLsizei width, GLsizei height, GLint, GLenum format, GLenum type,
+           const void *pixels) {
+    if (pixels != nullptr)
+        gl_intercept().frame.bytes_uploaded += size_t(width) * height * gl_pixel_size(format, type);
+    return false;
+}
+
+GL_INSPECT(glTexImage3D, GLenum, GLint, GLint, GLsizei width, GLsizei height, GLsizei depth, GLint, GLenum format,
+           GLenum type, const void *pixels) {
+    if (pixels != nullptr)
+        gl_intercept().frame.bytes_uploaded += size_t(width) * height * depth * gl_pixel_size(format, type);
+    return false;
+}
+
+#undef GL_INSPECT
+
+/**
+ * \brief Stands in for the glad pointer slot points at, counting and inspecting each call before forwarding it
+ */
+template <auto *slot, typename Pointer = std::remove_pointer_t<decltype(slot)>> struct gl_hook;
+
+template <auto *slot, typename R, typename... Args> struct gl_hook<slot, R(APIENTRYP)(Args...)> {
+    static inline R(APIENTRYP original)(Args...) = nullptr;
+    static inline unsigned id = 0;
+
+    static R APIENTRY call(Args... args) {
+        gl_interceptor &interceptor = gl_intercept();
+        ++interceptor.frame.calls[id];
+        if (gl_inspect<slot>::call(args...))
+            ++interceptor.frame.redundant[id];
+        return original(args...);
+    }
+
+    static void install(const char *name) {
+        // entry points the driver does not have stay null, so code checking for them still can
+        if (*slot == nullptr || *slot == call)
+            return;
+        id = gl_intercept().names.size();
+        gl_intercept().names.push_back(name);
+        original = *slot;
+        *slot = call;
+    }
+};
+
+inline void gl_interceptor::install() {
+    if (installed)
+        return;
+#define GL_INSTALL_HOOK(entry_point) gl_hook<&glad_##entry_point>::install(#entry_point);
+    GL_INTERCEPTED_ENTRY_POINTS(GL_INSTALL_HOOK)
+#undef GL_INSTALL_HOOK
+    for (gl_call_summary *summary : {&frame, &last_frame, &frames}) {
+        summary->calls.assign(names.size(), 0);
+        summary->redundant.assign(names.size(), 0);
+    }
+    installed = true;
+    std::cout << "gl calls: intercepting " << names.size() << " entry points" << std::endl;
+}
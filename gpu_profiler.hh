@@ -0,0 +1,122 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <cstdint>
+
+#include "profiler.hh"
+
+/**
+ * \brief Times passes on the gpu and adds them to the profiler's trace on a track of their own
+ * Each zone writes a GL_TIMESTAMP at its start and end, so zones can nest. Results are read
+ * FRAME_COUNT frames later, when the gpu has long finished them, and moved onto the cpu's timeline
+ * with an offset measured when recording starts. Only the gl thread may use it
+ */
+struct gpu_profiler {
+    static const unsigned FRAME_COUNT = 4;
+    static const unsigned MAX_ZONES = 32; // per frame, zones past this are not recorded
+
+    bool supported = false;
+
+    void init() {
+        supported = GLAD_GL_VERSION_3_3 && glQueryCounter != nullptr;
+        if (!supported) {
+            std::cout << "timestamp queries need OpenGL 3.3, gpu zones are not profiled" << std::endl;
+            return;
+        }
+        glGenQueries(FRAME_COUNT * MAX_ZONES * 2, queries[0][0]);
+        track = &profile().create_track("gpu");
+    }
+
+    /**
+     * \brief Collect the zones of the frame FRAME_COUNT frames ago and start a new one
+     */
+    void begin_frame() {
+        if (!supported)
+            return;
+        frame_zones &frame = frames[frame_index % FRAME_COUNT];
+        for (unsigned i = 0; i < frame.count; ++i) {
+            GLint available = 0;
+            glGetQueryObjectiv(queries[frame_index % FRAME_COUNT][i][1], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+                continue;
+            GLuint64 start, end;
+            glGetQueryObjectui64v(queries[frame_index % FRAME_COUNT][i][0], GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(queries[frame_index % FRAME_COUNT][i][1], GL_QUERY_RESULT, &end);
+            if (frame.recording == calibrated_recording)
+                track->record(frame.names[i], int64_t(start) + offset, int64_t(end) + offset);
+        }
+        frame.count = 0;
+
+        unsigned recording = profile().recordings.load(std::memory_order_relaxed);
+        if (profile().enabled.load(std::memory_order_relaxed) && recording != calibrated_recording) {
+            // the gpu's clock has its own zero, line it up with the cpu's once per recording
+            GLint64 gpu_now;
+            glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+            offset = profile().now() - gpu_now;
+            calibrated_recording = recording;
+        }
+        frame.recording = calibrated_recording;
+        ++frame_index;
+    }
+
+    /**
+     * \brief Start a zone, returns what to pass to end() or -1 if nothing is recorded
+     */
+    int begin(const char *name) {
+        frame_zones &frame = frames[(frame_index + FRAME_COUNT - 1) % FRAME_COUNT];
+        if (!supported || !profile().enabled.load(std::memory_order_relaxed) || frame.count == MAX_ZONES)
+            return -1;
+        frame.names[frame.count] = name;
+        glQueryCounter(queries[(frame_index + FRAME_COUNT - 1) % FRAME_COUNT][frame.count][0], GL_TIMESTAMP);
+        return frame.count++;
+    }
+
+    void end(int zone) {
+        if (zone >= 0)
+            glQueryCounter(queries[(frame_index + FRAME_COUNT - 1) % FRAME_COUNT][zone][1], GL_TIMESTAMP);
+    }
+
+  private:
+    struct frame_zones {
+        const char *names[MAX_ZONES];
+        unsigned count = 0;
+        unsigned recording = 0; // which recording the zones belong to
+    };
+
+    GLuint queries[FRAME_COUNT][MAX_ZONES][2] = {}; // start and end of each zone
+    frame_zones frames[FRAME_COUNT];
+    unsigned frame_index = 0;
+    profile_track *track = nullptr;
+    int64_t offset = 0; // cpu minus gpu time
+    unsigned calibrated_recording = 0;
+};
+
+/**
+ * \brief The gpu profiler the engine shares
+ */
+inline gpu_profiler &gpu_profile() {
+    static gpu_profiler instance;
+    return instance;
+}
+
+/**
+ * \brief Records the gpu time of the commands issued during its lifetime as a zone
+ */
+struct gpu_profile_zone {
+    int zone;
+
+    explicit gpu_profile_zone(const char *name) : zone(gpu_profile().begin(name)) {}
+    ~gpu_profile_zone() { gpu_profile().end(zone); }
+
+    gpu_profile_zone(const gpu_profile_zone &) = delete;
+    gpu_profile_zone &operator=(const gpu_profile_zone &) = delete;
+};
+
+#ifndef NO_PROFILER
+// times the gpu work issued in the rest of the enclosing scope
+#define PROFILE_GPU_ZONE(name) gpu_profile_zone PROFILE_CONCATENATE(gpu_profile_zone_, __LINE__)(name)
+#else
+#define PROFILE_GPU_ZONE(name)
+#endif
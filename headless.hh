@@ -0,0 +1,98 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <cstring>
+#include <iostream>
+
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
+
+/**
+ * \brief OpenGL context without a window or a display server, for benchmark runs on render nodes
+ * Built with HEADLESS_EGL (linking -lEGL) it is a surfaceless EGL context, which Mesa also provides on
+ * machines without a gpu through llvmpipe. It has no default framebuffer, so everything is drawn offscreen.
+ * Without HEADLESS_EGL create() fails and the caller can fall back to a hidden window
+ */
+struct headless_context {
+#ifdef HEADLESS_EGL
+    EGLDisplay display = EGL_NO_DISPLAY;
+    EGLContext context = EGL_NO_CONTEXT;
+#endif
+
+    /**
+     * \brief Create a core profile context of at least the given version, make it current and load gl
+     */
+    bool create(int major, int minor) {
+#ifdef HEADLESS_EGL
+        // the surfaceless platform needs no display server, the default display is the fallback
+        auto get_platform_display =
+            reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+        if (get_platform_display != nullptr)
+            display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+        if (display == EGL_NO_DISPLAY)
+            display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+        EGLint egl_major, egl_minor;
+        if (display == EGL_NO_DISPLAY || !eglInitialize(display, &egl_major, &egl_minor)) {
+            std::cout << "Failed to initialize EGL" << std::endl;
+            return false;
+        }
+        const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+        if (extensions == nullptr || std::strstr(extensions, "EGL_KHR_surfaceless_context") == nullptr) {
+            std::cout << "EGL does not support surfaceless contexts" << std::endl;
+            return false;
+        }
+        if (!eglBindAPI(EGL_OPENGL_API)) {
+            std::cout << "EGL does not support desktop OpenGL" << std::endl;
+            return false;
+        }
+
+        const EGLint config_attributes[] = {EGL_SURFACE_TYPE, EGL_PBUFFER_BIT, EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                            EGL_NONE};
+        EGLConfig config;
+        EGLint config_count = 0;
+        if (!eglChooseConfig(display, config_attributes, &config, 1, &config_count) || config_count == 0) {
+            std::cout << "No EGL config supports OpenGL" << std::endl;
+            return false;
+        }
+        const EGLint context_attributes[] = {EGL_CONTEXT_MAJOR_VERSION,
+                                             major,
+                                             EGL_CONTEXT_MINOR_VERSION,
+                                             minor,
+                                             EGL_CONTEXT_OPENGL_PROFILE_MASK,
+                                             EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+                                             EGL_NONE};
+        context = eglCreateContext(display, config, EGL_NO_CONTEXT, context_attributes);
+        if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+            std::cout << "Failed to create a surfaceless OpenGL " << major << "." << minor << " context"
+                      << std::endl;
+            return false;
+        }
+        if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress))) {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return false;
+        }
+        std::cout << "headless: " << glGetString(GL_RENDERER) << ", OpenGL " << glGetString(GL_VERSION) << std::endl;
+        return true;
+#else
+        (void)major, (void)minor;
+        std::cout << "built without HEADLESS_EGL, rendering to a hidden window instead" << std::endl;
+        return false;
+#endif
+    }
+
+    void destroy() {
+#ifdef HEADLESS_EGL
+        if (display == EGL_NO_DISPLAY)
+            return;
+        eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+        if (context != EGL_NO_CONTEXT)
+            eglDestroyContext(display, context);
+        eglTerminate(display);
+        display = EGL_NO_DISPLAY;
+        context = EGL_NO_CONTEXT;
+#endif
+    }
+};
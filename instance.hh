@@ -0,0 +1,73 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstring>
+#include <algorithm>
+
+#include "ring_buffer.hh"
+
+// first vertex attribute location of the per-instance model matrix, one location per column
+const GLuint INSTANCE_MODEL_ATTRIBUTE = 3;
+
+/**
+ * \brief Per-instance model matrices for drawing many copies of an object in one call per mesh
+ * Edit transforms freely on the cpu, then call upload() once per frame to copy them to the gpu in bulk
+ */
+struct instance_list {
+    std::vector<glm::mat4> transforms;
+
+    GLuint VBO_id = 0;        // buffer the transforms of the last upload are in
+    GLuint stream_VBO_id = 0; // buffer of their own, when they are not in a ring buffer
+    GLintptr offset = 0; // byte offset of the first transform in the buffer
+    GLsizei count = 0;   // instances in the gpu buffer as of the last upload
+    size_t capacity = 0; // instances the gpu buffer can hold without reallocating
+
+    void upload() {
+        if (stream_VBO_id == 0)
+            glGenBuffers(1, &stream_VBO_id);
+        VBO_id = stream_VBO_id;
+        glBindBuffer(GL_ARRAY_BUFFER, VBO_id);
+        // grow geometrically so adding a few instances a frame does not reallocate every time
+        if (transforms.size() > capacity)
+            capacity = std::max(transforms.size(), capacity * 2);
+        // (re)specifying the storage orphans the old one, so the driver does not wait for draws still reading it
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::mat4) * capacity, NULL, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(glm::mat4) * transforms.size(), transforms.data());
+        render_count().bytes_uploaded += sizeof(glm::mat4) * transforms.size();
+        offset = 0;
+        count = transforms.size();
+    }
+
+    /**
+     * \brief Copy the transforms into this frame's part of a ring buffer instead of a buffer of their own
+     * \return false if the ring had no room, nothing was uploaded then
+     */
+    bool upload(ring_buffer &ring) {
+        ring_buffer::allocation allocation = ring.allocate(sizeof(glm::mat4) * transforms.size());
+        if (allocation.pointer == nullptr)
+            return false;
+        std::memcpy(allocation.pointer, transforms.data(), sizeof(glm::mat4) * transforms.size());
+        VBO_id = ring.buffer_id;
+        offset = allocation.offset;
+        count = transforms.size();
+        return true;
+    }
+
+    /**
+     * \brief Point the instance attributes of the currently bound vertex array at this buffer
+     */
+    void bind_attributes() const {
+        glBindBuffer(GL_ARRAY_BUFFER, VBO_id);
+        for (GLuint column = 0; column < 4; ++column) {
+            GLuint location = INSTANCE_MODEL_ATTRIBUTE + column;
+            glVertexAttribPointer(location, glm::mat4::col_type::length(), GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+                                  reinterpret_cast<void *>(offset + sizeof(glm::mat4::col_type) * column));
+            glVertexAttribDivisor(location, 1);
+            glEnableVertexAttribArray(location);
+        }
+    }
+};
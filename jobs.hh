@@ -0,0 +1,249 @@
+#pragma once
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include <cstdint>
+#include <string>
+
+#include "profiler.hh"
+
+// counts the jobs started against it that have not finished yet
+struct job_counter {
+    std::atomic<unsigned> pending{0};
+
+    bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+};
+
+struct job {
+    std::function<void()> function;
+    job_counter *counter;
+};
+
+/**
+ * \brief Chase-Lev work stealing deque of a fixed size
+ * Only the owning worker pushes and pops, at the bottom. Any thread may steal from the top
+ */
+struct job_deque {
+    static const int64_t CAPACITY = 1 << 12;
+
+    /**
+     * \return false if the deque is full
+     */
+    bool push(job *item) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= CAPACITY)
+            return false;
+        buffer[b & (CAPACITY - 1)].store(item, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    job *pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_seq_cst);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        job *item = buffer[b & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // the last item, race the thieves for it
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                item = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return item;
+    }
+
+    job *steal() {
+        int64_t t = top.load(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_seq_cst);
+        if (t >= b)
+            return nullptr;
+        job *item = buffer[t & (CAPACITY - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return nullptr;
+        return item;
+    }
+
+  private:
+    std::atomic<int64_t> top{0}, bottom{0};
+    std::atomic<job *> buffer[CAPACITY] = {};
+};
+
+/**
+ * \brief Work stealing job scheduler
+ * Every worker owns a deque, pushes the jobs it starts onto it and pops them from the same end,
+ * and steals from the other end of another worker's deque when its own runs dry. Threads that are
+ * not workers hand their jobs in through a shared queue. A thread waiting on a counter runs jobs
+ * until the counter reaches zero, so jobs may start and wait on other jobs
+ */
+struct job_system {
+    /**
+     * \param thread_count threads doing work including the one that waits, so thread_count - 1 workers are started
+     */
+    explicit job_system(unsigned thread_count = std::max(1u, std::thread::hardware_concurrency()))
+        : deques(std::max(thread_count, 1u) - 1) {
+        for (unsigned i = 0; i < deques.size(); ++i)
+            deques[i] = std::make_unique<job_deque>();
+        for (unsigned i = 0; i < deques.size(); ++i)
+            workers.emplace_back(&job_system::work, this, i);
+    }
+
+    ~job_system() {
+        {
+            std::lock_guard<std::mutex> lock(sleep_mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+    }
+
+    job_system(const job_system &) = delete;
+    job_system &operator=(const job_system &) = delete;
+
+    unsigned thread_count() const { return deques.size() + 1; }
+
+    /**
+     * \brief Start function() as a job, counter is incremented now and decremented when it finishes
+     * Runs it right away when there are no workers
+     */
+    template <typename function_type> void run(function_type &&function, job_counter &counter) {
+        if (deques.empty()) {
+            function();
+            return;
+        }
+        counter.pending.fetch_add(1, std::memory_order_relaxed);
+        job *item = new job{std::forward<function_type>(function), &counter};
+
+        int worker = current_worker();
+        if (worker >= 0) {
+            if (!deques[worker]->push(item)) {
+                execute(item); // full, so there is plenty of work queued already
+                return;
+            }
+        } else {
+            std::lock_guard<std::mutex> lock(shared_mutex);
+            shared.push_back(item);
+        }
+
+        queued.fetch_add(1, std::memory_order_seq_cst);
+        if (sleeping.load(std::memory_order_seq_cst) > 0) {
+            // taking the lock orders this with a worker that is about to sleep
+            { std::lock_guard<std::mutex> lock(sleep_mutex); }
+            wake.notify_one();
+        }
+    }
+
+    /**
+     * \brief Run jobs until every job started against counter has finished
+     */
+    void wait(job_counter &counter) {
+        int worker = current_worker();
+        while (!counter.done()) {
+            if (job *item = find_job(worker))
+                execute(item);
+            else
+                std::this_thread::yield();
+        }
+    }
+
+  private:
+    std::vector<std::unique_ptr<job_deque>> deques;
+    std::vector<std::thread> workers;
+
+    std::mutex shared_mutex;
+    std::deque<job *> shared; // jobs started by threads that are not workers
+
+    std::atomic<int> queued{0};   // jobs pushed and not taken yet
+    std::atomic<int> sleeping{0}; // workers waiting for jobs
+    std::mutex sleep_mutex;
+    std::condition_variable wake;
+    bool stopping = false;
+
+    struct worker_identity {
+        const job_system *system = nullptr;
+        int index = -1;
+    };
+    static worker_identity &identity() {
+        thread_local worker_identity current;
+        return current;
+    }
+
+    int current_worker() const { return identity().system == this ? identity().index : -1; }
+
+    void execute(job *item) {
+        {
+            PROFILE_ZONE("job");
+            item->function();
+        }
+        item->counter->pending.fetch_sub(1, std::memory_order_release);
+        delete item;
+    }
+
+    job *find_job(int worker) {
+        job *item = worker >= 0 ? deques[worker]->pop() : nullptr;
+        if (item == nullptr) {
+            std::lock_guard<std::mutex> lock(shared_mutex);
+            if (!shared.empty()) {
+                item = shared.front();
+                shared.pop_front();
+            }
+        }
+        // steal from the others, starting at a different one each time to spread the thieves out
+        thread_local uint32_t random = 2463534242u;
+        for (unsigned attempt = 0; item == nullptr && attempt < deques.size(); ++attempt) {
+            random ^= random << 13;
+            random ^= random >> 17;
+            random ^= random << 5;
+            unsigned victim = (random + attempt) % deques.size();
+            if (int(victim) != worker)
+                item = deques[victim]->steal();
+        }
+        if (item != nullptr)
+            queued.fetch_sub(1, std::memory_order_relaxed);
+        return item;
+    }
+
+    void work(unsigned index) {
+        identity() = {this, int(index)};
+        profile().name_thread("worker " + std::to_string(index + 1));
+        unsigned idle_rounds = 0;
+        while (true) {
+            if (job *item = find_job(index)) {
+                execute(item);
+                idle_rounds = 0;
+                continue;
+            }
+            if (++idle_rounds < 64) {
+                std::this_thread::yield();
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            sleeping.fetch_add(1, std::memory_order_seq_cst);
+            wake.wait(lock, [&] { return stopping || queued.load(std::memory_order_seq_cst) > 0; });
+            sleeping.fetch_sub(1, std::memory_order_seq_cst);
+            if (stopping)
+                return;
+            idle_rounds = 0;
+        }
+    }
+};
+
+/**
+ * \brief The job system the engine shares, with one thread per core
+ */
+inline job_system &jobs() {
+    static job_system system;
+    return system;
+}
@@ -8,181 +8,611 @@
 #include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <random>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <limits>
+#include <cctype>
+#include <cerrno>
+#include <cstdlib>
 
 #include "shaders.h"
+#include "shader.hh"
 #include "object.hh"
+#include "instance.hh"
+#include "ring_buffer.hh"
+#include "frame_uniforms.hh"
+#include "clusters.hh"
+#include "shadows.hh"
+#include "resolution.hh"
+#include "profiler.hh"
+#include "gpu_profiler.hh"
+#include "headless.hh"
+#include "camera.hh"
+#include "telemetry.hh"
+#include "gl_intercept.hh"
+#include "pipeline.hh"
+#include "scene.hh"
 
 void framebuffer_size_callback(GLFWwindow *window, int width, int height);
+void print_usage();
+bool parse_number(const char *text, unsigned &value);
+bool parse_number(const char *text, float &value);
 
 int window_width = 800;
 int window_height = 600;
 
-float camera_fov = glm::radians(45.0f);             // vertical fov in radians
-glm::vec3 camera_pos = glm::vec3(0.0f, 0.0f, 3.0f); // camera position in world coordinates
-float camera_yaw = 0;
-float camera_pitch = 0;
+// what the cpu stage of a frame needs from the gl thread
+struct frame_input {
+    glm::mat4 model, view, projection;
+    glm::vec3 camera_position;
+    bool occlusion_culling;
+};
 
-int main() {
+// a prepared frame, ready to submit
+struct frame_packet {
+    glm::mat4 model, view, projection;
+    frame_draws draws;
+    cull_stats stats;
+    light_clusters clusters;
+};
 
+int main(int argc, char **argv) {
+
+    // command line options, see print_usage
     std::string model_name;
+    bool headless = false;
+    bool count_gl_calls = false;
+    unsigned frame_count = 1000;
+    std::string camera_path_name, record_path_name, telemetry_name;
+    camera_path path;
+    load_options options;
+    // split big material groups so level geometry can be culled in pieces
+    options.split_meshes = true;
+    unsigned frame_latency = 1;
+    unsigned light_count = 0;
+    unsigned instance_count = 0;
+    dynamic_resolution resolution;
+    for (int i = 1; i < argc; ++i) {
+        std::string option = argv[i];
+        // the argument after the option, or nullptr if there is none
+        auto next_value = [&]() -> const char * { return i + 1 < argc ? argv[++i] : nullptr; };
+        auto next_string = [&](std::string &value) {
+            const char *text = next_value();
+            if (text != nullptr)
+                value = text;
+            return text != nullptr;
+        };
+        bool valid = true;
+        if (option == "--model")
+            valid = next_string(model_name);
+        else if (option == "--headless")
+            headless = true;
+        else if (option == "--frames")
+            valid = parse_number(next_value(), frame_count) && frame_count > 0;
+        else if (option == "--resolution") {
+            std::string size;
+            valid = next_string(size);
+            size_t separator = size.find('x');
+            unsigned width = 0, height = 0;
+            valid = valid && separator != std::string::npos && parse_number(size.substr(0, separator).c_str(), width) &&
+                    parse_number(size.substr(separator + 1).c_str(), height) && width > 0 && height > 0 &&
+                    width <= 16384 && height <= 16384;
+            if (valid) {
+                window_width = width;
+                window_height = height;
+            }
+        } else if (option == "--camera-path")
+            valid = next_string(camera_path_name);
+        else if (option == "--path-steps")
+            valid = parse_number(next_value(), path.steps) && path.steps > 0;
+        else if (option == "--record-path")
+            valid = next_string(record_path_name);
+        else if (option == "--gl-calls")
+            count_gl_calls = true;
+        else if (option == "--telemetry")
+            valid = next_string(telemetry_name);
+        else if (option == "--profile")
+            profile().start();
+        else if (option == "--bake-pvs")
+            options.bake_pvs = true;
+        else if (option == "--bake-ao")
+            options.bake_ao = true;
+        else if (option == "--no-atlas")
+            options.build_atlas = false;
+        else if (option == "--latency") {
+            valid = parse_number(next_value(), frame_latency);
+            if (frame_latency > 2) {
+                std::cout << "--latency " << frame_latency << " is more than 2, using 2" << std::endl;
+                frame_latency = 2;
+            }
+        } else if (option == "--lights")
+            valid = parse_number(next_value(), light_count);
+        else if (option == "--instances")
+            valid = parse_number(next_value(), instance_count);
+        else if (option == "--target-ms")
+            valid = parse_number(next_value(), resolution.target_ms) && resolution.target_ms > 0.0f;
+        else if (option == "--scale-bounds") {
+            valid = parse_number(next_value(), resolution.min_scale) &&
+                    parse_number(next_value(), resolution.max_scale) && resolution.min_scale > 0.0f;
+            resolution.max_scale = std::max(resolution.max_scale, resolution.min_scale);
+        } else if (option == "--help") {
+            print_usage();
+            return 0;
+        } else {
+            std::cout << "Unknown option " << option << std::endl;
+            print_usage();
+            return EXIT_FAILURE;
+        }
+        if (!valid) {
+            std::cout << "Missing or bad value for " << option << std::endl;
+            print_usage();
+            return EXIT_FAILURE;
+        }
+    }
+
     std::string default_model = "./models/peach_castle/peach_castle.obj";
-    std::cout << "Enter model path (default " << default_model <<" ): " << std::flush;
-    std::getline(std::cin, model_name);
+    if (model_name.empty() && !headless) {
+        std::cout << "Enter model path (default " << default_model <<" ): " << std::flush;
+        std::getline(std::cin, model_name);
+    }
     if(model_name.empty())
         model_name = default_model;
 
-    // initialize and configure glfw
-    glfwInit();
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    if (!camera_path_name.empty() && !load_camera_path(camera_path_name, path.keyframes))
+        return EXIT_FAILURE;
+    camera_recorder recorder;
+    if (!record_path_name.empty() && !recorder.open(record_path_name))
+        return EXIT_FAILURE;
+
+    // headless runs try a context without a window first, and otherwise use a hidden window
+    headless_context headless_gl;
+    GLFWwindow *window = NULL;
+    if (!headless || !headless_gl.create(3, 3)) {
+        // initialize and configure glfw
+        glfwInit();
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+        glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+        glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+        if (headless)
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
 #ifdef __APPLE__
-    glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+        glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
 #endif
 
-    // glfw: create window
-    GLFWwindow *window = glfwCreateWindow(window_width, window_height, "OpenGL", NULL, NULL);
-    if (window == NULL) {
-        std::cout << "Failed to create GLFW window" << std::endl;
-        glfwTerminate();
-        return EXIT_FAILURE;
+        // glfw: create window
+        window = glfwCreateWindow(window_width, window_height, "OpenGL", NULL, NULL);
+        if (window == NULL) {
+            std::cout << "Failed to create GLFW window" << std::endl;
+            glfwTerminate();
+            return EXIT_FAILURE;
+        }
+        glfwMakeContextCurrent(window);
+        glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+
+        // glad: load all OpenGL function pointers
+        if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+            std::cout << "Failed to initialize GLAD" << std::endl;
+            return EXIT_FAILURE;
+        }
     }
-    glfwMakeContextCurrent(window);
-    glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
-    // glad: load all OpenGL function pointers
-    if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
-        std::cout << "Failed to initialize GLAD" << std::endl;
+    if (count_gl_calls)
+        gl_intercept().install();
+
+    profile().name_thread("main");
+    gpu_profile().init();
+
+    // linked programs are cached on disk, so only the first launch after a shader or driver change compiles them
+    program_cache programs;
+    programs.init("shader_cache_");
+    // every material is drawn with the fragment shader variant that has just the features it needs
+    static_assert(unsigned(SHADER_TEXTURED) == FRAGMENT_GLSL_TEXTURED &&
+                      unsigned(SHADER_ALPHA_TEST) == FRAGMENT_GLSL_ALPHA_TEST,
+                  "material shader features do not match the feature flags of fragment.glsl");
+    program_variants shader_programs, instanced_programs;
+    if (!shader_programs.create(programs, vertex_glsl, fragment_glsl_variants, FRAGMENT_GLSL_VARIANT_COUNT,
+                                "default") ||
+        !instanced_programs.create(programs, vertex_instanced_glsl, fragment_glsl_variants,
+                                   FRAGMENT_GLSL_VARIANT_COUNT, "instanced"))
         return EXIT_FAILURE;
-    }
-
-    GLint success;
-    GLchar info[512];
-
-    // load and compile vertex shader
-    GLuint vertex_shader_id = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex_shader_id, 1, &vertex_glsl, NULL);
-    glCompileShader(vertex_shader_id);
-    glGetShaderiv(vertex_shader_id, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        GLchar info[512];
-        glGetShaderInfoLog(vertex_shader_id, sizeof(info), NULL, info);
-        std::cout << "Failed to compile vertex shader: " << info << std::endl;
+    // draws only the depth of opaque meshes from their positions, before they are shaded
+    program_variants depth_program;
+    // draw the depth of static and instanced meshes into the sun's shadow maps, alpha tested ones with a variant
+    // that discards their see-through texels
+    program_variants shadow_program, shadow_instanced_program;
+    if (!depth_program.create(programs, vertex_depth_glsl, fragment_depth_glsl_variants, 1, "depth") ||
+        !shadow_program.create(programs, vertex_shadow_glsl, fragment_depth_glsl_variants,
+                               FRAGMENT_DEPTH_GLSL_VARIANT_COUNT, "shadow") ||
+        !shadow_instanced_program.create(programs, vertex_shadow_instanced_glsl, fragment_depth_glsl_variants,
+                                         FRAGMENT_DEPTH_GLSL_VARIANT_COUNT, "instanced shadow"))
         return EXIT_FAILURE;
-    }
 
-    // load and compile fragment shader
-    GLuint fragment_shader_id = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment_shader_id, 1, &fragment_glsl, NULL);
-    glCompileShader(fragment_shader_id);
-    glGetShaderiv(fragment_shader_id, GL_COMPILE_STATUS, &success);
-    if (!success) {
-        glGetShaderInfoLog(fragment_shader_id, sizeof(info), NULL, info);
-        std::cout << "Failed to compile fragment shader: " << info << std::endl;
-        return EXIT_FAILURE;
+    object object(model_name, glm::scale(glm::mat4(1.0f), glm::vec3(1.0f)), options);
+    camera camera;
+    camera.pose.position = glm::vec3(0.0f, 2.0f, 10.0f);
+
+    // the object's transform is owned by its scene node from here on
+    scene_graph scene;
+    unsigned object_node = scene.add_node(scene_graph::NO_PARENT, object.model_mat);
+
+    // lights are binned into clusters every frame, so each pixel only shades the few near it
+    light_list scene_lights;
+    aabb model_bounds;
+    for (const mesh &mesh : object.meshes)
+        model_bounds.expand(mesh.bounds);
+    std::mt19937 light_rng(1);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    float light_radius = glm::length(model_bounds.max - model_bounds.min) * 0.02f;
+    for (unsigned i = 0; i < light_count && !model_bounds.empty(); ++i) {
+        light light;
+        glm::vec3 along(unit(light_rng), unit(light_rng), unit(light_rng));
+        light.position = glm::mix(model_bounds.min, model_bounds.max, along);
+        light.radius = light_radius * (0.5f + unit(light_rng));
+        light.color = glm::vec3(unit(light_rng), unit(light_rng), unit(light_rng)) * 2.0f;
+        if (i % 4 == 0)
+            light.spot_cos = std::cos(glm::radians(30.0f)); // every fourth one points down
+        scene_lights.lights.push_back(light);
     }
-
-    // create and link shader program
-    GLuint shader_program_id = glCreateProgram();
-    glAttachShader(shader_program_id, vertex_shader_id);
-    glAttachShader(shader_program_id, fragment_shader_id);
-    glLinkProgram(shader_program_id);
-    glGetProgramiv(shader_program_id, GL_LINK_STATUS, &success);
-    if (!success) {
-        glGetProgramInfoLog(shader_program_id, sizeof(info), NULL, info);
-        std::cout << "Failed to link shader program: " << info << std::endl;
-        return EXIT_FAILURE;
+    scene_lights.upload();
+
+    // extra copies of the object, drawn with one instanced call per mesh
+    // they float in a layer above the model and spin, so every transform is rewritten each frame
+    struct instance_motion {
+        glm::vec3 position;
+        float scale, phase, speed; // spin in radians and radians per second
+    };
+    std::vector<instance_motion> instance_motions;
+    instance_list instances;
+    if (!model_bounds.empty()) {
+        glm::vec3 model_size = model_bounds.max - model_bounds.min;
+        float instance_scale = 0.5f / std::max(std::sqrt(float(instance_count)), 1.0f);
+        for (unsigned i = 0; i < instance_count; ++i) {
+            glm::vec3 along(unit(light_rng), 1.1f + 0.2f * unit(light_rng), unit(light_rng));
+            instance_motions.push_back({model_bounds.min + model_size * along,
+                                        instance_scale * (0.5f + unit(light_rng)), 6.2831853f * unit(light_rng),
+                                        0.5f + 2.0f * unit(light_rng)});
+        }
+        instances.transforms.resize(instance_motions.size());
     }
-    glDeleteShader(fragment_shader_id);
-    glDeleteShader(vertex_shader_id);
-
-    object object(model_name, glm::scale(glm::mat4(1.0f), glm::vec3(1.0f)));
-    camera_pos = glm::vec3(0.0f, 2.0f, 10.0f);
+    float animation_time = 0.0f;
+
+    // per frame data is streamed through a persistently mapped buffer when the driver supports it
+    ring_buffer frame_ring;
+    frame_ring.init(GL_ARRAY_BUFFER, 4 << 20);
+
+    // cpu depth buffer the biggest meshes are drawn into to skip whatever they hide, O toggles it
+    occlusion_buffer occlusion(256, 128);
+    bool occlusion_culling = true;
+    bool occlusion_key_down = false;
+
+    // P toggles drawing the depth of opaque meshes before shading them, which saves shading hidden pixels
+    // in fill bound views at the cost of drawing their vertices twice
+    bool depth_prepass = false;
+    bool depth_prepass_key_down = false;
+
+    // the level's shadows are cached, only the instances are drawn into the shadow maps every frame
+    // [ and ] turn the sun, which draws the cached shadows again
+    cascaded_shadow_maps shadows;
+    shadows.init();
+    float sun_azimuth = glm::radians(45.0f), sun_elevation = glm::radians(35.0f);
+
+    // F9 starts recording a trace, and pressing it again writes it to trace_<frame>.json
+    bool profile_key_down = false;
+    bool profile_on_exit = profile().enabled;
+    unsigned frame_number = 0;
+
+    // every frame's times, draws, uploads and culling results, F10 writes them to telemetry_<frame>.csv and .json
+    frame_telemetry telemetry;
+    bool telemetry_key_down = false;
+
+    // frames are drawn at a resolution that keeps the gpu time under the target, then stretched over the window
+    resolution.init();
+
+    // culling, sorting and encoding the draws of the next frame overlap drawing this one
+    auto prepare_frame = [&](const frame_input &input, frame_packet &packet) {
+        PROFILE_ZONE("prepare frame");
+        object.model_mat = input.model;
+        occlusion.clear();
+        packet.stats = object.cull(input.projection * input.view, input.camera_position, packet.draws,
+                                   input.occlusion_culling ? &occlusion : nullptr);
+        packet.clusters.bin(scene_lights.lights, input.view, input.projection);
+        packet.model = input.model;
+        packet.view = input.view;
+        packet.projection = input.projection;
+    };
+    frame_pipeline<frame_input, frame_packet> pipeline(frame_latency, prepare_frame);
 
     // tell the shader which texture unit each sampler belongs to (only has to be done once)
-    glUseProgram(shader_program_id);
-    glUniform1i(glGetUniformLocation(shader_program_id, "texture_diffuse"), TEXTURE_DIFFUSE);
+    for (program_variants *variants :
+         {&shader_programs, &instanced_programs, &shadow_program, &shadow_instanced_program})
+        variants->set_uniform("texture_diffuse", TEXTURE_DIFFUSE - GL_TEXTURE0);
+    for (program_variants *variants : {&shader_programs, &instanced_programs}) {
+        variants->set_uniform("shadow_static_map", SHADOW_STATIC_UNIT);
+        variants->set_uniform("shadow_dynamic_map", SHADOW_DYNAMIC_UNIT);
+    }
 
     // glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-    float last_frame = glfwGetTime();
+    // the keyboard is ignored in headless runs, so they do the same thing every time
+    auto key_pressed = [&](int key) { return !headless && glfwGetKey(window, key) == GLFW_PRESS; };
+    // glfw's timer needs glfw, which a headless run may not have initialized
+    auto start_time = std::chrono::steady_clock::now();
+    auto seconds = [&] { return std::chrono::duration<float>(std::chrono::steady_clock::now() - start_time).count(); };
+
+    // headless runs time every frame from start to finish, waiting for the gpu at the end of each
+    std::vector<float> frame_times;
+    if (headless) {
+        resolution.present = window != NULL;
+        frame_times.reserve(frame_count);
+    }
+
+    // played back paths step time by a fixed amount each frame rather than by the clock, so every run renders
+    // the same frames
+    const float playback_time_step = 1.0f / 60.0f;
+    float last_frame = seconds();
     float delta_time = 0;
-    while (!glfwWindowShouldClose(window)) {
-        if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
+    float frame_seconds = 0;
+    float last_title_update = 0;
+    while (headless ? frame_number < frame_count : !glfwWindowShouldClose(window)) {
+        PROFILE_ZONE("frame");
+        gpu_profile().begin_frame();
+        ++frame_number;
+        render_count() = render_counters();
+        gl_intercept().begin_frame();
+        frame_sample sample;
+        sample.frame = frame_number;
+        if (key_pressed(GLFW_KEY_ESCAPE))
             glfwSetWindowShouldClose(window, true);
 
-        float current_frame = glfwGetTime();
-        delta_time = current_frame - last_frame;
+        float current_frame = seconds();
+        frame_seconds = current_frame - last_frame;
+        delta_time = path.keyframes.empty() ? frame_seconds : playback_time_step;
         last_frame = current_frame;
 
         // spin object
-        // object.model_mat = glm::rotate(glm::mat4(1.0f), glm::radians(delta_time * 90.0f), glm::vec3(0.0f, 1.0f,
-        // 0.0f)) *
-        //                    object.model_mat;
-
-        float camera_move_speed = delta_time * 2.5f;
-        float camera_turn_speed = glm::radians(delta_time * 90.0f);
-        if (glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS)
-            camera_move_speed *= 2;
+        // scene.set_local(object_node, glm::rotate(glm::mat4(1.0f), glm::radians(delta_time * 90.0f),
+        //                                          glm::vec3(0.0f, 1.0f, 0.0f)) *
+        //                                  scene.get_local(object_node));
+        scene.update();
+
+        // all instances move every frame, rewritten in bulk and uploaded in one go when the frame is submitted
+        animation_time += delta_time;
+        parallel_for(0, instance_motions.size(), 1024, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) {
+                const instance_motion &motion = instance_motions[i];
+                glm::mat4 transform = glm::translate(glm::mat4(1.0f), motion.position);
+                transform = glm::rotate(transform, motion.phase + motion.speed * animation_time,
+                                        glm::vec3(0.0f, 1.0f, 0.0f));
+                instances.transforms[i] = glm::scale(transform, glm::vec3(motion.scale));
+            }
+        });
 
         // TODO mouse look
-        if (glfwGetKey(window, GLFW_KEY_LEFT) == GLFW_PRESS)
-            camera_yaw += camera_turn_speed;
-        if (glfwGetKey(window, GLFW_KEY_RIGHT) == GLFW_PRESS)
-            camera_yaw -= camera_turn_speed;
-        if (glfwGetKey(window, GLFW_KEY_UP) == GLFW_PRESS)
-            camera_pitch += camera_turn_speed;
-        if (glfwGetKey(window, GLFW_KEY_DOWN) == GLFW_PRESS)
-            camera_pitch -= camera_turn_speed;
-        camera_pitch = std::clamp(camera_pitch, glm::radians(-89.9f), glm::radians(89.9f));
-
-        glm::vec3 world_axis_y(0.0f, 1.0f, 0.0f);
-        glm::vec3 camera_axis_z(std::sin(camera_yaw) * std::cos(camera_pitch), -std::sin(camera_pitch),
-                                std::cos(camera_yaw) * std::cos(camera_pitch));
-        glm::vec3 camera_axis_x = glm::normalize(glm::cross(world_axis_y, camera_axis_z));
-        // glm::vec3 camera_axis_y = glm::normalize(glm::cross(camera_axis_z, camera_axis_x));
-
-        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS)
-            camera_pos -= camera_move_speed * camera_axis_z;
-        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS)
-            camera_pos -= camera_move_speed * camera_axis_x;
-        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS)
-            camera_pos += camera_move_speed * camera_axis_z;
-        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
-            camera_pos += camera_move_speed * camera_axis_x;
-        if (glfwGetKey(window, GLFW_KEY_SPACE) == GLFW_PRESS)
-            camera_pos += camera_move_speed * world_axis_y;
-        if (glfwGetKey(window, GLFW_KEY_LEFT_CONTROL) == GLFW_PRESS)
-            camera_pos -= camera_move_speed * world_axis_y;
-
-        glm::mat4 view_mat = glm::lookAt(camera_pos, camera_pos - camera_axis_z, world_axis_y);
-
+        unsigned camera_controls = 0;
+        const std::pair<int, camera_control> camera_keys[] = {
+            {GLFW_KEY_W, CAMERA_FORWARD},         {GLFW_KEY_S, CAMERA_BACK},
+            {GLFW_KEY_A, CAMERA_LEFT},            {GLFW_KEY_D, CAMERA_RIGHT},
+            {GLFW_KEY_SPACE, CAMERA_UP},          {GLFW_KEY_LEFT_CONTROL, CAMERA_DOWN},
+            {GLFW_KEY_LEFT, CAMERA_TURN_LEFT},    {GLFW_KEY_RIGHT, CAMERA_TURN_RIGHT},
+            {GLFW_KEY_UP, CAMERA_TURN_UP},        {GLFW_KEY_DOWN, CAMERA_TURN_DOWN},
+            {GLFW_KEY_LEFT_SHIFT, CAMERA_FAST},
+        };
+        for (const auto &[key, control] : camera_keys)
+            if (key_pressed(key))
+                camera_controls |= control;
+        if (path.keyframes.empty())
+            camera.update(camera_controls, delta_time);
+        else
+            camera.pose = path.at(frame_number - 1);
+        if (recorder.file.is_open())
+            recorder.record(camera.pose, delta_time, camera_controls);
+
+        glm::mat4 view_mat = camera.view();
+        glm::mat4 projection_mat = camera.projection((float)window_width / (float)window_height);
+
+        bool occlusion_key = key_pressed(GLFW_KEY_O);
+        if (occlusion_key && !occlusion_key_down)
+            occlusion_culling = !occlusion_culling;
+        occlusion_key_down = occlusion_key;
+
+        bool depth_prepass_key = key_pressed(GLFW_KEY_P);
+        if (depth_prepass_key && !depth_prepass_key_down)
+            depth_prepass = !depth_prepass;
+        depth_prepass_key_down = depth_prepass_key;
+
+        bool profile_key = key_pressed(GLFW_KEY_F9);
+        if (profile_key && !profile_key_down) {
+            if (!profile().enabled) {
+                profile().start();
+            } else {
+                profile().stop();
+                profile().write_chrome_trace("trace_" + std::to_string(frame_number) + ".json");
+                profile_on_exit = false;
+            }
+        }
+        profile_key_down = profile_key;
+
+        bool telemetry_key = key_pressed(GLFW_KEY_F10);
+        if (telemetry_key && !telemetry_key_down) {
+            telemetry.write("telemetry_" + std::to_string(frame_number) + ".csv");
+            telemetry.write("telemetry_" + std::to_string(frame_number) + ".json");
+        }
+        telemetry_key_down = telemetry_key;
+
+        if (key_pressed(GLFW_KEY_LEFT_BRACKET))
+            sun_azimuth -= delta_time;
+        if (key_pressed(GLFW_KEY_RIGHT_BRACKET))
+            sun_azimuth += delta_time;
+        glm::vec3 sun_direction(std::cos(sun_elevation) * std::cos(sun_azimuth), std::sin(sun_elevation),
+                                std::cos(sun_elevation) * std::sin(sun_azimuth));
+
+        // the packet drawn now was prepared from the input of frame_latency frames ago
+        frame_packet *packet;
+        {
+            PROFILE_ZONE("wait for frame");
+            packet = pipeline.advance(
+                {scene.get_world(object_node), view_mat, projection_mat, camera.pose.position, occlusion_culling});
+        }
+
+        resolution.begin_frame(window_width, window_height, frame_seconds * 1000.0f);
+        if (resolution.gpu_ms_frame != 0)
+            telemetry.set_gpu_ms(resolution.gpu_ms_frame, resolution.gpu_ms);
         glClearColor(0.357f, 0.737f, 0.894f, 1.0f);
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-        glUseProgram(shader_program_id);
-        const glm::mat4 &model_mat = object.model_mat;
-
-        glm::mat4 projection_mat =
-            glm::perspective(camera_fov, (float)window_width / (float)window_height, 0.1f, 100.0f);
-        GLuint model_uniform = glGetUniformLocation(shader_program_id, "model");
-        GLuint view_uniform = glGetUniformLocation(shader_program_id, "view");
-        GLuint projection_uniform = glGetUniformLocation(shader_program_id, "projection");
-        glUniformMatrix4fv(model_uniform, 1, GL_FALSE, glm::value_ptr(model_mat));
-        glUniformMatrix4fv(view_uniform, 1, GL_FALSE, glm::value_ptr(view_mat));
-        glUniformMatrix4fv(projection_uniform, 1, GL_FALSE, glm::value_ptr(projection_mat));
-
-        object.draw();
-
-        glfwSwapBuffers(window);
-        glfwPollEvents();
+        if (packet != nullptr) {
+            PROFILE_ZONE("submit");
+            sample.tested = packet->stats.tested;
+            sample.visible = packet->stats.visible;
+            sample.occluded = packet->stats.occluded;
+            sample.pvs_hidden = packet->stats.pvs_hidden;
+            sample.clusters_overflowed = packet->clusters.overflowed;
+            frame_uniforms uniforms{packet->model, packet->view, packet->projection,
+                                    glm::transpose(glm::inverse(packet->model))};
+            // whatever does not fit in the ring this frame goes through buffers of its own
+            if (!frame_ring.valid() || !uniforms.upload(frame_ring))
+                uniforms.upload();
+            if (!frame_ring.valid() || !packet->clusters.upload(frame_ring, resolution.width, resolution.height))
+                packet->clusters.upload(resolution.width, resolution.height);
+            if (!instances.transforms.empty() && (!frame_ring.valid() || !instances.upload(frame_ring)))
+                instances.upload();
+
+            auto draw_static_shadow = [&](const glm::mat4 &shadow_view_projection) {
+                shadow_program.set_uniform("shadow_view_projection", shadow_view_projection);
+                object.draw_shadow(shadow_view_projection * packet->model, shadow_program);
+            };
+            auto draw_dynamic_shadow = [&](const glm::mat4 &shadow_view_projection) {
+                shadow_instanced_program.set_uniform("shadow_view_projection", shadow_view_projection);
+                object.draw_shadow(instances, shadow_instanced_program);
+            };
+            {
+                PROFILE_GPU_ZONE("shadows");
+                shadows.render(packet->view, packet->projection, sun_direction,
+                               model_bounds.transformed(packet->model), draw_static_shadow, draw_dynamic_shadow,
+                               !instances.transforms.empty(), resolution.width, resolution.height,
+                               resolution.framebuffer);
+            }
+
+            {
+                PROFILE_GPU_ZONE("scene");
+                object.draw(packet->draws, shader_programs, depth_prepass ? &depth_program : nullptr);
+            }
+
+            // per frame culling results and recent frame times, shown in the title a couple of times a second so it
+            // stays readable
+            if (current_frame - last_title_update > 0.5f) {
+                frame_percentiles frame_time = telemetry.frame_time(256);
+                std::string title = "OpenGL - " + std::to_string(packet->stats.visible) + "/" +
+                                    std::to_string(packet->stats.tested) + " meshes visible, " +
+                                    std::to_string(packet->stats.occluded) + " occluded, " +
+                                    std::to_string(packet->stats.pvs_hidden) + " outside the pvs";
+                if (depth_prepass)
+                    title += ", depth pre-pass";
+                if (packet->clusters.overflowed > 0)
+                    title += ", " + std::to_string(packet->clusters.overflowed) + " clusters over " +
+                             std::to_string(light_clusters::MAX_LIGHTS_PER_CLUSTER) + " lights";
+                title += ", " + std::to_string(int(resolution.scale * 100.0f + 0.5f)) + "% resolution, " +
+                         "frame p50/p95/p99 " + std::to_string(int(frame_time.p50 + 0.5f)) + "/" +
+                         std::to_string(int(frame_time.p95 + 0.5f)) + "/" + std::to_string(int(frame_time.p99 + 0.5f)) +
+                         " ms";
+                if (!headless)
+                    glfwSetWindowTitle(window, title.c_str());
+                last_title_update = current_frame;
+            }
+
+            if (!instances.transforms.empty()) {
+                PROFILE_GPU_ZONE("instances");
+                object.draw(instances, instanced_programs);
+            }
+        }
+
+        {
+            PROFILE_GPU_ZONE("upscale");
+            resolution.end_frame();
+        }
+        frame_ring.end_frame();
+        sample.cpu_ms = (seconds() - current_frame) * 1000.0f;
+        if (headless) {
+            PROFILE_ZONE("finish");
+            glFinish();
+        } else {
+            {
+                PROFILE_ZONE("swap buffers");
+                glfwSwapBuffers(window);
+            }
+            glfwPollEvents();
+        }
+
+        const render_counters &counters = render_count();
+        sample.draw_calls = counters.draw_calls;
+        sample.triangles = counters.triangles;
+        sample.state_changes = counters.state_changes;
+        sample.texture_binds = counters.texture_binds;
+        sample.bytes_uploaded = counters.bytes_uploaded;
+        sample.frame_ms = (seconds() - current_frame) * 1000.0f;
+        telemetry.record(sample);
+        gl_intercept().end_frame();
+        if (headless)
+            frame_times.push_back(sample.frame_ms);
     }
 
-    glfwTerminate();
+    if (frame_ring.valid())
+        std::cout << "ring buffer: " << frame_ring.frames << " frames, " << frame_ring.stalls << " stalls, "
+                  << frame_ring.wraps << " wraps, " << frame_ring.overflows << " overflows" << std::endl;
+    std::cout << "shadows: " << shadows.static_renders << " cascade redraws of static geometry in " << shadows.frames
+              << " frames" << std::endl;
+    std::cout << "dynamic resolution: " << resolution.changes << " scale changes in " << resolution.frames
+              << " frames, ended at " << int(resolution.scale * 100.0f + 0.5f) << "% with "
+              << (resolution.gpu_timing ? "gpu" : "cpu") << " frames taking " << resolution.frame_ms << " ms"
+              << std::endl;
+    frame_percentiles frame_time = telemetry.frame_time(), gpu_time = telemetry.gpu_time();
+    std::cout << "telemetry: frame time p50 " << frame_time.p50 << " ms, p95 " << frame_time.p95 << " ms, p99 "
+              << frame_time.p99 << " ms, gpu time p50 " << gpu_time.p50 << " ms, p95 " << gpu_time.p95 << " ms, p99 "
+              << gpu_time.p99 << " ms over the last " << std::min<uint64_t>(frame_number, frame_telemetry::CAPACITY)
+              << " frames" << std::endl;
+    // counted where the draws bind them, so in the depth sorted order frames are really submitted in
+    std::vector<frame_sample> samples = telemetry.snapshot();
+    uint64_t texture_binds = 0;
+    for (const frame_sample &sample : samples)
+        texture_binds += sample.texture_binds;
+    if (!samples.empty())
+        std::cout << "textures: " << double(texture_binds) / samples.size() << " binds per frame "
+                  << (options.build_atlas ? "with" : "without") << " the atlas" << std::endl;
+    if (!telemetry_name.empty())
+        telemetry.write(telemetry_name);
+    if (gl_intercept().installed && gl_intercept().frame_count > 0) {
+        const gl_call_summary &frames = gl_intercept().frames;
+        unsigned frames_counted = gl_intercept().frame_count;
+        std::cout << "gl calls: " << frames.total_calls() / double(frames_counted) << " per frame, "
+                  << frames.total_redundant() / double(frames_counted) << " of them redundant, "
+                  << frames.bytes_uploaded / double(frames_counted) << " bytes uploaded per frame through calls"
+                  << std::endl;
+        gl_intercept().print(frames, 10, frames_counted);
+    }
+    if (headless && !frame_times.empty()) {
+        float total = 0.0f;
+        for (float time : frame_times)
+            total += time;
+        auto [min_time, max_time] = std::minmax_element(frame_times.begin(), frame_times.end());
+        float min_ms = *min_time, max_ms = *max_time;
+        frame_percentiles all_frames = percentiles(frame_times);
+        std::cout << "headless: " << frame_times.size() << " frames at " << window_width << "x" << window_height
+                  << ", frame time mean " << total / frame_times.size() << " ms, min " << min_ms << " ms, p50 "
+                  << all_frames.p50 << " ms, p95 " << all_frames.p95 << " ms, p99 " << all_frames.p99
+                  << " ms, max " << max_ms << " ms, " << frame_times.size() * 1000.0f / total << " fps"
+                  << std::endl;
+    }
+    if (profile_on_exit)
+        profile().write_chrome_trace("trace.json");
+    headless_gl.destroy();
+    if (window != NULL)
+        glfwTerminate();
     return 0;
 }
 
@@ -193,4 +623,56 @@ void framebuffer_size_callback(GLFWwindow *window, int width, int height) {
     window_width = width;
     window_height = height;
     glViewport(0, 0, width, height);
-}
\ No newline at end of file
+}
+void print_usage() {
+    std::cout << "usage: main [options]\n"
+                 "  --model PATH         load that model instead of asking for one\n"
+                 "  --headless           draw --frames N frames at --resolution WxH without a window, then print\n"
+                 "                       frame time statistics and exit\n"
+                 "  --camera-path FILE   move the camera through the poses in FILE with a fixed time step,\n"
+                 "                       --path-steps N frames apart along a spline\n"
+                 "  --record-path FILE   write the camera of every frame to FILE to play back later\n"
+                 "  --bake-pvs           precompute which chunks each part of the level can see\n"
+                 "  --bake-ao            bake the ambient occlusion of every vertex\n"
+                 "  --no-atlas           keep every texture separate, to compare texture binds with the atlas\n"
+                 "  --latency N          frames culling runs ahead of drawing, 0 to 2, 0 does both in turn\n"
+                 "  --lights N           scatter N point and spot lights over the model\n"
+                 "  --instances N        scatter N small spinning copies of the model above it\n"
+                 "  --profile            record a trace of the whole run into trace.json\n"
+                 "  --gl-calls           count the gl calls of every frame and print the most frequent ones\n"
+                 "  --telemetry FILE     write the measurements of the last frames to FILE, JSON if it ends in .json\n"
+                 "  --target-ms T        frame time dynamic resolution aims for\n"
+                 "  --scale-bounds A B   smallest and largest resolution scale\n"
+              << std::flush;
+}
+
+/**
+ * \brief Parse a whole argument as a number, std::stoul would throw on bad input
+ * \return false if text is missing or is not a non-negative whole number that fits
+ */
+bool parse_number(const char *text, unsigned &value) {
+    if (text == nullptr || !std::isdigit(static_cast<unsigned char>(text[0])))
+        return false;
+    char *end;
+    errno = 0;
+    unsigned long parsed = std::strtoul(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE || parsed > std::numeric_limits<unsigned>::max())
+        return false;
+    value = unsigned(parsed);
+    return true;
+}
+
+/**
+ * \return false if text is missing or is not a finite number
+ */
+bool parse_number(const char *text, float &value) {
+    if (text == nullptr)
+        return false;
+    char *end;
+    errno = 0;
+    float parsed = std::strtof(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE || !std::isfinite(parsed))
+        return false;
+    value = parsed;
+    return true;
+}
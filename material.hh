@@ -14,6 +14,10 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
+#include "parallel.hh"
+#include "profiler.hh"
+#include "telemetry.hh"
+
 // fragment shader uniform locations
 enum uniform_bind {
     COLOR_DIFFUSE = 0,
@@ -26,6 +30,17 @@ enum uniform_bind {
     TEXTURE_DIFFUSE = GL_TEXTURE0,
 };
 
+// fragment shader features a material needs, the bits of the index of the shader variant it is drawn with
+enum shader_feature : unsigned {
+    SHADER_TEXTURED = 1 << 0,   // samples texture_diffuse
+    SHADER_ALPHA_TEST = 1 << 1, // discards texels with zero alpha
+};
+
+// the same for the depth only shaders, the bits of the variant index of fragment_depth.glsl
+enum depth_shader_feature : unsigned {
+    DEPTH_SHADER_ALPHA_TEST = 1 << 0,
+};
+
 struct material {
 
     std::string name;
@@ -41,6 +56,22 @@ struct material {
     unsigned illum_model;
 
     GLuint texture_diffuse_id = 0;
+    unsigned shader_features = 0; // mask of shader_feature
+
+    unsigned depth_shader_features() const {
+        return shader_features & SHADER_ALPHA_TEST ? DEPTH_SHADER_ALPHA_TEST : 0;
+    }
+
+    // hides everything behind it, transparent and alpha tested materials can be seen through
+    bool solid() const { return transparency == 0.0f && !(shader_features & SHADER_ALPHA_TEST); }
+
+    // decoded RGBA pixels of map_Kd, kept until the texture is uploaded or packed into an atlas
+    std::string texture_diffuse_path;
+    int texture_width = 0, texture_height = 0;
+    std::vector<uint8_t> texture_data;
+
+    // texture currently bound to TEXTURE_DIFFUSE, shared by all materials to skip redundant binds
+    static inline GLuint bound_texture_id = 0;
 
     material(const std::string &name) : name(name) {}
 
@@ -72,10 +103,29 @@ struct material {
      */
     void init_texture(glm::vec4 color) { init_texture(glm::value_ptr(color), 1, 1, GL_RGBA); }
 
+    /**
+     * \brief Upload the pixels decoded by load_mtl, if they were not packed into an atlas
+     */
+    void upload_texture() {
+        if (!texture_data.empty())
+            init_texture(texture_data.data(), texture_width, texture_height, GL_RGBA);
+        texture_data.clear();
+        texture_data.shrink_to_fit();
+    }
+
+    void bind_texture() const {
+        if (bound_texture_id != texture_diffuse_id) {
+            glActiveTexture(TEXTURE_DIFFUSE);
+            glBindTexture(GL_TEXTURE_2D, texture_diffuse_id);
+            bound_texture_id = texture_diffuse_id;
+            ++render_count().state_changes;
+            ++render_count().texture_binds;
+        }
+    }
+
     void bind() const {
-        glActiveTexture(TEXTURE_DIFFUSE);
-        glBindTexture(GL_TEXTURE_2D, texture_diffuse_id);
-        
+        bind_texture();
+
         glUniform3fv(COLOR_DIFFUSE, 1, glm::value_ptr(color_diffuse));
         glUniform3fv(COLOR_AMBIENT, 1, glm::value_ptr(color_diffuse));
         glUniform3fv(COLOR_SPECULAR, 1, glm::value_ptr(color_diffuse));
@@ -92,6 +142,7 @@ struct material {
  * Some materials may have uninitialized fields
  */
 void load_mtl(const std::string &path, std::vector<material> &materials) {
+    PROFILE_ZONE("load mtl");
     // std::filesystem is broken on mingw-w64, so this is a workaround
     std::string base_dir = path.substr(0, path.find_last_of("\\/") + 1);
     std::string filename = path.substr(path.find_last_of("\\/") + 1);
@@ -102,6 +153,13 @@ void load_mtl(const std::string &path, std::vector<material> &materials) {
         return;
     }
 
+    struct texture_reference {
+        size_t material_index;
+        std::string filename;
+        unsigned line_no;
+    };
+    std::vector<texture_reference> textures;
+
     std::string line;
     unsigned line_no = 0;
     while (std::getline(ifile, line)) {
@@ -121,13 +179,10 @@ void load_mtl(const std::string &path, std::vector<material> &materials) {
                 // TODO fix textures with transparency
                 std::string texture_filename;
                 line_ss >> texture_filename;
-                int width, height, channels;
-                stbi_set_flip_vertically_on_load(true);
-                uint8_t *data = stbi_load((base_dir + texture_filename).c_str(), &width, &height, &channels, 0);
-                if (!data)
-                    std::cout << filename << "(" << line_no << ") failed to load texture: " << texture_filename << '\n';
-                materials.back().init_texture(data, width, height, channels == 4 ? GL_RGBA : GL_RGB);
-                stbi_image_free(data);
+                // decoded after parsing, all textures at once
+                if (!textures.empty() && textures.back().material_index == materials.size() - 1)
+                    textures.pop_back(); // the last map_Kd of a material wins
+                textures.push_back({materials.size() - 1, texture_filename, line_no});
             } else if (type == "Ka") { // ambient color
                 float f;
                 for (glm::vec3::length_type i = 0; line_ss >> f; ++i)
@@ -160,4 +215,39 @@ void load_mtl(const std::string &path, std::vector<material> &materials) {
         }
     }
     ifile.close();
+
+    // decoding dominates loading a textured model, and every texture decodes on its own
+    stbi_set_flip_vertically_on_load(true);
+    std::vector<std::string> errors(textures.size());
+    parallel_for(0, textures.size(), 1, [&](size_t begin, size_t end) {
+        PROFILE_ZONE("decode textures");
+        for (size_t i = begin; i < end; ++i) {
+            const texture_reference &texture = textures[i];
+            int width, height, channels;
+            uint8_t *data = stbi_load((base_dir + texture.filename).c_str(), &width, &height, &channels, 4);
+            if (!data) {
+                errors[i] = filename + "(" + std::to_string(texture.line_no) +
+                            ") failed to load texture: " + texture.filename + '\n';
+                continue;
+            }
+            // upload is deferred so the object loader can pack small textures into an atlas
+            material &material = materials[texture.material_index];
+            material.texture_diffuse_path = base_dir + texture.filename;
+            material.texture_width = width;
+            material.texture_height = height;
+            material.texture_data.assign(data, data + width * height * 4);
+            stbi_image_free(data);
+
+            // only textures with see-through texels need the variant that discards
+            material.shader_features = SHADER_TEXTURED;
+            for (size_t alpha = 3; alpha < material.texture_data.size(); alpha += 4) {
+                if (material.texture_data[alpha] == 0) {
+                    material.shader_features |= SHADER_ALPHA_TEST;
+                    break;
+                }
+            }
+        }
+    });
+    for (const std::string &error : errors)
+        std::cout << error;
 }
\ No newline at end of file
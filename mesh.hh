@@ -8,13 +8,18 @@
 
 #include <vector>
 #include <iostream>
+#include <algorithm>
 
 #include "material.hh"
+#include "instance.hh"
+#include "culling.hh"
+#include "telemetry.hh"
 
 struct vertex {
     glm::vec3 position;
     glm::vec3 normal;
     glm::vec2 tex_coord;
+    float occlusion = 1.0f; // baked ambient occlusion, 1 where nothing is in the way
 };
 
 struct mesh {
@@ -22,10 +27,29 @@ struct mesh {
     unsigned num_vertex;
     unsigned material_index;
     GLuint VAO_id, VBO_id;
-    
+    GLuint depth_VAO_id, position_VBO_id; // tightly packed positions alone, for drawing depth only
+    mutable GLuint instance_VBO_id = 0; // instance buffer and offset the vertex array currently points at
+    mutable GLintptr instance_offset = 0;
+
+    // object space bounds
+    aabb bounds;
+    bounding_sphere sphere;
+
+    // object space triangle corners kept on the cpu for occlusion culling
+    std::vector<glm::vec3> positions;
+
     mesh(const std::vector<vertex> &vertices, unsigned material)
         : num_vertex(vertices.size()), material_index(material) {
 
+        positions.reserve(vertices.size());
+        for (const vertex &vertex : vertices) {
+            bounds.expand(vertex.position);
+            positions.push_back(vertex.position);
+        }
+        sphere.center = bounds.center();
+        for (const vertex &vertex : vertices)
+            sphere.radius = std::max(sphere.radius, glm::distance(sphere.center, vertex.position));
+
         glGenVertexArrays(1, &VAO_id);
         glGenBuffers(1, &VBO_id);
 
@@ -46,6 +70,19 @@ struct mesh {
         glVertexAttribPointer(2, decltype(vertex::tex_coord)::length(), GL_FLOAT, GL_FALSE, sizeof(vertex),
                               reinterpret_cast<void *>(offsetof(vertex, vertex::tex_coord)));
         glEnableVertexAttribArray(2);
+        // ambient occlusion attribute, after the instance matrix in locations 3 to 6
+        glVertexAttribPointer(7, 1, GL_FLOAT, GL_FALSE, sizeof(vertex),
+                              reinterpret_cast<void *>(offsetof(vertex, vertex::occlusion)));
+        glEnableVertexAttribArray(7);
+
+        // a depth pass only needs positions, and reads a third of the bytes from a stream of just those
+        glGenVertexArrays(1, &depth_VAO_id);
+        glGenBuffers(1, &position_VBO_id);
+        glBindVertexArray(depth_VAO_id);
+        glBindBuffer(GL_ARRAY_BUFFER, position_VBO_id);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * positions.size(), positions.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, glm::vec3::length(), GL_FLOAT, GL_FALSE, sizeof(glm::vec3), nullptr);
+        glEnableVertexAttribArray(0);
 
         glBindVertexArray(0);
     }
@@ -56,5 +93,29 @@ struct mesh {
         materials.at(material_index).bind();
         glBindVertexArray(VAO_id);
         glDrawArrays(GL_TRIANGLES, 0, num_vertex);
+        ++render_count().state_changes;
+        render_count().draw(num_vertex);
+    }
+
+    void draw(const std::vector<material> &materials, const instance_list &instances) const {
+        if(materials.size() <= material_index)
+            std::cout << "material index out of range" << std::endl;
+        materials.at(material_index).bind();
+        draw_instanced(instances);
+    }
+
+    /**
+     * \brief Draw one copy per instance without binding a material
+     */
+    void draw_instanced(const instance_list &instances) const {
+        glBindVertexArray(VAO_id);
+        if (instance_VBO_id != instances.VBO_id || instance_offset != instances.offset) {
+            instances.bind_attributes();
+            instance_VBO_id = instances.VBO_id;
+            instance_offset = instances.offset;
+        }
+        glDrawArraysInstanced(GL_TRIANGLES, 0, num_vertex, instances.count);
+        ++render_count().state_changes;
+        render_count().draw(num_vertex, instances.count);
     }
 };
@@ -11,25 +11,237 @@
 #include <sstream>
 #include <iostream>
 #include <vector>
+#include <chrono>
 #include <algorithm>
+#include <iterator>
 
 #include "mesh.hh"
 #include "material.hh"
+#include "atlas.hh"
+#include "bvh.hh"
+#include "occlusion.hh"
+#include "pvs.hh"
+#include "ao.hh"
+#include "sort.hh"
+#include "draw_list.hh"
+#include "parallel.hh"
+#include "profiler.hh"
+#include "telemetry.hh"
+
+// optional processing done while loading an object
+struct load_options {
+    bool build_atlas = true;          // pack small non-repeating textures into shared atlas pages
+    int atlas_page_size = 1024;       // width and height of each atlas page in texels
+    int atlas_max_texture_size = 256; // textures bigger than this in either dimension are left alone
+    int atlas_padding = 4;            // texels of replicated border around each packed texture
+
+    bool split_meshes = false;            // split each material's triangles into spatially compact chunks
+    unsigned chunk_triangle_budget = 256; // most triangles a chunk may have after splitting
+    float chunk_max_fraction = 0.25f;     // also split chunks wider than this fraction of the whole model
+
+    unsigned occluder_count = 16; // opaque meshes with the most surface area, rasterized for occlusion culling
+
+    bool use_pvs = true;   // load potentially visible sets from <model>.pvs if it matches the model
+    bool bake_pvs = false; // bake them while loading and write <model>.pvs, slow
+    pvs_bake_settings pvs_settings;
+
+    bool use_ao = true;   // load baked ambient occlusion from <model>.ao if it matches the model
+    bool bake_ao = false; // bake it while loading and write <model>.ao, slow
+    ao_bake_settings ao_settings;
+};
 
 struct object {
     glm::mat4 model_mat;
     std::vector<mesh> meshes;
     std::vector<material> materials;
 
-    object(const std::string &path, glm::mat4 matrix) : model_mat(matrix) { load_obj(path); };
+    // hierarchy over the mesh bounds, and the result of the last cull in the same order as meshes
+    bvh mesh_bvh;
+    std::vector<uint8_t> mesh_visible;
+    std::vector<uint8_t> mesh_occluder;
 
-    void draw() const {
-        for (const mesh &mesh : meshes)
-            mesh.draw(materials);
+    // precomputed visibility, and the decoded set of the cell the camera was last in
+    pvs visibility;
+    int pvs_cell = -1;
+    bool pvs_cell_has_set = false;
+    std::vector<uint8_t> pvs_visible;
+
+    // draw order, opaque and alpha tested meshes front to back and transparent ones back to front,
+    // resorted by every cull
+    std::vector<sort_item> opaque_order, alpha_tested_order, transparent_order;
+    unsigned sort_fallbacks = 0; // times the order changed too much to fix up incrementally
+
+    static const unsigned MESHES_PER_TASK = 1024; // smallest share of the meshes worth handing to another thread
+
+    object(const std::string &path, glm::mat4 matrix, const load_options &options = load_options())
+        : model_mat(matrix) {
+        load_obj(path, options);
+    };
+
+    /**
+     * \brief Find the visible meshes, sort them by view depth and encode their draw commands
+     * Only touches cpu side data, so it can run on another thread than the one drawing
+     * \param view_projection the camera's projection * view matrix, model_mat is applied here
+     * \param camera_position in world space, selects the potentially visible set if the object has one
+     * \param draws receives the commands to pass to draw()
+     * \param occlusion if given, the visible occluders are rasterized into it and every other
+     * visible mesh hidden behind them is skipped as well. The buffer is not cleared here
+     */
+    cull_stats cull(const glm::mat4 &view_projection, glm::vec3 camera_position, frame_draws &draws,
+                    occlusion_buffer *occlusion = nullptr) {
+        PROFILE_ZONE("cull");
+        glm::mat4 model_view_projection = view_projection * model_mat;
+        frustum view_frustum = frustum::from_matrix(model_view_projection);
+
+        int cell = visibility.cell_index(glm::vec3(glm::inverse(model_mat) * glm::vec4(camera_position, 1.0f)));
+        if (cell != pvs_cell) {
+            pvs_cell = cell;
+            pvs_cell_has_set = visibility.lookup(cell, pvs_visible);
+        }
+
+        // each worker culls its own subtrees of the hierarchy, every mesh is in exactly one of them
+        std::vector<unsigned> roots = mesh_bvh.subtrees(
+            std::min<unsigned>(worker_count() * 4, meshes.size() / MESHES_PER_TASK));
+        std::fill(mesh_visible.begin(), mesh_visible.end(), false);
+        auto merge = [](cull_stats &into, const cull_stats &from) { into += from; };
+        cull_stats stats = parallel_reduce(0, roots.size(), 1, [&](size_t begin, size_t end) {
+            cull_stats slice;
+            for (size_t root = begin; root < end; ++root) {
+                mesh_bvh.cull(view_frustum, [&](unsigned i) {
+                    if (pvs_cell_has_set && !pvs_visible[i]) {
+                        ++slice.pvs_hidden;
+                        return;
+                    }
+                    mesh_visible[i] = true;
+                    ++slice.visible;
+                }, roots[root]);
+            }
+            return slice;
+        }, merge);
+        stats.tested = meshes.size();
+
+        if (occlusion != nullptr) {
+            for (unsigned i = 0; i < meshes.size(); ++i)
+                if (mesh_visible[i] && mesh_occluder[i])
+                    occlusion->add_occluder(meshes[i].positions, model_view_projection);
+            occlusion->rasterize();
+            stats += parallel_reduce(0, meshes.size(), MESHES_PER_TASK, [&](size_t begin, size_t end) {
+                cull_stats slice;
+                for (size_t i = begin; i < end; ++i) {
+                    if (mesh_visible[i] && !mesh_occluder[i] &&
+                        !occlusion->test(meshes[i].bounds, model_view_projection)) {
+                        mesh_visible[i] = false;
+                        ++slice.occluded;
+                    }
+                }
+                return slice;
+            }, merge);
+            stats.visible -= stats.occluded;
+        }
+
+        sort_draws(model_view_projection);
+        encode_draws(opaque_order, draws.opaque);
+        encode_draws(alpha_tested_order, draws.alpha_tested);
+        encode_draws(transparent_order, draws.transparent);
+        return stats;
+    }
+
+    /**
+     * \brief Draw the meshes a cull() found visible, opaque ones first
+     * Transparent meshes are blended back to front without writing depth, so they do not hide each other
+     * \param depth_program if given, the depth of opaque meshes is drawn with it first, and they are then
+     * shaded only where their depth is the nearest so each pixel is shaded once
+     */
+    void draw(const frame_draws &draws, const program_variants &programs,
+              const program_variants *depth_program = nullptr) const {
+        if (depth_program != nullptr) {
+            depth_program->use(0);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            draws.opaque.submit_depth();
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+            draws.opaque.submit(materials, programs);
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+        } else {
+            draws.opaque.submit(materials, programs);
+        }
+        // discarding needs the full shader, so alpha tested meshes are left out of the depth pass
+        draws.alpha_tested.submit(materials, programs);
+        glDepthMask(GL_FALSE);
+        draws.transparent.submit(materials, programs);
+        glDepthMask(GL_TRUE);
+    }
+
+    /**
+     * \brief Draw one copy of the object per instance, ignoring model_mat
+     * Requires programs that read the instance attributes, such as vertex_instanced.glsl
+     */
+    void draw(const instance_list &instances, const program_variants &programs) const {
+        if (instances.count == 0)
+            return;
+        for (const mesh &mesh : meshes) {
+            programs.use(materials.at(mesh.material_index).shader_features);
+            mesh.draw(materials, instances);
+        }
+    }
+
+    /**
+     * \brief Draw the depth of the meshes that cast shadows and are inside a view volume
+     * Alpha tested meshes are drawn with the variant of programs that discards their see-through texels
+     * \param view_projection_model of the shadow map, model_mat is left alone as cull() may be writing it
+     * \param programs variants of fragment_depth.glsl, indexed by depth_shader_feature
+     */
+    void draw_shadow(const glm::mat4 &view_projection_model, const program_variants &programs) const {
+        mesh_bvh.cull(frustum::from_matrix(view_projection_model), [&](unsigned i) {
+            const mesh &mesh = meshes[i];
+            const material &material = materials.at(mesh.material_index);
+            if (material.transparency > 0.0f)
+                return;
+            unsigned features = material.depth_shader_features();
+            programs.use(features);
+            if (features & DEPTH_SHADER_ALPHA_TEST) {
+                // the texture coordinates are only in the full vertex array
+                material.bind_texture();
+                glBindVertexArray(mesh.VAO_id);
+            } else {
+                glBindVertexArray(mesh.depth_VAO_id);
+            }
+            glDrawArrays(GL_TRIANGLES, 0, mesh.num_vertex);
+            ++render_count().state_changes;
+            render_count().draw(mesh.num_vertex);
+        });
+    }
+
+    /**
+     * \brief Draw the depth of every instance of the meshes that cast shadows
+     * \param programs variants of fragment_depth.glsl that read the instance attributes
+     */
+    void draw_shadow(const instance_list &instances, const program_variants &programs) const {
+        if (instances.count == 0)
+            return;
+        for (const mesh &mesh : meshes) {
+            const material &material = materials.at(mesh.material_index);
+            if (material.transparency > 0.0f)
+                continue;
+            unsigned features = material.depth_shader_features();
+            programs.use(features);
+            if (features & DEPTH_SHADER_ALPHA_TEST)
+                material.bind_texture();
+            mesh.draw_instanced(instances);
+        }
     }
 
   private:
-    void load_obj(const std::string &path) {
+    // vertices of a single usemtl block
+    struct vertex_group {
+        unsigned material_index;
+        std::vector<vertex> vertices;
+    };
+
+    void load_obj(const std::string &path, const load_options &options) {
+        PROFILE_ZONE("load obj");
 
         // std::filesystem is broken on mingw-w64, so this is a workaround
         std::string base_dir = path.substr(0, path.find_last_of("\\/") + 1);
@@ -39,8 +251,7 @@ struct object {
         std::vector<glm::vec3> obj_normals;
         std::vector<glm::vec2> obj_tex_coords;
 
-        std::vector<vertex> mesh_vertices;
-        unsigned current_material_index = -1;
+        std::vector<vertex_group> groups(1, {unsigned(-1), {}});
 
         std::ifstream ifile(path);
         if (!ifile.is_open()) {
@@ -61,16 +272,14 @@ struct object {
                     line_ss >> mtl_path;
                     load_mtl(base_dir + mtl_path, materials);
                 } else if (type == "usemtl") { // use new material
-                    if (!mesh_vertices.empty()) {
-                        meshes.push_back(mesh(mesh_vertices, current_material_index));
-                        mesh_vertices.clear();
-                    }
+                    if (!groups.back().vertices.empty())
+                        groups.push_back({});
                     std::string mat_name;
                     line_ss >> mat_name;
-                    current_material_index = -1;
+                    groups.back().material_index = -1;
                     for (unsigned i = 0; i < materials.size(); i++) {
                         if (materials[i].name == mat_name) {
-                            current_material_index = i;
+                            groups.back().material_index = i;
                             break;
                         }
                     }
@@ -93,6 +302,7 @@ struct object {
                         tex_coord[i] = f;
                     obj_tex_coords.push_back(tex_coord);
                 } else if (type == "f") { // face
+                    std::vector<vertex> &mesh_vertices = groups.back().vertices;
                     std::string vertex_data;
                     signed vertex_no = 0;
                     while (line_ss >> vertex_data) {
@@ -122,21 +332,360 @@ struct object {
             }
         }
 
-        meshes.push_back(mesh(mesh_vertices, current_material_index));
+        if (options.build_atlas)
+            build_atlas(groups, options);
+        if (options.split_meshes)
+            split_groups(groups, options.chunk_triangle_budget, options.chunk_max_fraction);
+        if (options.use_ao || options.bake_ao)
+            load_ao(path + ".ao", groups, options);
 
-        // clean up any uninitialized textures
-        for (material &material : materials)
+        {
+            PROFILE_ZONE("upload meshes");
+            for (const vertex_group &group : groups)
+                if (!group.vertices.empty())
+                    meshes.push_back(mesh(group.vertices, group.material_index));
+        }
+
+        // upload the remaining textures and clean up any uninitialized ones
+        for (material &material : materials) {
+            material.upload_texture();
             if (material.texture_diffuse_id == 0)
                 material.init_texture(glm::vec4(1.0f, 1.0f, 1.0f, 1.0f));
+        }
+        material::bound_texture_id = 0;
 
-        // put any transparent meshes at the back
-        // this is a quick hack to get transparency working, if a transparent mesh 
-        // is drawn behind another it will get clipped because of the depth buffer
-        // TODO implement proper depth transparency https://learnopengl.com/Advanced-OpenGL/Blending
-        std::sort(meshes.begin(), meshes.end(), [&](const mesh &a, const mesh &b) {
-            return materials.at(a.material_index).transparency < materials.at(b.material_index).transparency;
-        });
+        // the draw order is sorted by depth every frame, this is just a starting point
+        for (unsigned i = 0; i < meshes.size(); ++i) {
+            const material &material = materials.at(meshes[i].material_index);
+            if (material.transparency > 0.0f)
+                transparent_order.push_back({0, i});
+            else if (material.shader_features & SHADER_ALPHA_TEST)
+                alpha_tested_order.push_back({0, i});
+            else
+                opaque_order.push_back({0, i});
+        }
+
+        std::vector<aabb> mesh_bounds;
+        for (const mesh &mesh : meshes)
+            mesh_bounds.push_back(mesh.bounds);
+        mesh_bvh.build(mesh_bounds);
+        mesh_visible.assign(meshes.size(), true);
+        select_occluders(options.occluder_count);
+        if (options.use_pvs || options.bake_pvs)
+            load_pvs(path + ".pvs", options);
 
         ifile.close();
     }
+
+    /**
+     * \brief Pack small textures into atlas pages and remap the texture coordinates that use them
+     * Textures sampled outside [0, 1] rely on GL_REPEAT and are left as separate textures
+     */
+    void build_atlas(std::vector<vertex_group> &groups, const load_options &options) {
+        PROFILE_ZONE("build atlas");
+        std::vector<bool> eligible(materials.size());
+        for (unsigned i = 0; i < materials.size(); ++i)
+            eligible[i] = !materials[i].texture_data.empty() &&
+                          materials[i].texture_width <= options.atlas_max_texture_size &&
+                          materials[i].texture_height <= options.atlas_max_texture_size;
+
+        const float epsilon = 1e-4f;
+        for (const vertex_group &group : groups) {
+            if (group.material_index >= materials.size() || !eligible[group.material_index])
+                continue;
+            for (const vertex &vertex : group.vertices) {
+                if (glm::any(glm::lessThan(vertex.tex_coord, glm::vec2(-epsilon))) ||
+                    glm::any(glm::greaterThan(vertex.tex_coord, glm::vec2(1.0f + epsilon)))) {
+                    eligible[group.material_index] = false;
+                    break;
+                }
+            }
+        }
+
+        texture_atlas atlas(options.atlas_page_size, options.atlas_padding);
+        std::vector<texture_atlas::entry> entries;
+        std::vector<bool> packed;
+        unsigned packed_textures = pack_textures(atlas, eligible, entries, packed);
+
+        // a lone page is shrunk to the smallest size that still holds everything
+        while (atlas.pages.size() == 1 && atlas.page_size > 1) {
+            texture_atlas smaller(atlas.page_size / 2, options.atlas_padding);
+            std::vector<texture_atlas::entry> smaller_entries;
+            std::vector<bool> smaller_packed;
+            if (pack_textures(smaller, eligible, smaller_entries, smaller_packed) != packed_textures ||
+                smaller.pages.size() != 1)
+                break;
+            atlas = std::move(smaller);
+            entries.swap(smaller_entries);
+            packed.swap(smaller_packed);
+        }
+        unsigned packed_materials = std::count(packed.begin(), packed.end(), true);
+        if (atlas.pages.empty())
+            return;
+
+        for (vertex_group &group : groups)
+            if (group.material_index < materials.size() && packed[group.material_index])
+                for (vertex &vertex : group.vertices)
+                    vertex.tex_coord = atlas.remap(entries[group.material_index], vertex.tex_coord);
+
+        atlas.upload();
+        for (unsigned i = 0; i < materials.size(); ++i) {
+            if (!packed[i])
+                continue;
+            materials[i].texture_diffuse_id = atlas.pages[entries[i].page].texture_id;
+            materials[i].texture_data.clear();
+            materials[i].texture_data.shrink_to_fit();
+        }
+
+        std::cout << "atlas: packed " << packed_textures << " textures (" << packed_materials << " materials) into "
+                  << atlas.pages.size() << " page(s) of " << atlas.page_size << "x" << atlas.page_size << ", fill "
+                  << int(atlas.fill_ratio() * 100.0f + 0.5f) << "%" << std::endl;
+    }
+
+    /**
+     * \brief Add the eligible textures to the atlas, materials that reference the same file share one entry
+     * \return the number of distinct textures packed
+     */
+    unsigned pack_textures(texture_atlas &atlas, const std::vector<bool> &eligible,
+                           std::vector<texture_atlas::entry> &entries, std::vector<bool> &packed) const {
+        entries.assign(materials.size(), {});
+        packed.assign(materials.size(), false);
+        unsigned packed_textures = 0;
+        for (unsigned i = 0; i < materials.size(); ++i) {
+            if (!eligible[i])
+                continue;
+            unsigned first = 0;
+            while (first < i &&
+                   !(packed[first] && materials[first].texture_diffuse_path == materials[i].texture_diffuse_path))
+                ++first;
+            if (first < i) {
+                entries[i] = entries[first];
+            } else if (atlas.add(materials[i].texture_data.data(), materials[i].texture_width,
+                                 materials[i].texture_height, entries[i])) {
+                ++packed_textures;
+            } else {
+                continue;
+            }
+            packed[i] = true;
+        }
+        return packed_textures;
+    }
+
+    /**
+     * \brief Split groups into chunks that can be culled separately
+     * Triangles are split at the median centroid along the longest axis until each chunk fits the
+     * triangle budget and its centroids span at most max_fraction of the model's size
+     */
+    void split_groups(std::vector<vertex_group> &groups, unsigned triangle_budget, float max_fraction) {
+        PROFILE_ZONE("split meshes");
+        triangle_budget = std::max(triangle_budget, 1u);
+        aabb model_bounds;
+        for (const vertex_group &group : groups)
+            for (const vertex &vertex : group.vertices)
+                model_bounds.expand(vertex.position);
+        glm::vec3 model_size = model_bounds.empty() ? glm::vec3(0.0f) : model_bounds.max - model_bounds.min;
+        float max_size = std::max({model_size.x, model_size.y, model_size.z}) * max_fraction;
+
+        // groups split independently, so each is a job writing its own list of chunks
+        std::vector<std::vector<vertex_group>> group_chunks(groups.size());
+        parallel_for(0, groups.size(), 1, [&](size_t first_group, size_t last_group) {
+            for (size_t group_index = first_group; group_index < last_group; ++group_index) {
+                vertex_group &group = groups[group_index];
+                std::vector<vertex_group> &chunks = group_chunks[group_index];
+                unsigned triangle_count = group.vertices.size() / 3;
+                if (triangle_count <= 1) {
+                    chunks.push_back(std::move(group));
+                    continue;
+                }
+
+                std::vector<unsigned> triangles(triangle_count);
+                std::vector<glm::vec3> centroids(triangle_count);
+                for (unsigned i = 0; i < triangle_count; ++i) {
+                    triangles[i] = i;
+                    centroids[i] = (group.vertices[i * 3].position + group.vertices[i * 3 + 1].position +
+                                    group.vertices[i * 3 + 2].position) /
+                                   3.0f;
+                }
+
+                // ranges of triangles still to be split, processed depth first so neighbouring chunks stay together
+                std::vector<std::pair<unsigned, unsigned>> ranges{{0, triangle_count}};
+                while (!ranges.empty()) {
+                    auto [begin, end] = ranges.back();
+                    ranges.pop_back();
+
+                    aabb centroid_bounds;
+                    for (unsigned i = begin; i < end; ++i)
+                        centroid_bounds.expand(centroids[triangles[i]]);
+                    glm::vec3 size = centroid_bounds.max - centroid_bounds.min;
+                    int axis = size.x >= size.y && size.x >= size.z ? 0 : size.y >= size.z ? 1 : 2;
+
+                    if (end - begin == 1 || (end - begin <= triangle_budget && size[axis] <= max_size)) {
+                        chunks.push_back({group.material_index, {}});
+                        for (unsigned i = begin; i < end; ++i)
+                            for (unsigned corner = 0; corner < 3; ++corner)
+                                chunks.back().vertices.push_back(group.vertices[triangles[i] * 3 + corner]);
+                        continue;
+                    }
+
+                    unsigned middle = begin + (end - begin) / 2;
+                    std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end,
+                                     [&](unsigned a, unsigned b) { return centroids[a][axis] < centroids[b][axis]; });
+                    ranges.push_back({middle, end});
+                    ranges.push_back({begin, middle});
+                }
+            }
+        });
+
+        std::vector<vertex_group> chunks;
+        unsigned split_count = 0;
+        for (std::vector<vertex_group> &group : group_chunks) {
+            split_count += group.size() > 1;
+            std::move(group.begin(), group.end(), std::back_inserter(chunks));
+        }
+        if (split_count > 0)
+            std::cout << "split " << split_count << " of " << groups.size() << " material groups into "
+                      << chunks.size() << " chunks" << std::endl;
+        groups.swap(chunks);
+    }
+
+    std::vector<sort_item> sort_scratch;
+
+    /**
+     * \brief Update the depth keys of the draw order and resort it
+     * The lists keep every mesh, not just the visible ones, so they stay nearly sorted from one frame
+     * to the next and the resort is close to linear while the camera moves smoothly
+     */
+    void sort_draws(const glm::mat4 &model_view_projection) {
+        PROFILE_ZONE("sort draws");
+        // clip space w is the distance along the view direction
+        glm::vec4 depth_row(model_view_projection[0][3], model_view_projection[1][3], model_view_projection[2][3],
+                            model_view_projection[3][3]);
+        auto update_keys = [&](std::vector<sort_item> &order, bool back_to_front) {
+            parallel_for(0, order.size(), MESHES_PER_TASK, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; ++i) {
+                    glm::vec4 center(meshes[order[i].index].sphere.center, 1.0f);
+                    uint32_t key = float_sort_key(glm::dot(depth_row, center));
+                    order[i].key = back_to_front ? ~key : key;
+                }
+            });
+        };
+        update_keys(opaque_order, false);
+        update_keys(alpha_tested_order, false);
+        update_keys(transparent_order, true);
+        sort_fallbacks += coherent_sort(opaque_order, sort_scratch);
+        sort_fallbacks += coherent_sort(alpha_tested_order, sort_scratch);
+        sort_fallbacks += coherent_sort(transparent_order, sort_scratch);
+    }
+
+    /**
+     * \brief Turn the visible meshes of a sorted draw order into commands, one contiguous slice per worker
+     */
+    void encode_draws(const std::vector<sort_item> &order, draw_list &draws) const {
+        PROFILE_ZONE("encode draws");
+        size_t slice_count = std::clamp<size_t>(order.size() / MESHES_PER_TASK, 1, worker_count());
+        size_t slice_size = (order.size() + slice_count - 1) / slice_count;
+        draws.reset(slice_count);
+        parallel_for(0, slice_count, 1, [&](size_t first_slice, size_t last_slice) {
+            for (size_t slice = first_slice; slice < last_slice; ++slice) {
+                for (size_t i = slice * slice_size; i < std::min(order.size(), (slice + 1) * slice_size); ++i) {
+                    const mesh &mesh = meshes[order[i].index];
+                    if (mesh_visible[order[i].index])
+                        draws.slices[slice].push_back(
+                            {mesh.VAO_id, mesh.depth_VAO_id, GLsizei(mesh.num_vertex), mesh.material_index});
+                }
+            }
+        });
+    }
+
+    /**
+     * \brief Load the potentially visible sets of the meshes, or bake and save them if asked to
+     */
+    void load_pvs(const std::string &pvs_path, const load_options &options) {
+        std::vector<const std::vector<glm::vec3> *> chunk_positions;
+        std::vector<uint8_t> chunk_blocks;
+        for (const mesh &mesh : meshes) {
+            chunk_positions.push_back(&mesh.positions);
+            chunk_blocks.push_back(materials.at(mesh.material_index).solid());
+        }
+        if (!options.bake_pvs) {
+            visibility.load(pvs_path, pvs::hash_layout(chunk_positions));
+            return;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        visibility = pvs::bake(chunk_positions, chunk_blocks, options.pvs_settings);
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        unsigned baked_cells = 0;
+        for (size_t i = 0; i + 1 < visibility.cell_offsets.size(); ++i)
+            baked_cells += visibility.baked(i);
+        std::cout << "pvs: baked " << baked_cells << " of " << visibility.cell_offsets.size() - 1 << " cells in "
+                  << elapsed.count() << " s, " << visibility.data.size() << " bytes compressed from "
+                  << baked_cells * ((meshes.size() + 7) / 8) << std::endl;
+        visibility.save(pvs_path);
+    }
+
+    /**
+     * \brief Load the baked ambient occlusion of the vertices, or bake and save it if asked to
+     * It is baked after splitting, so changing how meshes are split invalidates the file
+     */
+    void load_ao(const std::string &ao_path, std::vector<vertex_group> &groups, const load_options &options) {
+        std::vector<glm::vec3> positions, normals;
+        std::vector<uint8_t> triangle_casts;
+        for (const vertex_group &group : groups) {
+            for (const vertex &vertex : group.vertices) {
+                positions.push_back(vertex.position);
+                normals.push_back(vertex.normal);
+            }
+            // cutouts block rays through their see-through texels too, so they cast nothing rather than too much
+            bool casts = group.material_index < materials.size() &&
+                         materials[group.material_index].transparency == 0.0f &&
+                         !(materials[group.material_index].shader_features & SHADER_ALPHA_TEST);
+            triangle_casts.insert(triangle_casts.end(), group.vertices.size() / 3, casts);
+        }
+
+        ambient_occlusion occlusion;
+        if (!options.bake_ao) {
+            if (!occlusion.load(ao_path, ambient_occlusion::hash_layout(positions, normals)))
+                return;
+        } else {
+            auto start = std::chrono::steady_clock::now();
+            occlusion = ambient_occlusion::bake(positions, normals, triangle_casts, options.ao_settings);
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            std::cout << "ao: baked " << occlusion.unique_vertices << " unique of " << positions.size()
+                      << " vertices in " << elapsed.count() << " s, " << occlusion.rays_cast / elapsed.count() / 1e6
+                      << " Mrays/s on " << worker_count() << " threads" << std::endl;
+            occlusion.save(ao_path);
+        }
+
+        size_t index = 0;
+        for (vertex_group &group : groups)
+            for (vertex &vertex : group.vertices)
+                vertex.occlusion = occlusion.value(index++);
+    }
+
+    /**
+     * \brief Pick the solid meshes with the most triangle area as occluders
+     * Big flat surfaces like walls and floors hide the most for the fewest triangles. Cutouts like fences and
+     * foliage are left out, as whatever is behind their see-through texels is visible
+     */
+    void select_occluders(unsigned max_count) {
+        std::vector<std::pair<float, unsigned>> candidates;
+        for (unsigned i = 0; i < meshes.size(); ++i) {
+            if (!materials.at(meshes[i].material_index).solid())
+                continue;
+            const std::vector<glm::vec3> &positions = meshes[i].positions;
+            float area = 0.0f;
+            for (size_t corner = 0; corner + 2 < positions.size(); corner += 3)
+                area += glm::length(glm::cross(positions[corner + 1] - positions[corner],
+                                               positions[corner + 2] - positions[corner])) * 0.5f;
+            candidates.push_back({area, i});
+        }
+        max_count = std::min<unsigned>(max_count, candidates.size());
+        std::partial_sort(candidates.begin(), candidates.begin() + max_count, candidates.end(),
+                          [](const auto &a, const auto &b) { return a.first > b.first; });
+
+        mesh_occluder.assign(meshes.size(), false);
+        for (unsigned i = 0; i < max_count; ++i)
+            mesh_occluder[candidates[i].second] = true;
+    }
 };
\ No newline at end of file
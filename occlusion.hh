@@ -0,0 +1,237 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#include "culling.hh"
+#include "parallel.hh"
+#include "profiler.hh"
+
+/**
+ * \brief Low resolution cpu depth buffer for occlusion culling
+ * Occluder triangles are added with add_occluder(), binned into screen tiles and rasterized by
+ * rasterize(), one tile per task, 4 pixels at a time. test() then checks whether anything at the
+ * screen rect of a box is farther away than the box's nearest point.
+ * Triangles crossing the near plane and back faces are skipped, which only ever makes the buffer
+ * farther away, so culling stays conservative
+ */
+struct occlusion_buffer {
+    static const int TILE_WIDTH = 32;
+    static const int TILE_HEIGHT = 16;
+
+    int width, height;          // in pixels, width is a multiple of 4 and both are multiples of the tile size
+    int tiles_x, tiles_y;
+    std::vector<float> depth;    // window space depth, 0 near to 1 far, row major with y up
+    std::vector<float> tile_max; // farthest depth in each tile
+
+    unsigned triangles_added = 0;
+
+    occlusion_buffer(int requested_width, int requested_height) {
+        tiles_x = std::max(1, (requested_width + TILE_WIDTH - 1) / TILE_WIDTH);
+        tiles_y = std::max(1, (requested_height + TILE_HEIGHT - 1) / TILE_HEIGHT);
+        width = tiles_x * TILE_WIDTH;
+        height = tiles_y * TILE_HEIGHT;
+        depth.assign(width * height, 1.0f);
+        tile_max.assign(tiles_x * tiles_y, 1.0f);
+        tile_triangles.resize(tiles_x * tiles_y);
+    }
+
+    void clear() {
+        std::fill(depth.begin(), depth.end(), 1.0f);
+        std::fill(tile_max.begin(), tile_max.end(), 1.0f);
+        for (std::vector<unsigned> &triangles : tile_triangles)
+            triangles.clear();
+        triangles.clear();
+        triangles_added = 0;
+    }
+
+    /**
+     * \brief Queue a triangle list for rasterization
+     * \param model_view_projection transforms the positions to clip space
+     */
+    void add_occluder(const std::vector<glm::vec3> &positions, const glm::mat4 &model_view_projection) {
+        for (size_t i = 0; i + 2 < positions.size(); i += 3) {
+            glm::vec3 screen[3];
+            bool clipped = false;
+            for (int corner = 0; corner < 3; ++corner) {
+                glm::vec4 clip = model_view_projection * glm::vec4(positions[i + corner], 1.0f);
+                if (clip.w <= NEAR_W) {
+                    clipped = true;
+                    break;
+                }
+                screen[corner] = to_screen(clip);
+            }
+            if (!clipped)
+                setup_triangle(screen);
+        }
+    }
+
+    /**
+     * \brief Rasterize every queued triangle, tiles are processed in parallel
+     */
+    void rasterize() {
+        PROFILE_ZONE("rasterize occluders");
+        parallel_for(0, tile_triangles.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t tile = begin; tile < end; ++tile)
+                rasterize_tile(tile);
+        });
+    }
+
+    /**
+     * \brief Whether any part of the box might be visible past the rasterized occluders
+     */
+    bool test(const aabb &box, const glm::mat4 &model_view_projection) const {
+        glm::vec2 screen_min(std::numeric_limits<float>::max()), screen_max(std::numeric_limits<float>::lowest());
+        float nearest = 1.0f;
+        // the corners are the min corner plus any combination of the box's edges, so transform those once
+        glm::vec3 size = box.max - box.min;
+        glm::vec4 base = model_view_projection * glm::vec4(box.min, 1.0f);
+        glm::vec4 edge_x = model_view_projection[0] * size.x, edge_y = model_view_projection[1] * size.y,
+                  edge_z = model_view_projection[2] * size.z;
+        for (int corner = 0; corner < 8; ++corner) {
+            glm::vec4 clip = base;
+            if (corner & 1)
+                clip += edge_x;
+            if (corner & 2)
+                clip += edge_y;
+            if (corner & 4)
+                clip += edge_z;
+            if (clip.w <= NEAR_W)
+                return true; // the box reaches behind the camera
+            glm::vec3 screen = to_screen(clip);
+            screen_min = glm::min(screen_min, glm::vec2(screen));
+            screen_max = glm::max(screen_max, glm::vec2(screen));
+            nearest = std::min(nearest, screen.z);
+        }
+
+        int x0 = std::max(0, int(std::floor(screen_min.x))), x1 = std::min(width - 1, int(std::ceil(screen_max.x)));
+        int y0 = std::max(0, int(std::floor(screen_min.y))), y1 = std::min(height - 1, int(std::ceil(screen_max.y)));
+        if (x0 > x1 || y0 > y1)
+            return true; // off screen, leave it to the frustum test
+
+        for (int tile_y = y0 / TILE_HEIGHT; tile_y <= y1 / TILE_HEIGHT; ++tile_y) {
+            for (int tile_x = x0 / TILE_WIDTH; tile_x <= x1 / TILE_WIDTH; ++tile_x) {
+                // every pixel in the tile is in front of the box
+                if (tile_max[tile_y * tiles_x + tile_x] < nearest)
+                    continue;
+                int px0 = std::max(x0, tile_x * TILE_WIDTH), px1 = std::min(x1, (tile_x + 1) * TILE_WIDTH - 1);
+                int py0 = std::max(y0, tile_y * TILE_HEIGHT), py1 = std::min(y1, (tile_y + 1) * TILE_HEIGHT - 1);
+                for (int y = py0; y <= py1; ++y)
+                    for (int x = px0; x <= px1; ++x)
+                        if (depth[y * width + x] >= nearest)
+                            return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    static constexpr float NEAR_W = 1e-4f;
+
+    // screen space triangle with edge functions e(x, y) = a * x + b * y + c, inside where all three are >= 0
+    struct triangle {
+        glm::vec3 edge_a, edge_b, edge_c;
+        float depth_x, depth_y, depth_c; // depth(x, y) = depth_x * x + depth_y * y + depth_c
+        glm::ivec2 min, max;              // pixel bounds, inclusive
+    };
+
+    std::vector<triangle> triangles;
+    std::vector<std::vector<unsigned>> tile_triangles;
+
+    glm::vec3 to_screen(glm::vec4 clip) const {
+        glm::vec3 ndc = glm::vec3(clip) / clip.w;
+        return {(ndc.x * 0.5f + 0.5f) * width, (ndc.y * 0.5f + 0.5f) * height, ndc.z * 0.5f + 0.5f};
+    }
+
+    void setup_triangle(const glm::vec3 v[3]) {
+        float area = (v[1].x - v[0].x) * (v[2].y - v[0].y) - (v[2].x - v[0].x) * (v[1].y - v[0].y);
+        if (area <= 0.0f)
+            return; // back facing or degenerate
+
+        triangle t;
+        t.min = glm::ivec2(glm::floor(glm::min(glm::min(glm::vec2(v[0]), glm::vec2(v[1])), glm::vec2(v[2]))));
+        t.max = glm::ivec2(glm::ceil(glm::max(glm::max(glm::vec2(v[0]), glm::vec2(v[1])), glm::vec2(v[2]))));
+        t.min = glm::max(t.min, glm::ivec2(0));
+        t.max = glm::min(t.max, glm::ivec2(width - 1, height - 1));
+        if (t.min.x > t.max.x || t.min.y > t.max.y)
+            return;
+
+        // edge i is opposite vertex i, positive on the inside of a counter clockwise triangle
+        glm::vec3 *edges[3] = {&t.edge_a, &t.edge_b, &t.edge_c};
+        for (int i = 0; i < 3; ++i) {
+            const glm::vec3 &from = v[(i + 1) % 3], &to = v[(i + 2) % 3];
+            *edges[i] = glm::vec3(from.y - to.y, to.x - from.x, from.x * to.y - from.y * to.x);
+        }
+
+        // depth is linear in screen space, solve its plane through the three vertices
+        glm::vec3 d1 = v[1] - v[0], d2 = v[2] - v[0];
+        t.depth_x = (d1.z * d2.y - d2.z * d1.y) / area;
+        t.depth_y = (d2.z * d1.x - d1.z * d2.x) / area;
+        t.depth_c = v[0].z - t.depth_x * v[0].x - t.depth_y * v[0].y;
+
+        unsigned index = triangles.size();
+        triangles.push_back(t);
+        ++triangles_added;
+        for (int tile_y = t.min.y / TILE_HEIGHT; tile_y <= t.max.y / TILE_HEIGHT; ++tile_y)
+            for (int tile_x = t.min.x / TILE_WIDTH; tile_x <= t.max.x / TILE_WIDTH; ++tile_x)
+                tile_triangles[tile_y * tiles_x + tile_x].push_back(index);
+    }
+
+    void rasterize_tile(size_t tile) {
+        int tile_x0 = int(tile % tiles_x) * TILE_WIDTH, tile_y0 = int(tile / tiles_x) * TILE_HEIGHT;
+        for (unsigned index : tile_triangles[tile]) {
+            const triangle &t = triangles[index];
+            // start on a multiple of 4 so the simd loop stays aligned with the tile
+            int x0 = std::max(t.min.x, tile_x0) & ~3, x1 = std::min(t.max.x, tile_x0 + TILE_WIDTH - 1);
+            int y0 = std::max(t.min.y, tile_y0), y1 = std::min(t.max.y, tile_y0 + TILE_HEIGHT - 1);
+            for (int y = y0; y <= y1; ++y) {
+                float py = y + 0.5f;
+                float *row = &depth[y * width];
+#if defined(__SSE2__) || defined(_M_X64)
+                const __m128 offsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+                const __m128 zero = _mm_setzero_ps();
+                for (int x = x0; x <= x1; x += 4) {
+                    __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), offsets);
+                    __m128 w0 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(t.edge_a.x)),
+                                           _mm_set1_ps(t.edge_a.y * py + t.edge_a.z));
+                    __m128 w1 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(t.edge_b.x)),
+                                           _mm_set1_ps(t.edge_b.y * py + t.edge_b.z));
+                    __m128 w2 = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(t.edge_c.x)),
+                                           _mm_set1_ps(t.edge_c.y * py + t.edge_c.z));
+                    __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)),
+                                               _mm_cmpge_ps(w2, zero));
+                    if (_mm_movemask_ps(inside) == 0)
+                        continue;
+                    __m128 z = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(t.depth_x)),
+                                          _mm_set1_ps(t.depth_y * py + t.depth_c));
+                    __m128 current = _mm_loadu_ps(row + x);
+                    __m128 nearer = _mm_min_ps(current, z);
+                    _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, current)));
+                }
+#else
+                for (int x = x0; x <= x1; ++x) {
+                    float px = x + 0.5f;
+                    if (glm::dot(t.edge_a, glm::vec3(px, py, 1.0f)) >= 0.0f &&
+                        glm::dot(t.edge_b, glm::vec3(px, py, 1.0f)) >= 0.0f &&
+                        glm::dot(t.edge_c, glm::vec3(px, py, 1.0f)) >= 0.0f)
+                        row[x] = std::min(row[x], t.depth_x * px + t.depth_y * py + t.depth_c);
+                }
+#endif
+            }
+        }
+
+        float farthest = 0.0f;
+        for (int y = tile_y0; y < tile_y0 + TILE_HEIGHT; ++y)
+            for (int x = tile_x0; x < tile_x0 + TILE_WIDTH; ++x)
+                farthest = std::max(farthest, depth[y * width + x]);
+        tile_max[tile] = farthest;
+    }
+};
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <cstddef>
+
+#include "jobs.hh"
+
+/**
+ * \brief Number of threads worth splitting cpu work across, the job system's workers and the caller
+ */
+inline unsigned worker_count() { return jobs().thread_count(); }
+
+/**
+ * \brief Split [begin, end) into contiguous slices of at least min_slice items and run
+ * function(slice_begin, slice_end) on each as a job, and wait for all of them
+ * There are a few slices per worker so that idle workers can steal from busy ones when the slices
+ * take uneven time. The calling thread runs the first slice itself, then helps with the rest
+ */
+template <typename function_type>
+void parallel_for(size_t begin, size_t end, size_t min_slice, function_type function) {
+    if (end <= begin)
+        return;
+    size_t count = end - begin;
+    size_t max_slices = worker_count() > 1 ? worker_count() * 4 : 1;
+    size_t slices = std::min<size_t>(max_slices, (count + min_slice - 1) / std::max<size_t>(min_slice, 1));
+    if (slices <= 1) {
+        function(begin, end);
+        return;
+    }
+
+    size_t slice_size = (count + slices - 1) / slices;
+    job_counter counter;
+    for (size_t slice_begin = begin + slice_size; slice_begin < end; slice_begin += slice_size) {
+        size_t slice_end = std::min(slice_begin + slice_size, end);
+        jobs().run([&function, slice_begin, slice_end] { function(slice_begin, slice_end); }, counter);
+    }
+    function(begin, std::min(begin + slice_size, end));
+    jobs().wait(counter);
+}
+
+/**
+ * \brief Run gather(slice_begin, slice_end) over slices of [begin, end) like parallel_for, then fold the
+ * results into the first one with merge(result &into, const result &from) and return it
+ */
+template <typename gather_type, typename merge_type>
+auto parallel_reduce(size_t begin, size_t end, size_t min_slice, gather_type gather, merge_type merge) {
+    size_t count = end > begin ? end - begin : 0;
+    size_t slices = std::min<size_t>(worker_count(), (count + min_slice - 1) / std::max<size_t>(min_slice, 1));
+    if (slices <= 1)
+        return gather(begin, end);
+
+    size_t slice_size = (count + slices - 1) / slices;
+    std::vector<decltype(gather(begin, end))> results(slices);
+    parallel_for(0, slices, 1, [&](size_t first_slice, size_t last_slice) {
+        for (size_t slice = first_slice; slice < last_slice; ++slice) {
+            size_t slice_begin = std::min(begin + slice * slice_size, end);
+            results[slice] = gather(slice_begin, std::min(slice_begin + slice_size, end));
+        }
+    });
+    for (size_t slice = 1; slice < slices; ++slice)
+        merge(results[0], results[slice]);
+    return results[0];
+}
+
+/**
+ * \brief Run two functions concurrently and wait for both
+ */
+template <typename function_a, typename function_b> void parallel_invoke(function_a a, function_b b) {
+    job_counter counter;
+    jobs().run(a, counter);
+    b();
+    jobs().wait(counter);
+}
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+#include "profiler.hh"
+
+/**
+ * \brief Runs the cpu side of a frame on its own thread, ahead of the thread that submits to gl
+ * Every frame the gl thread hands in the input for a new frame and gets back a packet prepared from
+ * the input it handed in latency frames ago, so preparing frame N + latency overlaps submitting frame N.
+ * latency + 1 packets rotate between the two threads, a packet is only reused once the gl thread
+ * has moved on to the next one. With a latency of 0 frames are prepared on the calling thread
+ */
+template <typename input_type, typename packet_type> struct frame_pipeline {
+    using prepare_function = std::function<void(const input_type &, packet_type &)>;
+
+    static const unsigned MAX_LATENCY = 2;
+
+    frame_pipeline(unsigned frames_of_latency, prepare_function prepare_frame)
+        : latency(std::min(frames_of_latency, MAX_LATENCY)), prepare(prepare_frame), inputs(latency + 1),
+          packets(latency + 1), ready(latency + 1, false) {
+        if (latency > 0)
+            worker = std::thread(&frame_pipeline::run, this);
+    }
+
+    ~frame_pipeline() {
+        if (!worker.joinable())
+            return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        worker.join();
+    }
+
+    frame_pipeline(const frame_pipeline &) = delete;
+    frame_pipeline &operator=(const frame_pipeline &) = delete;
+
+    /**
+     * \brief Queue the next frame's input and wait for the packet to submit this frame
+     * \return nullptr for the first latency frames, while the pipeline fills
+     */
+    packet_type *advance(const input_type &input) {
+        if (latency == 0) {
+            prepare(input, packets[0]);
+            return &packets[0];
+        }
+
+        // this slot's packet was submitted last frame, so nothing reads it any more
+        unsigned slot = queued % (latency + 1);
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            inputs[slot] = input;
+            ready[slot] = false;
+            ++queued;
+        }
+        changed.notify_all();
+
+        if (queued <= latency)
+            return nullptr;
+        unsigned submit_slot = (queued - 1 - latency) % (latency + 1);
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [&] { return bool(ready[submit_slot]); });
+        return &packets[submit_slot];
+    }
+
+    unsigned frame_latency() const { return latency; }
+
+  private:
+    const unsigned latency;
+    prepare_function prepare;
+    std::vector<input_type> inputs;
+    std::vector<packet_type> packets;
+    std::vector<char> ready;
+
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable changed;
+    unsigned queued = 0;   // frames handed in, only written by the gl thread
+    unsigned prepared = 0; // frames prepared, only written by the worker
+    bool stopping = false;
+
+    void run() {
+        profile().name_thread("frame preparation");
+        while (true) {
+            input_type input;
+            unsigned slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return stopping || prepared < queued; });
+                if (stopping)
+                    return;
+                slot = prepared % (latency + 1);
+                input = inputs[slot];
+            }
+            prepare(input, packets[slot]);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                ready[slot] = true;
+                ++prepared;
+            }
+            changed.notify_all();
+        }
+    }
+};
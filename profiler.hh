@@ -0,0 +1,186 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <algorithm>
+
+/**
+ * \brief Ring of the zones recorded on one thread, or on another timeline such as the gpu's
+ * Only its own thread writes to it, so recording takes no lock. Once full the oldest zones are
+ * overwritten. The fields are atomics so a trace can be written while zones are still being recorded
+ */
+struct profile_track {
+    static const unsigned CAPACITY = 1 << 16;
+
+    struct zone {
+        std::atomic<const char *> name{nullptr};
+        std::atomic<int64_t> start{0}, end{0}; // nanoseconds since the profiler was created
+    };
+
+    std::string name;
+    std::unique_ptr<zone[]> zones{new zone[CAPACITY]};
+    std::atomic<uint64_t> written{0};
+
+    void record(const char *zone_name, int64_t start, int64_t end) {
+        uint64_t index = written.load(std::memory_order_relaxed);
+        zone &zone = zones[index % CAPACITY];
+        zone.name.store(zone_name, std::memory_order_relaxed);
+        zone.start.store(start, std::memory_order_relaxed);
+        zone.end.store(end, std::memory_order_relaxed);
+        written.store(index + 1, std::memory_order_release);
+    }
+};
+
+/**
+ * \brief Collects scoped zones from every thread and writes them as a Chrome trace
+ * Zones are only recorded between start() and stop(); while stopped a PROFILE_ZONE costs one relaxed
+ * load and a branch. Defining NO_PROFILER compiles the zones out altogether
+ */
+struct profiler {
+    std::atomic<bool> enabled{false};
+    std::atomic<unsigned> recordings{0}; // times start() was called, timelines recalibrate when it changes
+
+    int64_t now() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch)
+            .count();
+    }
+
+    /**
+     * \brief Start recording, zones recorded before are left out of the next trace
+     */
+    void start() {
+        recording_start.store(now(), std::memory_order_relaxed);
+        recordings.fetch_add(1, std::memory_order_relaxed);
+        enabled.store(true, std::memory_order_relaxed);
+    }
+
+    void stop() { enabled.store(false, std::memory_order_relaxed); }
+
+    /**
+     * \brief The calling thread's track, created the first time it records something
+     */
+    profile_track &thread_track() {
+        thread_local profile_track *track = nullptr;
+        if (track == nullptr)
+            track = &create_track(thread_name());
+        return *track;
+    }
+
+    /**
+     * \brief Name the calling thread's track in traces, before it records anything
+     */
+    void name_thread(const std::string &name) { thread_name() = name; }
+
+    /**
+     * \brief A track for a timeline that is not a thread, recorded into by one thread only
+     */
+    profile_track &create_track(const std::string &name) {
+        std::lock_guard<std::mutex> lock(mutex);
+        tracks.push_back(std::make_unique<profile_track>());
+        tracks.back()->name = name.empty() ? "thread " + std::to_string(tracks.size()) : name;
+        return *tracks.back();
+    }
+
+    /**
+     * \brief Write the zones recorded since the last start() in the Chrome trace event format, which
+     * chrome://tracing and ui.perfetto.dev open
+     */
+    bool write_chrome_trace(const std::string &path) {
+        std::ofstream file(path);
+        if (!file.is_open()) {
+            std::cout << "Failed to open file: " << path << std::endl;
+            return false;
+        }
+        int64_t since = recording_start.load(std::memory_order_relaxed);
+        size_t zone_count = 0;
+        file << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t tid = 0; tid < tracks.size(); ++tid) {
+            const profile_track &track = *tracks[tid];
+            file << (tid > 0 ? ",\n" : "") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << tid
+                 << ",\"args\":{\"name\":\"" << track.name << "\"}}";
+
+            // copy first and then drop whatever the thread may have overwritten meanwhile
+            uint64_t written = track.written.load(std::memory_order_acquire);
+            uint64_t first = written > profile_track::CAPACITY ? written - profile_track::CAPACITY : 0;
+            struct copy {
+                const char *name;
+                int64_t start, end;
+            };
+            std::vector<copy> zones;
+            for (uint64_t i = first; i < written; ++i) {
+                const profile_track::zone &zone = track.zones[i % profile_track::CAPACITY];
+                zones.push_back({zone.name.load(std::memory_order_relaxed), zone.start.load(std::memory_order_relaxed),
+                                 zone.end.load(std::memory_order_relaxed)});
+            }
+            uint64_t written_after = track.written.load(std::memory_order_acquire);
+            uint64_t valid = written_after > profile_track::CAPACITY ? written_after - profile_track::CAPACITY : 0;
+            for (uint64_t i = std::max(first, valid); i < written; ++i) {
+                const copy &zone = zones[i - first];
+                if (zone.start < since)
+                    continue;
+                file << ",\n{\"name\":\"" << zone.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+                     << ",\"ts\":" << zone.start / 1000.0 << ",\"dur\":" << (zone.end - zone.start) / 1000.0 << "}";
+                ++zone_count;
+            }
+        }
+        file << "\n]}\n";
+        std::cout << "profiler: wrote " << zone_count << " zones to " << path << std::endl;
+        return file.good();
+    }
+
+  private:
+    const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+    std::atomic<int64_t> recording_start{0};
+    std::mutex mutex;
+    std::vector<std::unique_ptr<profile_track>> tracks;
+
+    static std::string &thread_name() {
+        thread_local std::string name;
+        return name;
+    }
+};
+
+/**
+ * \brief The profiler the engine shares
+ */
+inline profiler &profile() {
+    static profiler instance;
+    return instance;
+}
+
+/**
+ * \brief Records the time from its construction to its destruction as a zone of the calling thread
+ * \param name has to outlive the trace, use a string literal
+ */
+struct profile_zone {
+    const char *name;
+    int64_t start; // negative while the profiler is stopped
+
+    explicit profile_zone(const char *zone_name)
+        : name(zone_name), start(profile().enabled.load(std::memory_order_relaxed) ? profile().now() : -1) {}
+
+    ~profile_zone() {
+        if (start >= 0)
+            profile().thread_track().record(name, start, profile().now());
+    }
+
+    profile_zone(const profile_zone &) = delete;
+    profile_zone &operator=(const profile_zone &) = delete;
+};
+
+#define PROFILE_CONCATENATE_(a, b) a##b
+#define PROFILE_CONCATENATE(a, b) PROFILE_CONCATENATE_(a, b)
+#ifndef NO_PROFILER
+// times the rest of the enclosing scope
+#define PROFILE_ZONE(name) profile_zone PROFILE_CONCATENATE(profile_zone_, __LINE__)(name)
+#else
+#define PROFILE_ZONE(name)
+#endif
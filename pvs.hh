@@ -0,0 +1,333 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <cstdint>
+#include <algorithm>
+
+#include "culling.hh"
+#include "parallel.hh"
+#include "bvh.hh"
+#include "profiler.hh"
+
+struct pvs_bake_settings {
+    unsigned cells_per_axis = 16; // cells along the longest side of the model
+    unsigned rays_per_cell = 2048;
+    unsigned max_pass_through = 8; // non blocking surfaces a ray may pass through before it stops
+};
+
+/**
+ * \brief Precomputed potentially visible sets of a static model
+ * The model's bounds are divided into a grid of cells, and each cell stores which chunks (meshes) can
+ * be seen from anywhere inside it as a PackBits compressed bitset. Sets are baked by casting random
+ * rays from inside each cell against the model's triangles, so a chunk only seen through a tiny gap
+ * can be missed; more rays per cell make that less likely.
+ * Everything is in the model's object space
+ */
+struct pvs {
+    glm::vec3 origin{0.0f}; // min corner of the grid
+    float cell_size = 0.0f;
+    glm::ivec3 cell_counts{0};
+    unsigned chunk_count = 0;
+    uint64_t layout_hash = 0; // hash of the triangles the sets were baked from, stale files are ignored
+
+    // cell i's packed set is data[cell_offsets[i], cell_offsets[i + 1]), empty for cells that were not baked
+    std::vector<uint32_t> cell_offsets;
+    std::vector<uint8_t> data;
+
+    bool empty() const { return cell_offsets.empty(); }
+
+    /**
+     * \brief Index of the cell containing point, or -1 outside the grid
+     */
+    int cell_index(glm::vec3 point) const {
+        if (empty())
+            return -1;
+        glm::ivec3 cell = glm::ivec3(glm::floor((point - origin) / cell_size));
+        if (glm::any(glm::lessThan(cell, glm::ivec3(0))) || glm::any(glm::greaterThanEqual(cell, cell_counts)))
+            return -1;
+        return (cell.z * cell_counts.y + cell.y) * cell_counts.x + cell.x;
+    }
+
+    /**
+     * \brief Decode the set of a cell into one byte per chunk
+     * \return false if the cell has no set, in which case everything should be treated as visible
+     */
+    bool lookup(int cell, std::vector<uint8_t> &visible) const {
+        if (cell < 0 || !baked(cell))
+            return false;
+        // sets are differences to the previous baked cell along x, so start from the first one of the run
+        int first = cell;
+        while (first % cell_counts.x > 0 && baked(first - 1))
+            --first;
+        std::vector<uint8_t> bits((chunk_count + 7) / 8, 0), difference;
+        for (int i = first; i <= cell; ++i) {
+            unpack_bits(data.data() + cell_offsets[i], data.data() + cell_offsets[i + 1], difference);
+            for (size_t byte = 0; byte < bits.size() && byte < difference.size(); ++byte)
+                bits[byte] ^= difference[byte];
+        }
+        visible.resize(chunk_count);
+        for (unsigned i = 0; i < chunk_count; ++i)
+            visible[i] = (bits[i / 8] >> (i % 8)) & 1;
+        return true;
+    }
+
+    bool baked(int cell) const { return cell_offsets[cell + 1] > cell_offsets[cell]; }
+
+    /**
+     * \brief Hash of the chunks' triangles, used to tell whether a saved set still matches the model
+     */
+    static uint64_t hash_layout(const std::vector<const std::vector<glm::vec3> *> &chunk_positions) {
+        // FNV-1a over the chunk sizes and vertex positions
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&](const void *bytes, size_t size) {
+            for (size_t i = 0; i < size; ++i)
+                hash = (hash ^ static_cast<const uint8_t *>(bytes)[i]) * 1099511628211ull;
+        };
+        for (const std::vector<glm::vec3> *positions : chunk_positions) {
+            uint64_t count = positions->size();
+            add(&count, sizeof(count));
+            add(positions->data(), positions->size() * sizeof(glm::vec3));
+        }
+        return hash;
+    }
+
+    /**
+     * \brief Bake the sets for a model split into chunks
+     * Only cells with geometry somewhere below their center are baked, which skips the space under the
+     * model and leaves the cells something could be standing in
+     * \param chunk_positions triangle corners of each chunk
+     * \param chunk_blocks whether each chunk stops rays, transparent and alpha tested chunks should not
+     */
+    static pvs bake(const std::vector<const std::vector<glm::vec3> *> &chunk_positions,
+                    const std::vector<uint8_t> &chunk_blocks, const pvs_bake_settings &settings = pvs_bake_settings()) {
+        PROFILE_ZONE("bake pvs");
+        pvs result;
+        result.chunk_count = chunk_positions.size();
+        result.layout_hash = hash_layout(chunk_positions);
+
+        aabb model_bounds;
+        std::vector<aabb> chunk_bounds(chunk_positions.size());
+        std::vector<aabb> triangle_bounds;
+        std::vector<std::pair<unsigned, unsigned>> triangles; // chunk and first corner of each triangle
+        for (unsigned chunk = 0; chunk < chunk_positions.size(); ++chunk) {
+            const std::vector<glm::vec3> &positions = *chunk_positions[chunk];
+            for (unsigned corner = 0; corner + 2 < positions.size(); corner += 3) {
+                aabb box;
+                for (unsigned i = 0; i < 3; ++i)
+                    box.expand(positions[corner + i]);
+                triangle_bounds.push_back(box);
+                triangles.push_back({chunk, corner});
+                chunk_bounds[chunk].expand(box);
+            }
+            model_bounds.expand(chunk_bounds[chunk]);
+        }
+        if (model_bounds.empty())
+            return result;
+
+        bvh triangle_bvh;
+        triangle_bvh.build(triangle_bounds, 4);
+
+        glm::vec3 size = model_bounds.max - model_bounds.min;
+        result.cell_size = std::max({size.x, size.y, size.z}) / std::max(settings.cells_per_axis, 1u);
+        result.origin = model_bounds.min;
+        result.cell_counts = glm::max(glm::ivec3(glm::ceil(size / result.cell_size)), glm::ivec3(1));
+        unsigned cell_count = result.cell_counts.x * result.cell_counts.y * result.cell_counts.z;
+
+        // closest triangle along a ray, returns its chunk or -1
+        auto trace = [&](glm::vec3 origin, glm::vec3 direction, float &t) {
+            int hit_chunk = -1;
+            t = std::numeric_limits<float>::max();
+            triangle_bvh.raycast(origin, direction, t, [&](unsigned triangle, float &t_max) {
+                const std::vector<glm::vec3> &positions = *chunk_positions[triangles[triangle].first];
+                unsigned corner = triangles[triangle].second;
+                float t_hit;
+                if (!ray_intersects(positions[corner], positions[corner + 1], positions[corner + 2], origin, direction,
+                                    t_max, t_hit))
+                    return false;
+                t_max = t_hit;
+                hit_chunk = triangles[triangle].first;
+                return true;
+            });
+            return hit_chunk;
+        };
+
+        std::vector<std::vector<uint8_t>> cell_sets(cell_count);
+        parallel_for(0, cell_count, 1, [&](size_t begin, size_t end) {
+            std::vector<uint8_t> bits;
+            for (size_t cell = begin; cell < end; ++cell) {
+                glm::ivec3 coordinates(cell % result.cell_counts.x, cell / result.cell_counts.x % result.cell_counts.y,
+                                       cell / result.cell_counts.x / result.cell_counts.y);
+                aabb cell_bounds{result.origin + glm::vec3(coordinates) * result.cell_size,
+                                 result.origin + glm::vec3(coordinates + 1) * result.cell_size};
+                float t;
+                if (trace(cell_bounds.center(), glm::vec3(0.0f, -1.0f, 0.0f), t) < 0)
+                    continue;
+
+                bits.assign((result.chunk_count + 7) / 8, 0);
+                auto mark = [&](unsigned chunk) { bits[chunk / 8] |= 1 << (chunk % 8); };
+                // chunks reaching into the cell are always visible from it
+                for (unsigned chunk = 0; chunk < chunk_bounds.size(); ++chunk)
+                    if (overlaps(chunk_bounds[chunk], cell_bounds))
+                        mark(chunk);
+
+                std::mt19937 rng(cell);
+                std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+                std::normal_distribution<float> normal;
+                for (unsigned ray = 0; ray < settings.rays_per_cell; ++ray) {
+                    glm::vec3 origin = cell_bounds.min + glm::vec3(unit(rng), unit(rng), unit(rng)) * result.cell_size;
+                    glm::vec3 direction(normal(rng), normal(rng), normal(rng));
+                    if (glm::dot(direction, direction) < 1e-12f)
+                        continue;
+                    direction = glm::normalize(direction);
+                    for (unsigned pass = 0; pass <= settings.max_pass_through; ++pass) {
+                        int chunk = trace(origin, direction, t);
+                        if (chunk < 0)
+                            break;
+                        mark(chunk);
+                        if (chunk_blocks[chunk])
+                            break;
+                        origin += direction * (t + 1e-4f * result.cell_size);
+                    }
+                }
+                cell_sets[cell] = bits;
+            }
+        });
+
+        // neighbouring cells see nearly the same chunks, so each set is stored as the difference to the
+        // previous cell along x, which is mostly zero bytes and packs well
+        result.cell_offsets.push_back(0);
+        std::vector<uint8_t> difference, packed;
+        for (unsigned cell = 0; cell < cell_count; ++cell) {
+            if (!cell_sets[cell].empty()) {
+                difference = cell_sets[cell];
+                if (cell % result.cell_counts.x > 0 && !cell_sets[cell - 1].empty())
+                    for (size_t i = 0; i < difference.size(); ++i)
+                        difference[i] ^= cell_sets[cell - 1][i];
+                pack_bits(difference, packed);
+                result.data.insert(result.data.end(), packed.begin(), packed.end());
+            }
+            result.cell_offsets.push_back(result.data.size());
+        }
+        return result;
+    }
+
+    bool save(const std::string &path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            std::cout << "Failed to open file: " << path << std::endl;
+            return false;
+        }
+        uint32_t header[] = {MAGIC, chunk_count, uint32_t(cell_offsets.size()), uint32_t(data.size())};
+        file.write(reinterpret_cast<const char *>(header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(&layout_hash), sizeof(layout_hash));
+        file.write(reinterpret_cast<const char *>(&origin), sizeof(origin));
+        file.write(reinterpret_cast<const char *>(&cell_size), sizeof(cell_size));
+        file.write(reinterpret_cast<const char *>(&cell_counts), sizeof(cell_counts));
+        file.write(reinterpret_cast<const char *>(cell_offsets.data()), cell_offsets.size() * sizeof(uint32_t));
+        file.write(reinterpret_cast<const char *>(data.data()), data.size());
+        return file.good();
+    }
+
+    /**
+     * \brief Load sets saved by save(), if they were baked from a model with the given layout hash
+     */
+    bool load(const std::string &path, uint64_t expected_hash) {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+            return false;
+        uint32_t header[4];
+        uint64_t hash;
+        file.read(reinterpret_cast<char *>(header), sizeof(header));
+        file.read(reinterpret_cast<char *>(&hash), sizeof(hash));
+        if (!file || header[0] != MAGIC || hash != expected_hash) {
+            std::cout << path << " does not match the model, ignoring it" << std::endl;
+            return false;
+        }
+
+        pvs loaded;
+        loaded.chunk_count = header[1];
+        loaded.layout_hash = hash;
+        file.read(reinterpret_cast<char *>(&loaded.origin), sizeof(loaded.origin));
+        file.read(reinterpret_cast<char *>(&loaded.cell_size), sizeof(loaded.cell_size));
+        file.read(reinterpret_cast<char *>(&loaded.cell_counts), sizeof(loaded.cell_counts));
+        // the sizes are checked against the grid and the rest of the file before anything is allocated
+        std::streamoff body_start = file.tellg();
+        file.seekg(0, std::ios::end);
+        std::streamoff body_size = file.tellg() - body_start;
+        file.seekg(body_start);
+        bool valid_grid = glm::all(glm::greaterThan(loaded.cell_counts, glm::ivec3(0))) &&
+                          uint64_t(header[2]) == uint64_t(loaded.cell_counts.x) * loaded.cell_counts.y *
+                                                         loaded.cell_counts.z + 1;
+        if (!file || !valid_grid || uint64_t(body_size) != uint64_t(header[2]) * sizeof(uint32_t) + header[3]) {
+            std::cout << path << " is damaged, ignoring it" << std::endl;
+            return false;
+        }
+        loaded.cell_offsets.resize(header[2]);
+        loaded.data.resize(header[3]);
+        file.read(reinterpret_cast<char *>(loaded.cell_offsets.data()), loaded.cell_offsets.size() * sizeof(uint32_t));
+        file.read(reinterpret_cast<char *>(loaded.data.data()), loaded.data.size());
+        if (!file) {
+            std::cout << "Failed to read " << path << std::endl;
+            return false;
+        }
+        // lookup() reads data[cell_offsets[i], cell_offsets[i + 1]) without checking, so the offsets have to
+        // start at 0, never decrease and end at the size of the data
+        bool valid_offsets = loaded.cell_offsets.front() == 0 && loaded.cell_offsets.back() == loaded.data.size() &&
+                             std::is_sorted(loaded.cell_offsets.begin(), loaded.cell_offsets.end());
+        if (!valid_offsets) {
+            std::cout << path << " is damaged, ignoring it" << std::endl;
+            return false;
+        }
+        *this = std::move(loaded);
+        return true;
+    }
+
+  private:
+    static const uint32_t MAGIC = 0x32535650; // "PVS2", version 1 files had cutouts blocking rays
+
+    // PackBits: a control byte n < 128 is followed by n + 1 literal bytes, n > 128 repeats the next byte 257 - n times
+    static void pack_bits(const std::vector<uint8_t> &bytes, std::vector<uint8_t> &packed) {
+        packed.clear();
+        size_t i = 0;
+        while (i < bytes.size()) {
+            size_t run = 1;
+            while (i + run < bytes.size() && run < 128 && bytes[i + run] == bytes[i])
+                ++run;
+            if (run >= 3) {
+                packed.push_back(uint8_t(257 - run));
+                packed.push_back(bytes[i]);
+                i += run;
+                continue;
+            }
+            // literals until the next run of at least three, shorter runs are cheaper to leave in the literals
+            size_t literal_end = i + 1;
+            while (literal_end < bytes.size() && literal_end - i < 128 &&
+                   !(literal_end + 2 < bytes.size() && bytes[literal_end] == bytes[literal_end + 1] &&
+                     bytes[literal_end] == bytes[literal_end + 2]))
+                ++literal_end;
+            packed.push_back(uint8_t(literal_end - i - 1));
+            packed.insert(packed.end(), bytes.begin() + i, bytes.begin() + literal_end);
+            i = literal_end;
+        }
+    }
+
+    static void unpack_bits(const uint8_t *packed, const uint8_t *end, std::vector<uint8_t> &bytes) {
+        bytes.clear();
+        while (packed < end) {
+            uint8_t control = *packed++;
+            if (control < 128) {
+                size_t count = std::min<size_t>(control + 1, end - packed);
+                bytes.insert(bytes.end(), packed, packed + count);
+                packed += count;
+            } else if (control > 128 && packed < end) {
+                bytes.insert(bytes.end(), 257 - control, *packed++);
+            }
+        }
+    }
+};
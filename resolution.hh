@@ -0,0 +1,153 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+
+#include "material.hh"
+
+/**
+ * \brief Offscreen render target whose resolution follows the frame time
+ * Frames are drawn into the lower left scale * window size pixels of a target allocated for max_scale,
+ * then stretched over the window. The time the gpu spends between begin_frame() and end_frame() is
+ * measured with timer queries, read a few frames later so the cpu never waits on them, and the scale is
+ * moved so that time stays just under target_ms. The pixel count, which most of the time is spent on,
+ * goes with the square of the scale. Without timer queries the cpu frame time is used instead, which
+ * also counts time the cpu is the bottleneck or waits for vsync
+ */
+struct dynamic_resolution {
+    static const unsigned QUERY_COUNT = 4; // frames a timer query has to finish in before it is reused
+
+    float target_ms = 16.0f;
+    float min_scale = 0.5f, max_scale = 1.0f;
+    float scale = 1.0f;
+
+    GLuint framebuffer = 0, color_texture = 0, depth_renderbuffer = 0;
+    int width = 0, height = 0; // what is drawn this frame, scale * the window size
+
+    bool present = true; // stretch frames over the window, headless contexts without one only draw offscreen
+
+    float frame_ms = 0.0f; // smoothed frame time the scale is driven by
+    bool gpu_timing = false;
+    float gpu_ms = -1.0f;      // latest gpu time read back, of frame gpu_ms_frame
+    unsigned gpu_ms_frame = 0; // counted like frames, the first frame is 1
+    unsigned frames = 0, changes = 0;
+
+    void init() {
+        gpu_timing = GLAD_GL_VERSION_3_3 && glGetQueryObjectui64v != nullptr;
+        if (gpu_timing)
+            glGenQueries(QUERY_COUNT, queries);
+        else
+            std::cout << "timer queries need OpenGL 3.3, dynamic resolution follows the cpu frame time instead"
+                      << std::endl;
+        glGenFramebuffers(1, &framebuffer);
+        glGenTextures(1, &color_texture);
+        glGenRenderbuffers(1, &depth_renderbuffer);
+        scale = std::clamp(scale, min_scale, max_scale);
+    }
+
+    /**
+     * \brief Pick this frame's resolution, bind the target and start timing
+     * \param cpu_frame_ms time since the last frame started, used without timer queries
+     */
+    void begin_frame(int window_width, int window_height, float cpu_frame_ms) {
+        ++frames;
+        if (gpu_timing) {
+            // the oldest query is reused now, its result is the latest one that can be read without waiting
+            GLuint query = queries[frames % QUERY_COUNT];
+            GLint available = 0;
+            if (frames > QUERY_COUNT)
+                glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+                // software renderers have been seen to return garbage for the first query, ignore anything
+                // over a second
+                if (nanoseconds < 1000000000) {
+                    gpu_ms = nanoseconds * 1e-6f;
+                    gpu_ms_frame = frames - QUERY_COUNT;
+                    adjust(gpu_ms);
+                }
+            }
+        } else if (frames > 1) {
+            adjust(cpu_frame_ms);
+        }
+
+        int target_width = std::max(int(std::ceil(window_width * max_scale)), 1);
+        int target_height = std::max(int(std::ceil(window_height * max_scale)), 1);
+        if (target_width != allocated_width || target_height != allocated_height)
+            allocate(target_width, target_height);
+        window_size = glm::ivec2(window_width, window_height);
+        width = std::clamp(int(window_width * scale + 0.5f), 1, allocated_width);
+        height = std::clamp(int(window_height * scale + 0.5f), 1, allocated_height);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, width, height);
+        if (gpu_timing)
+            glBeginQuery(GL_TIME_ELAPSED, queries[frames % QUERY_COUNT]);
+    }
+
+    /**
+     * \brief Stop timing and stretch the frame over the window
+     */
+    void end_frame() {
+        if (gpu_timing)
+            glEndQuery(GL_TIME_ELAPSED);
+        if (!present)
+            return;
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, framebuffer);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, width, height, 0, 0, window_size.x, window_size.y, GL_COLOR_BUFFER_BIT,
+                          width == window_size.x && height == window_size.y ? GL_NEAREST : GL_LINEAR);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(0, 0, window_size.x, window_size.y);
+    }
+
+  private:
+    GLuint queries[QUERY_COUNT] = {};
+    int allocated_width = 0, allocated_height = 0;
+    glm::ivec2 window_size{0};
+    unsigned frames_since_change = 0;
+
+    void allocate(int target_width, int target_height) {
+        allocated_width = target_width;
+        allocated_height = target_height;
+        glBindTexture(GL_TEXTURE_2D, color_texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, target_width, target_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+        material::bound_texture_id = 0;
+        glBindRenderbuffer(GL_RENDERBUFFER, depth_renderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, target_width, target_height);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color_texture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth_renderbuffer);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "dynamic resolution framebuffer is incomplete" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    void adjust(float measured_ms) {
+        frame_ms = frame_ms == 0.0f ? measured_ms : frame_ms + (measured_ms - frame_ms) * 0.1f;
+        // the smoothed time needs a while to show the effect of the last change, as results arrive late
+        if (++frames_since_change < QUERY_COUNT + 8)
+            return;
+        // aim a little under the target, and leave the scale alone while close to it so it does not flicker
+        float aim = target_ms * 0.9f;
+        if (frame_ms > target_ms * 0.8f && frame_ms < target_ms)
+            return;
+        float next = scale * std::sqrt(aim / std::max(frame_ms, 1e-3f));
+        next = std::clamp(next, std::max(scale * 0.85f, min_scale), std::min(scale * 1.1f, max_scale));
+        if (std::abs(next - scale) < 0.01f)
+            return;
+        scale = next;
+        frames_since_change = 0;
+        ++changes;
+    }
+};
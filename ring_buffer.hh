@@ -0,0 +1,129 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <deque>
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+
+#include "telemetry.hh"
+
+/**
+ * \brief Persistently mapped buffer that per frame data is streamed through
+ * Allocations are handed out from the buffer in order, wrapping back to the start when they reach the
+ * end. end_frame() puts a fence after the frame's commands, and memory is only reused once the fence
+ * of the frame that last used it has signaled, so writing is a plain memcpy and the driver never has
+ * to synchronize implicitly. The buffer holds FRAME_COUNT frames of frame_size bytes
+ */
+struct ring_buffer {
+    static const unsigned FRAME_COUNT = 3;
+
+    struct allocation {
+        void *pointer = nullptr; // where to write the data, nullptr if the allocation failed
+        GLintptr offset = 0;     // byte offset in the buffer to point gl at
+    };
+
+    GLenum target = GL_ARRAY_BUFFER;
+    GLuint buffer_id = 0;
+    size_t capacity = 0;
+    uint8_t *mapped = nullptr;
+
+    unsigned stalls = 0; // times the cpu had to wait for the gpu to finish with memory
+    unsigned wraps = 0;  // times allocation went back to the start of the buffer
+    unsigned frames = 0;
+    unsigned overflows = 0; // allocations that failed because the current frame had used up the buffer
+
+    /**
+     * \brief Create and map the buffer
+     * \return false if persistent mapping is not supported, it needs OpenGL 4.4
+     */
+    bool init(GLenum buffer_target, size_t frame_size) {
+        if (!GLAD_GL_VERSION_4_4 || glBufferStorage == nullptr) {
+            std::cout << "persistently mapped buffers need OpenGL 4.4, streaming through glBufferData instead"
+                      << std::endl;
+            return false;
+        }
+        target = buffer_target;
+        capacity = frame_size * FRAME_COUNT;
+        const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glGenBuffers(1, &buffer_id);
+        glBindBuffer(target, buffer_id);
+        glBufferStorage(target, capacity, NULL, flags);
+        mapped = static_cast<uint8_t *>(glMapBufferRange(target, 0, capacity, flags));
+        if (mapped == nullptr) {
+            std::cout << "Failed to map ring buffer" << std::endl;
+            glDeleteBuffers(1, &buffer_id);
+            buffer_id = 0;
+            return false;
+        }
+        return true;
+    }
+
+    bool valid() const { return mapped != nullptr; }
+
+    /**
+     * \brief Reserve size bytes for this frame, waiting for the gpu if the memory is still in use
+     * Fails when the memory the current frame already has leaves no room, so callers need another way to upload
+     * \param alignment of the offset, a uniform block needs GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+     */
+    allocation allocate(size_t size, size_t alignment = 16) {
+        if (!valid())
+            return {};
+        // positions count every byte ever allocated, the buffer offset is position % capacity
+        uint64_t start = head - head % capacity + (head % capacity + alignment - 1) / alignment * alignment;
+        bool wrapped = start % capacity + size > capacity;
+        if (wrapped)
+            start = (start / capacity + 1) * capacity;
+        if (size <= capacity)
+            while (start + size - tail > capacity && !in_flight.empty())
+                wait_oldest();
+        // what is left between tail and head belongs to the current frame, which has no fence yet
+        if (start + size - tail > capacity) {
+            if (overflows++ == 0)
+                std::cout << "ring buffer: a frame needs more than its " << capacity
+                          << " bytes, the rest is uploaded on its own" << std::endl;
+            return {};
+        }
+        wraps += wrapped;
+        head = start + size;
+        render_count().bytes_uploaded += size; // the caller copies that much into it
+        return {mapped + start % capacity, GLintptr(start % capacity)};
+    }
+
+    /**
+     * \brief Fence the commands that read this frame's allocations, call after issuing them
+     */
+    void end_frame() {
+        if (!valid())
+            return;
+        in_flight.push_back({glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0), head});
+        ++frames;
+        // never more than FRAME_COUNT frames ahead of the gpu, even when they use little memory
+        while (in_flight.size() > FRAME_COUNT)
+            wait_oldest();
+    }
+
+  private:
+    struct frame_fence {
+        GLsync fence;
+        uint64_t end; // head position when the frame ended, everything before it is free once the fence signals
+    };
+
+    uint64_t head = 0, tail = 0;
+    std::deque<frame_fence> in_flight;
+
+    void wait_oldest() {
+        frame_fence &oldest = in_flight.front();
+        GLenum result = glClientWaitSync(oldest.fence, 0, 0);
+        if (result == GL_TIMEOUT_EXPIRED) {
+            ++stalls;
+            do
+                result = glClientWaitSync(oldest.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+            while (result == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(oldest.fence);
+        tail = oldest.end;
+        in_flight.pop_front();
+    }
+};
@@ -0,0 +1,275 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <numeric>
+#include <algorithm>
+
+#include "parallel.hh"
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#endif
+
+/**
+ * \brief out = a * b for column major matrices
+ * glm only vectorizes mat4 products with GLM_FORCE_INTRINSICS, which needs anonymous structs that
+ * --pedantic-errors rejects, so this is the same broadcast and accumulate kernel glm uses
+ * out may not alias a or b
+ */
+inline void mat4_mul(const glm::mat4 &a, const glm::mat4 &b, glm::mat4 &out) {
+#if defined(__AVX__)
+    // two columns of out per iteration, each half of a register works on one column
+    __m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&a[0][0]));
+    __m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&a[1][0]));
+    __m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&a[2][0]));
+    __m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128 *>(&a[3][0]));
+    for (int column = 0; column < 4; column += 2) {
+        __m256 b_columns = _mm256_loadu_ps(&b[column][0]);
+        __m256 m0 = _mm256_mul_ps(a0, _mm256_permute_ps(b_columns, _MM_SHUFFLE(0, 0, 0, 0)));
+        __m256 m1 = _mm256_mul_ps(a1, _mm256_permute_ps(b_columns, _MM_SHUFFLE(1, 1, 1, 1)));
+        __m256 m2 = _mm256_mul_ps(a2, _mm256_permute_ps(b_columns, _MM_SHUFFLE(2, 2, 2, 2)));
+        __m256 m3 = _mm256_mul_ps(a3, _mm256_permute_ps(b_columns, _MM_SHUFFLE(3, 3, 3, 3)));
+        _mm256_storeu_ps(&out[column][0], _mm256_add_ps(_mm256_add_ps(m0, m1), _mm256_add_ps(m2, m3)));
+    }
+#elif defined(__SSE__) || defined(_M_X64)
+    __m128 a0 = _mm_loadu_ps(&a[0][0]);
+    __m128 a1 = _mm_loadu_ps(&a[1][0]);
+    __m128 a2 = _mm_loadu_ps(&a[2][0]);
+    __m128 a3 = _mm_loadu_ps(&a[3][0]);
+    for (int column = 0; column < 4; ++column) {
+        __m128 b_column = _mm_loadu_ps(&b[column][0]);
+        __m128 m0 = _mm_mul_ps(a0, _mm_shuffle_ps(b_column, b_column, _MM_SHUFFLE(0, 0, 0, 0)));
+        __m128 m1 = _mm_mul_ps(a1, _mm_shuffle_ps(b_column, b_column, _MM_SHUFFLE(1, 1, 1, 1)));
+        __m128 m2 = _mm_mul_ps(a2, _mm_shuffle_ps(b_column, b_column, _MM_SHUFFLE(2, 2, 2, 2)));
+        __m128 m3 = _mm_mul_ps(a3, _mm_shuffle_ps(b_column, b_column, _MM_SHUFFLE(3, 3, 3, 3)));
+        _mm_storeu_ps(&out[column][0], _mm_add_ps(_mm_add_ps(m0, m1), _mm_add_ps(m2, m3)));
+    }
+#else
+    out = a * b;
+#endif
+}
+
+/**
+ * \brief Transform hierarchy stored as parallel arrays
+ * Nodes are kept in breadth first order, so every parent is stored before its children, the nodes of a depth
+ * are contiguous and so are the children of a node. World transforms are then updated in a single linear pass.
+ * When most nodes changed, the nodes of one depth only read the world transforms of the depth above, so each
+ * depth is split across the worker threads. When few changed, only they and the children of changed nodes are
+ * visited, so clean subtrees cost nothing.
+ * Nodes are referred to by handles, which stay valid when the arrays are reordered
+ */
+struct scene_graph {
+    static const unsigned NO_PARENT = -1;
+
+    // indexed by storage position, in breadth first order
+    std::vector<unsigned> parent; // storage position of the parent, or NO_PARENT
+    std::vector<unsigned> depth;
+    std::vector<glm::mat4> local;
+    std::vector<glm::mat4> world;
+    std::vector<uint8_t> local_dirty;   // local transform changed since the last update
+    std::vector<uint8_t> world_changed; // world transform was recomputed by the last update
+
+    std::vector<unsigned> handle_to_index;
+    std::vector<unsigned> index_to_handle;
+
+    unsigned add_node(unsigned parent_handle, const glm::mat4 &transform) {
+        unsigned parent_index = parent_handle == NO_PARENT ? NO_PARENT : handle_to_index.at(parent_handle);
+        unsigned node_depth = parent_handle == NO_PARENT ? 0 : depth[parent_index] + 1;
+        // appending keeps the order breadth first if the node goes after the children of the last parent
+        if (!depth.empty() &&
+            (node_depth < depth.back() || (node_depth == depth.back() && parent_index < parent.back())))
+            sorted = false;
+        level_start.clear();
+
+        unsigned handle = handle_to_index.size();
+        handle_to_index.push_back(parent.size());
+        index_to_handle.push_back(handle);
+        parent.push_back(parent_index);
+        depth.push_back(node_depth);
+        local.push_back(transform);
+        world.push_back(transform);
+        local_dirty.push_back(true);
+        world_changed.push_back(false);
+        dirty.push_back(handle);
+        return handle;
+    }
+
+    void set_local(unsigned handle, const glm::mat4 &transform) {
+        unsigned index = handle_to_index[handle];
+        local[index] = transform;
+        if (!local_dirty[index])
+            dirty.push_back(handle);
+        local_dirty[index] = true;
+    }
+
+    const glm::mat4 &get_local(unsigned handle) const { return local[handle_to_index[handle]]; }
+    const glm::mat4 &get_world(unsigned handle) const { return world[handle_to_index[handle]]; }
+    bool get_world_changed(unsigned handle) const { return world_changed[handle_to_index[handle]]; }
+
+    size_t size() const { return parent.size(); }
+
+    /**
+     * \brief Recompute the world transform of every node whose local transform, or that of an ancestor, changed
+     */
+    void update() {
+        // reset the flags of the last update first, while the nodes it listed are where it left them
+        if (changed_listed)
+            for (unsigned index : changed)
+                world_changed[index] = false;
+        else if (any_world_changed)
+            std::fill(world_changed.begin(), world_changed.end(), uint8_t(false));
+        changed.clear();
+        changed_listed = true;
+        any_world_changed = false;
+        if (dirty.empty())
+            return;
+
+        if (!sorted)
+            sort_breadth_first();
+        if (level_start.empty())
+            find_levels();
+        // walking every node is cheaper than gathering the changed ones when most of them are
+        if (dirty.size() * SPARSE_RATIO < size()) {
+            update_sparse();
+        } else {
+            for (size_t level = 0; level + 1 < level_start.size(); ++level)
+                parallel_for(level_start[level], level_start[level + 1], 4096,
+                             [&](size_t begin, size_t end) { update_range(begin, end); });
+            changed_listed = false;
+        }
+        dirty.clear();
+        any_world_changed = true;
+    }
+
+  private:
+    // below one dirty node in this many, update() only visits the changed nodes
+    static const size_t SPARSE_RATIO = 8;
+
+    bool sorted = true;
+    bool any_world_changed = false;    // world_changed has set flags
+    bool changed_listed = true;        // changed holds every node with world_changed set
+    std::vector<unsigned> dirty;       // handles of the nodes with local_dirty set
+    std::vector<unsigned> changed;     // storage positions the last sparse update recomputed
+    std::vector<size_t> level_start; // first storage position of every depth and one past the last node, or empty
+    std::vector<unsigned> first_child; // storage position of the first child of every node
+    std::vector<unsigned> child_count;
+    std::vector<uint64_t> pending;     // one bit per node, the nodes update_sparse() still has to visit
+
+    void update_range(size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            unsigned p = parent[i];
+            bool changed = local_dirty[i] || (p != NO_PARENT && world_changed[p]);
+            world_changed[i] = changed;
+            if (!changed)
+                continue;
+            local_dirty[i] = false;
+            if (p == NO_PARENT)
+                world[i] = local[i];
+            else
+                mat4_mul(world[p], local[i], world[i]);
+        }
+    }
+
+    // nodes to recompute are marked in a bitmap and visited in storage order, a node marks its children, which
+    // are stored after it, so one pass in order reaches every changed node after its parent
+    void update_sparse() {
+        pending.assign((size() + 63) / 64, 0);
+        for (unsigned handle : dirty) {
+            unsigned index = handle_to_index[handle];
+            pending[index / 64] |= uint64_t(1) << (index % 64);
+        }
+        for (size_t word = 0; word < pending.size(); ++word) {
+            while (pending[word] != 0) {
+                unsigned i = word * 64 + lowest_bit(pending[word]);
+                pending[word] &= pending[word] - 1;
+                unsigned p = parent[i];
+                if (p == NO_PARENT)
+                    world[i] = local[i];
+                else
+                    mat4_mul(world[p], local[i], world[i]);
+                local_dirty[i] = false;
+                world_changed[i] = true;
+                changed.push_back(i);
+                for (unsigned child = first_child[i]; child < first_child[i] + child_count[i]; ++child)
+                    pending[child / 64] |= uint64_t(1) << (child % 64);
+            }
+        }
+    }
+
+    static unsigned lowest_bit(uint64_t bits) {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward64(&index, bits);
+        return index;
+#else
+        return __builtin_ctzll(bits);
+#endif
+    }
+
+    void find_levels() {
+        first_child.assign(depth.size(), 0);
+        child_count.assign(depth.size(), 0);
+        for (size_t i = 0; i < depth.size(); ++i) {
+            if (i == 0 || depth[i] != depth[i - 1])
+                level_start.push_back(i);
+            if (parent[i] != NO_PARENT && child_count[parent[i]]++ == 0)
+                first_child[parent[i]] = i;
+        }
+        level_start.push_back(depth.size());
+    }
+
+    // reorders all arrays breadth first, keeps roots and siblings in insertion order
+    void sort_breadth_first() {
+        // children of every node, grouped by parent in storage order
+        std::vector<unsigned> children_start(parent.size() + 1, 0);
+        for (unsigned p : parent)
+            if (p != NO_PARENT)
+                ++children_start[p + 1];
+        std::partial_sum(children_start.begin(), children_start.end(), children_start.begin());
+        std::vector<unsigned> children(children_start.back());
+        std::vector<unsigned> next(children_start.begin(), children_start.end() - 1);
+        std::vector<unsigned> order;
+        order.reserve(parent.size());
+        for (unsigned i = 0; i < parent.size(); ++i) {
+            if (parent[i] == NO_PARENT)
+                order.push_back(i);
+            else
+                children[next[parent[i]]++] = i;
+        }
+        for (size_t k = 0; k < order.size(); ++k)
+            order.insert(order.end(), children.begin() + children_start[order[k]],
+                         children.begin() + children_start[order[k] + 1]);
+
+        std::vector<unsigned> new_index(order.size());
+        for (unsigned i = 0; i < order.size(); ++i)
+            new_index[order[i]] = i;
+
+        reorder(depth, order);
+        reorder(local, order);
+        reorder(world, order);
+        reorder(local_dirty, order);
+        reorder(world_changed, order);
+        reorder(index_to_handle, order);
+        reorder(parent, order);
+        for (unsigned &p : parent)
+            if (p != NO_PARENT)
+                p = new_index[p];
+        for (unsigned i = 0; i < index_to_handle.size(); ++i)
+            handle_to_index[index_to_handle[i]] = i;
+        level_start.clear();
+        sorted = true;
+    }
+
+    template <typename T> static void reorder(std::vector<T> &values, const std::vector<unsigned> &order) {
+        std::vector<T> reordered;
+        reordered.reserve(values.size());
+        for (unsigned i : order)
+            reordered.push_back(values[i]);
+        values.swap(reordered);
+    }
+};
@@ -0,0 +1,300 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdint>
+
+#include "telemetry.hh"
+
+/**
+ * \brief Compile a single shader stage
+ * \return the shader id, or 0 if compilation failed
+ */
+GLuint compile_shader(GLenum type, const char *source, const char *name) {
+    GLint success;
+    GLchar info[512];
+
+    GLuint shader_id = glCreateShader(type);
+    glShaderSource(shader_id, 1, &source, NULL);
+    glCompileShader(shader_id);
+    glGetShaderiv(shader_id, GL_COMPILE_STATUS, &success);
+    if (!success) {
+        glGetShaderInfoLog(shader_id, sizeof(info), NULL, info);
+        std::cout << "Failed to compile " << name << " shader: " << info << std::endl;
+        glDeleteShader(shader_id);
+        return 0;
+    }
+    return shader_id;
+}
+
+/**
+ * \brief Compile and link a vertex and fragment shader into a program
+ * \param retrievable hint that the linked binary will be read back with glGetProgramBinary
+ * \return the program id, or 0 if compiling or linking failed
+ */
+GLuint create_program(const char *vertex_source, const char *fragment_source, bool retrievable = false) {
+    GLint success;
+    GLchar info[512];
+
+    GLuint vertex_shader_id = compile_shader(GL_VERTEX_SHADER, vertex_source, "vertex");
+    if (vertex_shader_id == 0)
+        return 0;
+    GLuint fragment_shader_id = compile_shader(GL_FRAGMENT_SHADER, fragment_source, "fragment");
+    if (fragment_shader_id == 0) {
+        glDeleteShader(vertex_shader_id);
+        return 0;
+    }
+
+    GLuint program_id = glCreateProgram();
+    glAttachShader(program_id, vertex_shader_id);
+    glAttachShader(program_id, fragment_shader_id);
+    if (retrievable)
+        glProgramParameteri(program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    glLinkProgram(program_id);
+    glDeleteShader(fragment_shader_id);
+    glDeleteShader(vertex_shader_id);
+    glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program_id, sizeof(info), NULL, info);
+        std::cout << "Failed to link shader program: " << info << std::endl;
+        glDeleteProgram(program_id);
+        return 0;
+    }
+    return program_id;
+}
+
+/**
+ * \brief Linked programs saved to disk with glGetProgramBinary so later launches can skip compiling
+ * Binaries only work on the driver that made them, so each file is keyed by a hash of the sources and
+ * the driver's vendor, renderer and version strings. A binary the driver rejects, after an update the
+ * version string does not show for example, is compiled from source again and replaced
+ */
+struct program_cache {
+    std::string prefix; // cache files are named prefix + key + ".bin"
+    bool enabled = false;
+
+    /**
+     * \return false if the driver cannot save program binaries, programs are then always compiled
+     */
+    bool init(const std::string &file_prefix) {
+        prefix = file_prefix;
+        GLint format_count = 0;
+        if (GLAD_GL_VERSION_4_1 && glGetProgramBinary != nullptr)
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+        if (format_count == 0) {
+            std::cout << "driver cannot save program binaries, compiling shaders on every launch" << std::endl;
+            return false;
+        }
+        const char *strings[] = {reinterpret_cast<const char *>(glGetString(GL_VENDOR)),
+                                 reinterpret_cast<const char *>(glGetString(GL_RENDERER)),
+                                 reinterpret_cast<const char *>(glGetString(GL_VERSION))};
+        for (const char *string : strings) {
+            driver += string != nullptr ? string : "";
+            driver += '\n';
+        }
+        enabled = true;
+        return true;
+    }
+
+    /**
+     * \brief Load the program from the cache, or compile it and save it there
+     * \param name used in the timing report
+     * \return the program id, or 0 if compiling or linking failed
+     */
+    GLuint create_program(const char *vertex_source, const char *fragment_source, const char *name) {
+        auto start = std::chrono::steady_clock::now();
+        auto elapsed_ms = [&] {
+            return std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+        };
+        if (!enabled) {
+            GLuint program_id = ::create_program(vertex_source, fragment_source);
+            std::cout << "program " << name << ": compiled in " << elapsed_ms() << " ms" << std::endl;
+            return program_id;
+        }
+
+        uint64_t key = hash(vertex_source, fragment_source);
+        std::ostringstream path;
+        path << prefix << std::hex << std::setw(16) << std::setfill('0') << key << ".bin";
+
+        float compile_ms;
+        GLuint program_id = load(path.str(), key, compile_ms);
+        if (program_id != 0) {
+            std::cout << "program " << name << ": loaded from cache in " << elapsed_ms() << " ms, compiling took "
+                      << compile_ms << " ms" << std::endl;
+            return program_id;
+        }
+
+        start = std::chrono::steady_clock::now();
+        program_id = ::create_program(vertex_source, fragment_source, true);
+        if (program_id == 0)
+            return 0;
+        compile_ms = elapsed_ms();
+        std::cout << "program " << name << ": compiled in " << compile_ms << " ms" << std::endl;
+        save(path.str(), key, program_id, compile_ms);
+        return program_id;
+    }
+
+  private:
+    static const uint32_t MAGIC = 0x31475250; // "PRG1"
+
+    std::string driver;
+
+    uint64_t hash(const char *vertex_source, const char *fragment_source) const {
+        // FNV-1a over the driver strings and both sources, including their terminators to keep them apart
+        uint64_t hash = 14695981039346656037ull;
+        auto add = [&](const char *bytes, size_t size) {
+            for (size_t i = 0; i < size; ++i)
+                hash = (hash ^ uint8_t(bytes[i])) * 1099511628211ull;
+        };
+        add(driver.c_str(), driver.size() + 1);
+        add(vertex_source, std::char_traits<char>::length(vertex_source) + 1);
+        add(fragment_source, std::char_traits<char>::length(fragment_source) + 1);
+        return hash;
+    }
+
+    /**
+     * \return the program id, or 0 if there is no usable binary for this key
+     */
+    GLuint load(const std::string &path, uint64_t key, float &compile_ms) const {
+        std::ifstream file(path, std::ios::binary);
+        if (!file.is_open())
+            return 0;
+        uint32_t header[3]; // magic, binary format, binary length
+        uint64_t file_key;
+        file.read(reinterpret_cast<char *>(header), sizeof(header));
+        file.read(reinterpret_cast<char *>(&file_key), sizeof(file_key));
+        file.read(reinterpret_cast<char *>(&compile_ms), sizeof(compile_ms));
+        if (!file || header[0] != MAGIC || file_key != key)
+            return 0;
+        std::vector<char> binary(header[2]);
+        file.read(binary.data(), binary.size());
+        if (!file)
+            return 0;
+
+        GLuint program_id = glCreateProgram();
+        glProgramBinary(program_id, header[1], binary.data(), binary.size());
+        GLint success;
+        glGetProgramiv(program_id, GL_LINK_STATUS, &success);
+        if (!success) {
+            std::cout << "driver rejected cached program " << path << ", compiling it again" << std::endl;
+            glDeleteProgram(program_id);
+            return 0;
+        }
+        return program_id;
+    }
+
+    void save(const std::string &path, uint64_t key, GLuint program_id, float compile_ms) const {
+        GLint length = 0;
+        glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> binary(length);
+        GLenum format;
+        glGetProgramBinary(program_id, length, &length, &format, binary.data());
+
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open()) {
+            std::cout << "Failed to open file: " << path << std::endl;
+            return;
+        }
+        uint32_t header[] = {MAGIC, format, uint32_t(length)};
+        file.write(reinterpret_cast<const char *>(header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(&key), sizeof(key));
+        file.write(reinterpret_cast<const char *>(&compile_ms), sizeof(compile_ms));
+        file.write(binary.data(), length);
+    }
+};
+
+/**
+ * \brief A program per variant of a fragment shader with feature flags, indexed by the mask of its features
+ * See compile_shaders.py for how the variants are generated
+ */
+struct program_variants {
+    std::vector<GLuint> programs;
+    // location of every uniform outside of blocks by name, per variant, looked up once in create()
+    std::vector<std::map<std::string, GLint, std::less<>>> uniform_locations;
+
+    // program currently in use, shared by all variant sets to skip redundant switches
+    static inline GLuint bound_program_id = 0;
+
+    /**
+     * \return false if any variant failed to compile or link
+     */
+    bool create(program_cache &cache, const char *vertex_source, const char *const *fragment_variants,
+                unsigned variant_count, const std::string &name) {
+        for (unsigned features = 0; features < variant_count; ++features) {
+            std::string variant_name = name + " variant " + std::to_string(features);
+            GLuint program_id = cache.create_program(vertex_source, fragment_variants[features], variant_name.c_str());
+            if (program_id == 0)
+                return false;
+            programs.push_back(program_id);
+            uniform_locations.push_back(find_uniforms(program_id));
+        }
+        return true;
+    }
+
+    GLuint operator[](unsigned features) const { return programs.at(features); }
+
+    /**
+     * \brief Switch to the variant with the given features, if it is not in use already
+     */
+    void use(unsigned features) const {
+        GLuint program_id = programs.at(features);
+        if (bound_program_id != program_id) {
+            glUseProgram(program_id);
+            bound_program_id = program_id;
+            ++render_count().state_changes;
+        }
+    }
+
+    /**
+     * \brief Set a uniform by name in every variant that has it
+     * Writes to the programs directly, so it does not change which program is in use
+     */
+    void set_uniform(const char *name, const glm::mat4 &value) const {
+        for (unsigned features = 0; features < programs.size(); ++features) {
+            auto uniform = uniform_locations[features].find(name);
+            if (uniform != uniform_locations[features].end())
+                glProgramUniformMatrix4fv(programs[features], uniform->second, 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    void set_uniform(const char *name, GLint value) const {
+        for (unsigned features = 0; features < programs.size(); ++features) {
+            auto uniform = uniform_locations[features].find(name);
+            if (uniform != uniform_locations[features].end())
+                glProgramUniform1i(programs[features], uniform->second, value);
+        }
+    }
+
+  private:
+    static std::map<std::string, GLint, std::less<>> find_uniforms(GLuint program_id) {
+        std::map<std::string, GLint, std::less<>> locations;
+        GLint uniform_count = 0, max_length = 0;
+        glGetProgramiv(program_id, GL_ACTIVE_UNIFORMS, &uniform_count);
+        glGetProgramiv(program_id, GL_ACTIVE_UNIFORM_MAX_LENGTH, &max_length);
+        std::vector<GLchar> name(std::max(max_length, 1));
+        for (GLint i = 0; i < uniform_count; ++i) {
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(program_id, i, name.size(), NULL, &size, &type, name.data());
+            // members of uniform blocks have no location
+            GLint location = glGetUniformLocation(program_id, name.data());
+            if (location >= 0)
+                locations[name.data()] = location;
+        }
+        return locations;
+    }
+};
@@ -1,9 +1,19 @@
-// .\shaders\fragment.glsl
-const char *fragment_glsl =
+// ./shaders/fragment.glsl, variants indexed by a mask of its features
+enum fragment_glsl_features {
+    FRAGMENT_GLSL_TEXTURED = 1 << 0,
+    FRAGMENT_GLSL_ALPHA_TEST = 1 << 1,
+    FRAGMENT_GLSL_VARIANT_COUNT = 4
+};
+const char *fragment_glsl_variants[] = {
+// no features
 "#version 430 core\n"
+"// features: TEXTURED ALPHA_TEST\n"
 "\n"
 "in vec3 normal;\n"
 "in vec2 tex_coord;\n"
+"in vec3 world_position;\n"
+"in float view_depth;\n"
+"in float occlusion;\n"
 "\n"
 "out vec4 frag_color;\n"
 "\n"
@@ -18,44 +28,615 @@ const char *fragment_glsl =
 "\n"
 "uniform sampler2D texture_diffuse;\n"
 "\n"
+"// point and spot lights, a spot light has spot_cos above -1\n"
+"struct light {\n"
+"    vec3 position;\n"
+"    float radius;\n"
+"    vec3 color;\n"
+"    float spot_cos;\n"
+"    vec3 direction;\n"
+"    float spot_blend;\n"
+"};\n"
+"layout(std430, binding = 0) readonly buffer light_list {\n"
+"    light lights[];\n"
+"};\n"
+"\n"
+"// lights binned into view space clusters on the cpu, see clusters.hh\n"
+"layout(std430, binding = 1) readonly buffer cluster_grid {\n"
+"    uvec4 grid_size;          // clusters along x, y and z\n"
+"    vec4 grid_scale;          // tiles per pixel along x and y, then slice = log(view_depth) * z - w\n"
+"    uvec2 cluster_ranges[];   // first index and index count of each cluster's lights\n"
+"};\n"
+"layout(std430, binding = 2) readonly buffer cluster_light_indices {\n"
+"    uint light_indices[];\n"
+"};\n"
+"\n"
+"// cascaded sun shadows, see shadows.hh\n"
+"layout(std140, binding = 0) uniform shadow_data {\n"
+"    mat4 shadow_matrices[3]; // world to shadow map texture coordinates and depth\n"
+"    vec4 shadow_splits;      // view depth where each cascade ends\n"
+"    vec4 sun_direction;      // toward the sun, w is 1 when dynamic casters were drawn\n"
+"};\n"
+"uniform sampler2DArrayShadow shadow_static_map;\n"
+"uniform sampler2DArrayShadow shadow_dynamic_map;\n"
+"\n"
+"float sun_visibility() {\n"
+"    if (view_depth >= shadow_splits.z)\n"
+"        return 1.0f;\n"
+"    int cascade = view_depth < shadow_splits.x ? 0 : view_depth < shadow_splits.y ? 1 : 2;\n"
+"    vec4 position = shadow_matrices[cascade] * vec4(world_position, 1.0f);\n"
+"    vec4 coord = vec4(position.xy, float(cascade), position.z);\n"
+"    // static and dynamic casters are kept in separate maps, whichever is nearer shadows\n"
+"    float visibility = texture(shadow_static_map, coord);\n"
+"    if (sun_direction.w > 0.5f)\n"
+"        visibility = min(visibility, texture(shadow_dynamic_map, coord));\n"
+"    return visibility;\n"
+"}\n"
+"\n"
+"vec3 cluster_lighting() {\n"
+"    uvec2 tile = min(uvec2(gl_FragCoord.xy * grid_scale.xy), grid_size.xy - 1u);\n"
+"    uint slice = uint(clamp(log(view_depth) * grid_scale.z - grid_scale.w, 0.0f, float(grid_size.z - 1u)));\n"
+"    uvec2 range = cluster_ranges[tile.x + grid_size.x * (tile.y + grid_size.y * slice)];\n"
+"\n"
+"    vec3 lighting = vec3(0.0f);\n"
+"    for (uint i = range.x; i < range.x + range.y; ++i) {\n"
+"        light l = lights[light_indices[i]];\n"
+"        vec3 to_light = l.position - world_position;\n"
+"        float light_distance = length(to_light);\n"
+"        vec3 light_dir = to_light / max(light_distance, 1e-4f);\n"
+"        float falloff = clamp(1.0f - (light_distance * light_distance) / (l.radius * l.radius), 0.0f, 1.0f);\n"
+"        float cone = 1.0f;\n"
+"        if (l.spot_cos > -1.0f)\n"
+"            cone = smoothstep(l.spot_cos, l.spot_cos + l.spot_blend, dot(-light_dir, l.direction));\n"
+"        lighting += max(dot(normal, light_dir), 0.0f) * falloff * falloff * cone * l.color;\n"
+"    }\n"
+"    return lighting;\n"
+"}\n"
+"\n"
 "void main() {\n"
 "\n"
 "    float global_ambient_intensity = 0.5f;\n"
 "    vec3 global_ambient_color = global_ambient_intensity * vec3(0.86, 0.94, 1);\n"
-"    vec3 ambient = global_ambient_color * color_ambient;\n"
+"    vec3 ambient = global_ambient_color * color_ambient * occlusion;\n"
 "\n"
 "    float global_sun_intensity = 1.3f;\n"
 "    vec3 global_sun_color = global_sun_intensity * vec3(1, 0.98, 0.95);\n"
-"    vec3 global_sun_dir = normalize(vec3(1.0f, -1.0f, 1.0f));\n"
-"    float sun_angle = max(dot(normal, global_sun_dir), 0.0f);\n"
+"    float sun_angle = max(dot(normal, sun_direction.xyz), 0.0f) * sun_visibility();\n"
 "    vec3 diffuse = sun_angle * global_sun_color * color_diffuse;\n"
 "\n"
-"    vec3 flat_color = diffuse + ambient;\n"
+"    vec3 flat_color = diffuse + ambient + cluster_lighting() * color_diffuse;\n"
 "\n"
+"#ifdef TEXTURED\n"
 "    vec4 tex_color = texture(texture_diffuse, tex_coord);\n"
+"#ifdef ALPHA_TEST\n"
+"    // only materials with see-through texels discard, so the rest keep early depth testing\n"
 "    if(tex_color.a == 0.0f)\n"
 "        discard;\n"
+"#endif\n"
+"#else\n"
+"    vec4 tex_color = vec4(1.0f);\n"
+"#endif\n"
 "\n"
 "    frag_color = vec4(flat_color, 1 - material_transparency) * tex_color;\n"
 "}\n"
-"\0";
-// .\shaders\vertex.glsl
-const char *vertex_glsl =
+"\0",
+// TEXTURED
+"#version 430 core\n"
+"#define TEXTURED\n"
+"// features: TEXTURED ALPHA_TEST\n"
+"\n"
+"in vec3 normal;\n"
+"in vec2 tex_coord;\n"
+"in vec3 world_position;\n"
+"in float view_depth;\n"
+"in float occlusion;\n"
+"\n"
+"out vec4 frag_color;\n"
+"\n"
+"layout(location = 0) uniform vec3 color_diffuse;\n"
+"layout(location = 1) uniform vec3 color_ambient;\n"
+"layout(location = 2) uniform vec3 color_specular;\n"
+"layout(location = 3) uniform vec3 color_emissive;\n"
+"\n"
+"layout(location = 4) uniform float material_transparency;\n"
+"layout(location = 5) uniform float material_refraction;\n"
+"layout(location = 6) uniform float material_specular_exp;\n"
+"\n"
+"uniform sampler2D texture_diffuse;\n"
+"\n"
+"// point and spot lights, a spot light has spot_cos above -1\n"
+"struct light {\n"
+"    vec3 position;\n"
+"    float radius;\n"
+"    vec3 color;\n"
+"    float spot_cos;\n"
+"    vec3 direction;\n"
+"    float spot_blend;\n"
+"};\n"
+"layout(std430, binding = 0) readonly buffer light_list {\n"
+"    light lights[];\n"
+"};\n"
+"\n"
+"// lights binned into view space clusters on the cpu, see clusters.hh\n"
+"layout(std430, binding = 1) readonly buffer cluster_grid {\n"
+"    uvec4 grid_size;          // clusters along x, y and z\n"
+"    vec4 grid_scale;          // tiles per pixel along x and y, then slice = log(view_depth) * z - w\n"
+"    uvec2 cluster_ranges[];   // first index and index count of each cluster's lights\n"
+"};\n"
+"layout(std430, binding = 2) readonly buffer cluster_light_indices {\n"
+"    uint light_indices[];\n"
+"};\n"
+"\n"
+"// cascaded sun shadows, see shadows.hh\n"
+"layout(std140, binding = 0) uniform shadow_data {\n"
+"    mat4 shadow_matrices[3]; // world to shadow map texture coordinates and depth\n"
+"    vec4 shadow_splits;      // view depth where each cascade ends\n"
+"    vec4 sun_direction;      // toward the sun, w is 1 when dynamic casters were drawn\n"
+"};\n"
+"uniform sampler2DArrayShadow shadow_static_map;\n"
+"uniform sampler2DArrayShadow shadow_dynamic_map;\n"
+"\n"
+"float sun_visibility() {\n"
+"    if (view_depth >= shadow_splits.z)\n"
+"        return 1.0f;\n"
+"    int cascade = view_depth < shadow_splits.x ? 0 : view_depth < shadow_splits.y ? 1 : 2;\n"
+"    vec4 position = shadow_matrices[cascade] * vec4(world_position, 1.0f);\n"
+"    vec4 coord = vec4(position.xy, float(cascade), position.z);\n"
+"    // static and dynamic casters are kept in separate maps, whichever is nearer shadows\n"
+"    float visibility = texture(shadow_static_map, coord);\n"
+"    if (sun_direction.w > 0.5f)\n"
+"        visibility = min(visibility, texture(shadow_dynamic_map, coord));\n"
+"    return visibility;\n"
+"}\n"
+"\n"
+"vec3 cluster_lighting() {\n"
+"    uvec2 tile = min(uvec2(gl_FragCoord.xy * grid_scale.xy), grid_size.xy - 1u);\n"
+"    uint slice = uint(clamp(log(view_depth) * grid_scale.z - grid_scale.w, 0.0f, float(grid_size.z - 1u)));\n"
+"    uvec2 range = cluster_ranges[tile.x + grid_size.x * (tile.y + grid_size.y * slice)];\n"
+"\n"
+"    vec3 lighting = vec3(0.0f);\n"
+"    for (uint i = range.x; i < range.x + range.y; ++i) {\n"
+"        light l = lights[light_indices[i]];\n"
+"        vec3 to_light = l.position - world_position;\n"
+"        float light_distance = length(to_light);\n"
+"        vec3 light_dir = to_light / max(light_distance, 1e-4f);\n"
+"        float falloff = clamp(1.0f - (light_distance * light_distance) / (l.radius * l.radius), 0.0f, 1.0f);\n"
+"        float cone = 1.0f;\n"
+"        if (l.spot_cos > -1.0f)\n"
+"            cone = smoothstep(l.spot_cos, l.spot_cos + l.spot_blend, dot(-light_dir, l.direction));\n"
+"        lighting += max(dot(normal, light_dir), 0.0f) * falloff * falloff * cone * l.color;\n"
+"    }\n"
+"    return lighting;\n"
+"}\n"
+"\n"
+"void main() {\n"
+"\n"
+"    float global_ambient_intensity = 0.5f;\n"
+"    vec3 global_ambient_color = global_ambient_intensity * vec3(0.86, 0.94, 1);\n"
+"    vec3 ambient = global_ambient_color * color_ambient * occlusion;\n"
+"\n"
+"    float global_sun_intensity = 1.3f;\n"
+"    vec3 global_sun_color = global_sun_intensity * vec3(1, 0.98, 0.95);\n"
+"    float sun_angle = max(dot(normal, sun_direction.xyz), 0.0f) * sun_visibility();\n"
+"    vec3 diffuse = sun_angle * global_sun_color * color_diffuse;\n"
+"\n"
+"    vec3 flat_color = diffuse + ambient + cluster_lighting() * color_diffuse;\n"
+"\n"
+"#ifdef TEXTURED\n"
+"    vec4 tex_color = texture(texture_diffuse, tex_coord);\n"
+"#ifdef ALPHA_TEST\n"
+"    // only materials with see-through texels discard, so the rest keep early depth testing\n"
+"    if(tex_color.a == 0.0f)\n"
+"        discard;\n"
+"#endif\n"
+"#else\n"
+"    vec4 tex_color = vec4(1.0f);\n"
+"#endif\n"
+"\n"
+"    frag_color = vec4(flat_color, 1 - material_transparency) * tex_color;\n"
+"}\n"
+"\0",
+// ALPHA_TEST
+"#version 430 core\n"
+"#define ALPHA_TEST\n"
+"// features: TEXTURED ALPHA_TEST\n"
+"\n"
+"in vec3 normal;\n"
+"in vec2 tex_coord;\n"
+"in vec3 world_position;\n"
+"in float view_depth;\n"
+"in float occlusion;\n"
+"\n"
+"out vec4 frag_color;\n"
+"\n"
+"layout(location = 0) uniform vec3 color_diffuse;\n"
+"layout(location = 1) uniform vec3 color_ambient;\n"
+"layout(location = 2) uniform vec3 color_specular;\n"
+"layout(location = 3) uniform vec3 color_emissive;\n"
+"\n"
+"layout(location = 4) uniform float material_transparency;\n"
+"layout(location = 5) uniform float material_refraction;\n"
+"layout(location = 6) uniform float material_specular_exp;\n"
+"\n"
+"uniform sampler2D texture_diffuse;\n"
+"\n"
+"// point and spot lights, a spot light has spot_cos above -1\n"
+"struct light {\n"
+"    vec3 position;\n"
+"    float radius;\n"
+"    vec3 color;\n"
+"    float spot_cos;\n"
+"    vec3 direction;\n"
+"    float spot_blend;\n"
+"};\n"
+"layout(std430, binding = 0) readonly buffer light_list {\n"
+"    light lights[];\n"
+"};\n"
+"\n"
+"// lights binned into view space clusters on the cpu, see clusters.hh\n"
+"layout(std430, binding = 1) readonly buffer cluster_grid {\n"
+"    uvec4 grid_size;          // clusters along x, y and z\n"
+"    vec4 grid_scale;          // tiles per pixel along x and y, then slice = log(view_depth) * z - w\n"
+"    uvec2 cluster_ranges[];   // first index and index count of each cluster's lights\n"
+"};\n"
+"layout(std430, binding = 2) readonly buffer cluster_light_indices {\n"
+"    uint light_indices[];\n"
+"};\n"
+"\n"
+"// cascaded sun shadows, see shadows.hh\n"
+"layout(std140, binding = 0) uniform shadow_data {\n"
+"    mat4 shadow_matrices[3]; // world to shadow map texture coordinates and depth\n"
+"    vec4 shadow_splits;      // view depth where each cascade ends\n"
+"    vec4 sun_direction;      // toward the sun, w is 1 when dynamic casters were drawn\n"
+"};\n"
+"uniform sampler2DArrayShadow shadow_static_map;\n"
+"uniform sampler2DArrayShadow shadow_dynamic_map;\n"
+"\n"
+"float sun_visibility() {\n"
+"    if (view_depth >= shadow_splits.z)\n"
+"        return 1.0f;\n"
+"    int cascade = view_depth < shadow_splits.x ? 0 : view_depth < shadow_splits.y ? 1 : 2;\n"
+"    vec4 position = shadow_matrices[cascade] * vec4(world_position, 1.0f);\n"
+"    vec4 coord = vec4(position.xy, float(cascade), position.z);\n"
+"    // static and dynamic casters are kept in separate maps, whichever is nearer shadows\n"
+"    float visibility = texture(shadow_static_map, coord);\n"
+"    if (sun_direction.w > 0.5f)\n"
+"        visibility = min(visibility, texture(shadow_dynamic_map, coord));\n"
+"    return visibility;\n"
+"}\n"
+"\n"
+"vec3 cluster_lighting() {\n"
+"    uvec2 tile = min(uvec2(gl_FragCoord.xy * grid_scale.xy), grid_size.xy - 1u);\n"
+"    uint slice = uint(clamp(log(view_depth) * grid_scale.z - grid_scale.w, 0.0f, float(grid_size.z - 1u)));\n"
+"    uvec2 range = cluster_ranges[tile.x + grid_size.x * (tile.y + grid_size.y * slice)];\n"
+"\n"
+"    vec3 lighting = vec3(0.0f);\n"
+"    for (uint i = range.x; i < range.x + range.y; ++i) {\n"
+"        light l = lights[light_indices[i]];\n"
+"        vec3 to_light = l.position - world_position;\n"
+"        float light_distance = length(to_light);\n"
+"        vec3 light_dir = to_light / max(light_distance, 1e-4f);\n"
+"        float falloff = clamp(1.0f - (light_distance * light_distance) / (l.radius * l.radius), 0.0f, 1.0f);\n"
+"        float cone = 1.0f;\n"
+"        if (l.spot_cos > -1.0f)\n"
+"            cone = smoothstep(l.spot_cos, l.spot_cos + l.spot_blend, dot(-light_dir, l.direction));\n"
+"        lighting += max(dot(normal, light_dir), 0.0f) * falloff * falloff * cone * l.color;\n"
+"    }\n"
+"    return lighting;\n"
+"}\n"
+"\n"
+"void main() {\n"
+"\n"
+"    float global_ambient_intensity = 0.5f;\n"
+"    vec3 global_ambient_color = global_ambient_intensity * vec3(0.86, 0.94, 1);\n"
+"    vec3 ambient = global_ambient_color * color_ambient * occlusion;\n"
+"\n"
+"    float global_sun_intensity = 1.3f;\n"
+"    vec3 global_sun_color = global_sun_intensity * vec3(1, 0.98, 0.95);\n"
+"    float sun_angle = max(dot(normal, sun_direction.xyz), 0.0f) * sun_visibility();\n"
+"    vec3 diffuse = sun_angle * global_sun_color * color_diffuse;\n"
+"\n"
+"    vec3 flat_color = diffuse + ambient + cluster_lighting() * color_diffuse;\n"
+"\n"
+"#ifdef TEXTURED\n"
+"    vec4 tex_color = texture(texture_diffuse, tex_coord);\n"
+"#ifdef ALPHA_TEST\n"
+"    // only materials with see-through texels discard, so the rest keep early depth testing\n"
+"    if(tex_color.a == 0.0f)\n"
+"        discard;\n"
+"#endif\n"
+"#else\n"
+"    vec4 tex_color = vec4(1.0f);\n"
+"#endif\n"
+"\n"
+"    frag_color = vec4(flat_color, 1 - material_transparency) * tex_color;\n"
+"}\n"
+"\0",
+// TEXTURED ALPHA_TEST
+"#version 430 core\n"
+"#define TEXTURED\n"
+"#define ALPHA_TEST\n"
+"// features: TEXTURED ALPHA_TEST\n"
+"\n"
+"in vec3 normal;\n"
+"in vec2 tex_coord;\n"
+"in vec3 world_position;\n"
+"in float view_depth;\n"
+"in float occlusion;\n"
+"\n"
+"out vec4 frag_color;\n"
+"\n"
+"layout(location = 0) uniform vec3 color_diffuse;\n"
+"layout(location = 1) uniform vec3 color_ambient;\n"
+"layout(location = 2) uniform vec3 color_specular;\n"
+"layout(location = 3) uniform vec3 color_emissive;\n"
+"\n"
+"layout(location = 4) uniform float material_transparency;\n"
+"layout(location = 5) uniform float material_refraction;\n"
+"layout(location = 6) uniform float material_specular_exp;\n"
+"\n"
+"uniform sampler2D texture_diffuse;\n"
+"\n"
+"// point and spot lights, a spot light has spot_cos above -1\n"
+"struct light {\n"
+"    vec3 position;\n"
+"    float radius;\n"
+"    vec3 color;\n"
+"    float spot_cos;\n"
+"    vec3 direction;\n"
+"    float spot_blend;\n"
+"};\n"
+"layout(std430, binding = 0) readonly buffer light_list {\n"
+"    light lights[];\n"
+"};\n"
+"\n"
+"// lights binned into view space clusters on the cpu, see clusters.hh\n"
+"layout(std430, binding = 1) readonly buffer cluster_grid {\n"
+"    uvec4 grid_size;          // clusters along x, y and z\n"
+"    vec4 grid_scale;          // tiles per pixel along x and y, then slice = log(view_depth) * z - w\n"
+"    uvec2 cluster_ranges[];   // first index and index count of each cluster's lights\n"
+"};\n"
+"layout(std430, binding = 2) readonly buffer cluster_light_indices {\n"
+"    uint light_indices[];\n"
+"};\n"
+"\n"
+"// cascaded sun shadows, see shadows.hh\n"
+"layout(std140, binding = 0) uniform shadow_data {\n"
+"    mat4 shadow_matrices[3]; // world to shadow map texture coordinates and depth\n"
+"    vec4 shadow_splits;      // view depth where each cascade ends\n"
+"    vec4 sun_direction;      // toward the sun, w is 1 when dynamic casters were drawn\n"
+"};\n"
+"uniform sampler2DArrayShadow shadow_static_map;\n"
+"uniform sampler2DArrayShadow shadow_dynamic_map;\n"
+"\n"
+"float sun_visibility() {\n"
+"    if (view_depth >= shadow_splits.z)\n"
+"        return 1.0f;\n"
+"    int cascade = view_depth < shadow_splits.x ? 0 : view_depth < shadow_splits.y ? 1 : 2;\n"
+"    vec4 position = shadow_matrices[cascade] * vec4(world_position, 1.0f);\n"
+"    vec4 coord = vec4(position.xy, float(cascade), position.z);\n"
+"    // static and dynamic casters are kept in separate maps, whichever is nearer shadows\n"
+"    float visibility = texture(shadow_static_map, coord);\n"
+"    if (sun_direction.w > 0.5f)\n"
+"        visibility = min(visibility, texture(shadow_dynamic_map, coord));\n"
+"    return visibility;\n"
+"}\n"
+"\n"
+"vec3 cluster_lighting() {\n"
+"    uvec2 tile = min(uvec2(gl_FragCoord.xy * grid_scale.xy), grid_size.xy - 1u);\n"
+"    uint slice = uint(clamp(log(view_depth) * grid_scale.z - grid_scale.w, 0.0f, float(grid_size.z - 1u)));\n"
+"    uvec2 range = cluster_ranges[tile.x + grid_size.x * (tile.y + grid_size.y * slice)];\n"
+"\n"
+"    vec3 lighting = vec3(0.0f);\n"
+"    for (uint i = range.x; i < range.x + range.y; ++i) {\n"
+"        light l = lights[light_indices[i]];\n"
+"        vec3 to_light = l.position - world_position;\n"
+"        float light_distance = length(to_light);\n"
+"        vec3 light_dir = to_light / max(light_distance, 1e-4f);\n"
+"        float falloff = clamp(1.0f - (light_distance * light_distance) / (l.radius * l.radius), 0.0f, 1.0f);\n"
+"        float cone = 1.0f;\n"
+"        if (l.spot_cos > -1.0f)\n"
+"            cone = smoothstep(l.spot_cos, l.spot_cos + l.spot_blend, dot(-light_dir, l.direction));\n"
+"        lighting += max(dot(normal, light_dir), 0.0f) * falloff * falloff * cone * l.color;\n"
+"    }\n"
+"    return lighting;\n"
+"}\n"
+"\n"
+"void main() {\n"
+"\n"
+"    float global_ambient_intensity = 0.5f;\n"
+"    vec3 global_ambient_color = global_ambient_intensity * vec3(0.86, 0.94, 1);\n"
+"    vec3 ambient = global_ambient_color * color_ambient * occlusion;\n"
+"\n"
+"    float global_sun_intensity = 1.3f;\n"
+"    vec3 global_sun_color = global_sun_intensity * vec3(1, 0.98, 0.95);\n"
+"    float sun_angle = max(dot(normal, sun_direction.xyz), 0.0f) * sun_visibility();\n"
+"    vec3 diffuse = sun_angle * global_sun_color * color_diffuse;\n"
+"\n"
+"    vec3 flat_color = diffuse + ambient + cluster_lighting() * color_diffuse;\n"
+"\n"
+"#ifdef TEXTURED\n"
+"    vec4 tex_color = texture(texture_diffuse, tex_coord);\n"
+"#ifdef ALPHA_TEST\n"
+"    // only materials with see-through texels discard, so the rest keep early depth testing\n"
+"    if(tex_color.a == 0.0f)\n"
+"        discard;\n"
+"#endif\n"
+"#else\n"
+"    vec4 tex_color = vec4(1.0f);\n"
+"#endif\n"
+"\n"
+"    frag_color = vec4(flat_color, 1 - material_transparency) * tex_color;\n"
+"}\n"
+"\0",
+};
+// ./shaders/fragment_depth.glsl, variants indexed by a mask of its features
+enum fragment_depth_glsl_features {
+    FRAGMENT_DEPTH_GLSL_ALPHA_TEST = 1 << 0,
+    FRAGMENT_DEPTH_GLSL_VARIANT_COUNT = 2
+};
+const char *fragment_depth_glsl_variants[] = {
+// no features
 "#version 330 core\n"
+"// features: ALPHA_TEST\n"
+"\n"
+"#ifdef ALPHA_TEST\n"
+"in vec2 tex_coord;\n"
+"\n"
+"uniform sampler2D texture_diffuse;\n"
+"#endif\n"
+"\n"
+"// the depth pre-pass and the shadow maps write no color, only depth\n"
+"void main() {\n"
+"#ifdef ALPHA_TEST\n"
+"    // see-through texels of cutout materials cast no shadow\n"
+"    if (texture(texture_diffuse, tex_coord).a == 0.0f)\n"
+"        discard;\n"
+"#endif\n"
+"}\n"
+"\0",
+// ALPHA_TEST
+"#version 330 core\n"
+"#define ALPHA_TEST\n"
+"// features: ALPHA_TEST\n"
+"\n"
+"#ifdef ALPHA_TEST\n"
+"in vec2 tex_coord;\n"
+"\n"
+"uniform sampler2D texture_diffuse;\n"
+"#endif\n"
+"\n"
+"// the depth pre-pass and the shadow maps write no color, only depth\n"
+"void main() {\n"
+"#ifdef ALPHA_TEST\n"
+"    // see-through texels of cutout materials cast no shadow\n"
+"    if (texture(texture_diffuse, tex_coord).a == 0.0f)\n"
+"        discard;\n"
+"#endif\n"
+"}\n"
+"\0",
+};
+// ./shaders/vertex.glsl
+const char *vertex_glsl =
+"#version 430 core\n"
 "layout(location = 0) in vec3 attr_position;\n"
 "layout(location = 1) in vec3 attr_normal;\n"
 "layout(location = 2) in vec2 attr_tex_coord;\n"
+"layout(location = 7) in float attr_occlusion; // baked ambient occlusion, see ao.hh\n"
 "\n"
 "out vec3 normal;\n"
 "out vec2 tex_coord;\n"
+"out vec3 world_position;\n"
+"out float view_depth; // distance in front of the camera, picks the light cluster\n"
+"out float occlusion;\n"
+"invariant gl_Position; // the depth pre-pass in vertex_depth.glsl has to produce the same depth\n"
 "\n"
-"uniform mat4 model;\n"
-"uniform mat4 view;\n"
-"uniform mat4 projection;\n"
+"// per frame constants, see frame_uniforms.hh\n"
+"layout(std140, binding = 1) uniform frame_data {\n"
+"    mat4 model;\n"
+"    mat4 view;\n"
+"    mat4 projection;\n"
+"    mat4 normal_matrix;\n"
+"};\n"
 "\n"
 "void main() {\n"
 "    gl_Position = projection * view * model * vec4(attr_position, 1.0);\n"
 "    tex_coord = attr_tex_coord;\n"
-"    normal = normalize(attr_normal);\n"
+"    occlusion = attr_occlusion;\n"
+"    world_position = vec3(model * vec4(attr_position, 1.0));\n"
+"    view_depth = -(view * vec4(world_position, 1.0)).z;\n"
+"    normal = normalize(mat3(normal_matrix) * attr_normal);\n"
+"}\n"
+"\0";
+// ./shaders/vertex_depth.glsl
+const char *vertex_depth_glsl =
+"#version 430 core\n"
+"layout(location = 0) in vec3 attr_position;\n"
+"\n"
+"// must match vertex.glsl exactly, the shading pass only draws where its depth equals this pass's\n"
+"invariant gl_Position;\n"
+"\n"
+"// per frame constants, see frame_uniforms.hh\n"
+"layout(std140, binding = 1) uniform frame_data {\n"
+"    mat4 model;\n"
+"    mat4 view;\n"
+"    mat4 projection;\n"
+"    mat4 normal_matrix;\n"
+"};\n"
+"\n"
+"void main() {\n"
+"    gl_Position = projection * view * model * vec4(attr_position, 1.0);\n"
+"}\n"
+"\0";
+// ./shaders/vertex_instanced.glsl
+const char *vertex_instanced_glsl =
+"#version 430 core\n"
+"layout(location = 0) in vec3 attr_position;\n"
+"layout(location = 1) in vec3 attr_normal;\n"
+"layout(location = 2) in vec2 attr_tex_coord;\n"
+"layout(location = 3) in mat4 attr_instance_model; // occupies locations 3 to 6\n"
+"layout(location = 7) in float attr_occlusion;\n"
+"\n"
+"out vec3 normal;\n"
+"out vec2 tex_coord;\n"
+"out vec3 world_position;\n"
+"out float view_depth; // distance in front of the camera, picks the light cluster\n"
+"out float occlusion;\n"
+"\n"
+"// per frame constants, see frame_uniforms.hh\n"
+"layout(std140, binding = 1) uniform frame_data {\n"
+"    mat4 model;\n"
+"    mat4 view;\n"
+"    mat4 projection;\n"
+"    mat4 normal_matrix;\n"
+"};\n"
+"\n"
+"void main() {\n"
+"    gl_Position = projection * view * attr_instance_model * vec4(attr_position, 1.0);\n"
+"    tex_coord = attr_tex_coord;\n"
+"    occlusion = attr_occlusion;\n"
+"    world_position = vec3(attr_instance_model * vec4(attr_position, 1.0));\n"
+"    view_depth = -(view * vec4(world_position, 1.0)).z;\n"
+"    // instances are only rotated and uniformly scaled, which turns normals the same as the inverse transpose\n"
+"    normal = normalize(mat3(attr_instance_model) * attr_normal);\n"
+"}\n"
+"\0";
+// ./shaders/vertex_shadow.glsl
+const char *vertex_shadow_glsl =
+"#version 430 core\n"
+"layout(location = 0) in vec3 attr_position;\n"
+"layout(location = 2) in vec2 attr_tex_coord; // passed on for alpha tested materials\n"
+"\n"
+"// per frame constants, see frame_uniforms.hh\n"
+"layout(std140, binding = 1) uniform frame_data {\n"
+"    mat4 model;\n"
+"    mat4 view;\n"
+"    mat4 projection;\n"
+"    mat4 normal_matrix;\n"
+"};\n"
+"\n"
+"out vec2 tex_coord;\n"
+"\n"
+"uniform mat4 shadow_view_projection; // of the cascade being drawn\n"
+"\n"
+"void main() {\n"
+"    gl_Position = shadow_view_projection * model * vec4(attr_position, 1.0);\n"
+"    tex_coord = attr_tex_coord;\n"
+"}\n"
+"\0";
+// ./shaders/vertex_shadow_instanced.glsl
+const char *vertex_shadow_instanced_glsl =
+"#version 330 core\n"
+"layout(location = 0) in vec3 attr_position;\n"
+"layout(location = 2) in vec2 attr_tex_coord; // passed on for alpha tested materials\n"
+"layout(location = 3) in mat4 attr_instance_model; // occupies locations 3 to 6\n"
+"\n"
+"out vec2 tex_coord;\n"
+"\n"
+"uniform mat4 shadow_view_projection; // of the cascade being drawn\n"
+"\n"
+"void main() {\n"
+"    gl_Position = shadow_view_projection * attr_instance_model * vec4(attr_position, 1.0);\n"
+"    tex_coord = attr_tex_coord;\n"
 "}\n"
 "\0";
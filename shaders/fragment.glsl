@@ -1,7 +1,11 @@
 #version 430 core
+// features: TEXTURED ALPHA_TEST
 
 in vec3 normal;
 in vec2 tex_coord;
+in vec3 world_position;
+in float view_depth;
+in float occlusion;
 
 out vec4 frag_color;
 
@@ -16,23 +20,94 @@ layout(location = 6) uniform float material_specular_exp;
 
 uniform sampler2D texture_diffuse;
 
+// point and spot lights, a spot light has spot_cos above -1
+struct light {
+    vec3 position;
+    float radius;
+    vec3 color;
+    float spot_cos;
+    vec3 direction;
+    float spot_blend;
+};
+layout(std430, binding = 0) readonly buffer light_list {
+    light lights[];
+};
+
+// lights binned into view space clusters on the cpu, see clusters.hh
+layout(std430, binding = 1) readonly buffer cluster_grid {
+    uvec4 grid_size;          // clusters along x, y and z
+    vec4 grid_scale;          // tiles per pixel along x and y, then slice = log(view_depth) * z - w
+    uvec2 cluster_ranges[];   // first index and index count of each cluster's lights
+};
+layout(std430, binding = 2) readonly buffer cluster_light_indices {
+    uint light_indices[];
+};
+
+// cascaded sun shadows, see shadows.hh
+layout(std140, binding = 0) uniform shadow_data {
+    mat4 shadow_matrices[3]; // world to shadow map texture coordinates and depth
+    vec4 shadow_splits;      // view depth where each cascade ends
+    vec4 sun_direction;      // toward the sun, w is 1 when dynamic casters were drawn
+};
+uniform sampler2DArrayShadow shadow_static_map;
+uniform sampler2DArrayShadow shadow_dynamic_map;
+
+float sun_visibility() {
+    if (view_depth >= shadow_splits.z)
+        return 1.0f;
+    int cascade = view_depth < shadow_splits.x ? 0 : view_depth < shadow_splits.y ? 1 : 2;
+    vec4 position = shadow_matrices[cascade] * vec4(world_position, 1.0f);
+    vec4 coord = vec4(position.xy, float(cascade), position.z);
+    // static and dynamic casters are kept in separate maps, whichever is nearer shadows
+    float visibility = texture(shadow_static_map, coord);
+    if (sun_direction.w > 0.5f)
+        visibility = min(visibility, texture(shadow_dynamic_map, coord));
+    return visibility;
+}
+
+vec3 cluster_lighting() {
+    uvec2 tile = min(uvec2(gl_FragCoord.xy * grid_scale.xy), grid_size.xy - 1u);
+    uint slice = uint(clamp(log(view_depth) * grid_scale.z - grid_scale.w, 0.0f, float(grid_size.z - 1u)));
+    uvec2 range = cluster_ranges[tile.x + grid_size.x * (tile.y + grid_size.y * slice)];
+
+    vec3 lighting = vec3(0.0f);
+    for (uint i = range.x; i < range.x + range.y; ++i) {
+        light l = lights[light_indices[i]];
+        vec3 to_light = l.position - world_position;
+        float light_distance = length(to_light);
+        vec3 light_dir = to_light / max(light_distance, 1e-4f);
+        float falloff = clamp(1.0f - (light_distance * light_distance) / (l.radius * l.radius), 0.0f, 1.0f);
+        float cone = 1.0f;
+        if (l.spot_cos > -1.0f)
+            cone = smoothstep(l.spot_cos, l.spot_cos + l.spot_blend, dot(-light_dir, l.direction));
+        lighting += max(dot(normal, light_dir), 0.0f) * falloff * falloff * cone * l.color;
+    }
+    return lighting;
+}
+
 void main() {
 
     float global_ambient_intensity = 0.5f;
     vec3 global_ambient_color = global_ambient_intensity * vec3(0.86, 0.94, 1);
-    vec3 ambient = global_ambient_color * color_ambient;
+    vec3 ambient = global_ambient_color * color_ambient * occlusion;
 
     float global_sun_intensity = 1.3f;
     vec3 global_sun_color = global_sun_intensity * vec3(1, 0.98, 0.95);
-    vec3 global_sun_dir = normalize(vec3(1.0f, -1.0f, 1.0f));
-    float sun_angle = max(dot(normal, global_sun_dir), 0.0f);
+    float sun_angle = max(dot(normal, sun_direction.xyz), 0.0f) * sun_visibility();
     vec3 diffuse = sun_angle * global_sun_color * color_diffuse;
 
-    vec3 flat_color = diffuse + ambient;
+    vec3 flat_color = diffuse + ambient + cluster_lighting() * color_diffuse;
 
+#ifdef TEXTURED
     vec4 tex_color = texture(texture_diffuse, tex_coord);
+#ifdef ALPHA_TEST
+    // only materials with see-through texels discard, so the rest keep early depth testing
     if(tex_color.a == 0.0f)
         discard;
+#endif
+#else
+    vec4 tex_color = vec4(1.0f);
+#endif
 
     frag_color = vec4(flat_color, 1 - material_transparency) * tex_color;
 }
\ No newline at end of file
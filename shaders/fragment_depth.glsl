@@ -0,0 +1,17 @@
+#version 330 core
+// features: ALPHA_TEST
+
+#ifdef ALPHA_TEST
+in vec2 tex_coord;
+
+uniform sampler2D texture_diffuse;
+#endif
+
+// the depth pre-pass and the shadow maps write no color, only depth
+void main() {
+#ifdef ALPHA_TEST
+    // see-through texels of cutout materials cast no shadow
+    if (texture(texture_diffuse, tex_coord).a == 0.0f)
+        discard;
+#endif
+}
\ No newline at end of file
@@ -1,17 +1,29 @@
-#version 330 core
+#version 430 core
 layout(location = 0) in vec3 attr_position;
 layout(location = 1) in vec3 attr_normal;
 layout(location = 2) in vec2 attr_tex_coord;
+layout(location = 7) in float attr_occlusion; // baked ambient occlusion, see ao.hh
 
 out vec3 normal;
 out vec2 tex_coord;
+out vec3 world_position;
+out float view_depth; // distance in front of the camera, picks the light cluster
+out float occlusion;
+invariant gl_Position; // the depth pre-pass in vertex_depth.glsl has to produce the same depth
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// per frame constants, see frame_uniforms.hh
+layout(std140, binding = 1) uniform frame_data {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    mat4 normal_matrix;
+};
 
 void main() {
     gl_Position = projection * view * model * vec4(attr_position, 1.0);
     tex_coord = attr_tex_coord;
-    normal = normalize(attr_normal);
+    occlusion = attr_occlusion;
+    world_position = vec3(model * vec4(attr_position, 1.0));
+    view_depth = -(view * vec4(world_position, 1.0)).z;
+    normal = normalize(mat3(normal_matrix) * attr_normal);
 }
\ No newline at end of file
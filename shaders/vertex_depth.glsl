@@ -0,0 +1,17 @@
+#version 430 core
+layout(location = 0) in vec3 attr_position;
+
+// must match vertex.glsl exactly, the shading pass only draws where its depth equals this pass's
+invariant gl_Position;
+
+// per frame constants, see frame_uniforms.hh
+layout(std140, binding = 1) uniform frame_data {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    mat4 normal_matrix;
+};
+
+void main() {
+    gl_Position = projection * view * model * vec4(attr_position, 1.0);
+}
\ No newline at end of file
@@ -0,0 +1,30 @@
+#version 430 core
+layout(location = 0) in vec3 attr_position;
+layout(location = 1) in vec3 attr_normal;
+layout(location = 2) in vec2 attr_tex_coord;
+layout(location = 3) in mat4 attr_instance_model; // occupies locations 3 to 6
+layout(location = 7) in float attr_occlusion;
+
+out vec3 normal;
+out vec2 tex_coord;
+out vec3 world_position;
+out float view_depth; // distance in front of the camera, picks the light cluster
+out float occlusion;
+
+// per frame constants, see frame_uniforms.hh
+layout(std140, binding = 1) uniform frame_data {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    mat4 normal_matrix;
+};
+
+void main() {
+    gl_Position = projection * view * attr_instance_model * vec4(attr_position, 1.0);
+    tex_coord = attr_tex_coord;
+    occlusion = attr_occlusion;
+    world_position = vec3(attr_instance_model * vec4(attr_position, 1.0));
+    view_depth = -(view * vec4(world_position, 1.0)).z;
+    // instances are only rotated and uniformly scaled, which turns normals the same as the inverse transpose
+    normal = normalize(mat3(attr_instance_model) * attr_normal);
+}
\ No newline at end of file
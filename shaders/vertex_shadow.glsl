@@ -0,0 +1,20 @@
+#version 430 core
+layout(location = 0) in vec3 attr_position;
+layout(location = 2) in vec2 attr_tex_coord; // passed on for alpha tested materials
+
+// per frame constants, see frame_uniforms.hh
+layout(std140, binding = 1) uniform frame_data {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    mat4 normal_matrix;
+};
+
+out vec2 tex_coord;
+
+uniform mat4 shadow_view_projection; // of the cascade being drawn
+
+void main() {
+    gl_Position = shadow_view_projection * model * vec4(attr_position, 1.0);
+    tex_coord = attr_tex_coord;
+}
\ No newline at end of file
@@ -0,0 +1,13 @@
+#version 330 core
+layout(location = 0) in vec3 attr_position;
+layout(location = 2) in vec2 attr_tex_coord; // passed on for alpha tested materials
+layout(location = 3) in mat4 attr_instance_model; // occupies locations 3 to 6
+
+out vec2 tex_coord;
+
+uniform mat4 shadow_view_projection; // of the cascade being drawn
+
+void main() {
+    gl_Position = shadow_view_projection * attr_instance_model * vec4(attr_position, 1.0);
+    tex_coord = attr_tex_coord;
+}
\ No newline at end of file
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+
+#include "culling.hh"
+#include "telemetry.hh"
+
+// uniform buffer binding of the shadow data read by fragment.glsl, see shadow_uniforms
+const GLuint SHADOW_UNIFORM_BINDING = 0;
+// texture units of the shadow maps
+const GLint SHADOW_STATIC_UNIT = 1;
+const GLint SHADOW_DYNAMIC_UNIT = 2;
+
+/**
+ * \brief Cascaded sun shadow maps that keep the depth of static geometry from one frame to the next
+ * The view up to max_distance is split into CASCADE_COUNT ranges, each covered by a shadow map that
+ * fits a sphere around that range, so its size does not change as the camera turns. A cascade's
+ * position is snapped to a grid of a tenth of its size, in whole texels, and it covers a margin past
+ * the sphere to make up for the snapping. The static depth of a cascade is only rendered again when
+ * it snaps to another position, the sun turns or the static geometry moves. Dynamic geometry is
+ * rendered into maps of its own every frame, and the shader takes the nearer of the two depths
+ */
+struct cascaded_shadow_maps {
+    static const unsigned CASCADE_COUNT = 3;
+    static const GLsizei RESOLUTION = 1024;
+
+    float max_distance = 60.0f;   // view depth the cascades reach to
+    float split_blend = 0.75f;    // 0 splits the distance evenly, 1 logarithmically
+
+    GLuint static_texture = 0, dynamic_texture = 0; // depth texture arrays, one layer per cascade
+    GLuint framebuffer = 0, uniform_buffer = 0;
+
+    unsigned frames = 0;
+    unsigned static_renders = 0; // cascades whose static depth was rendered again
+
+    struct cascade {
+        glm::mat4 view_projection{1.0f}; // world to the cascade's clip space
+        float end_depth = 0.0f;          // view depth where the next cascade takes over
+        glm::vec2 snapped_center{0.0f};  // in light space, where the static depth was rendered from
+        float half_size = 0.0f;
+        bool static_valid = false;
+    };
+    cascade cascades[CASCADE_COUNT];
+
+    void init() {
+        for (GLuint *texture : {&static_texture, &dynamic_texture}) {
+            glGenTextures(1, texture);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, *texture);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, RESOLUTION, RESOLUTION, CASCADE_COUNT, 0,
+                         GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+            // compare in the sampler, so linear filtering blends the results of 4 texels
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+            // everything outside a map is lit
+            const float border[] = {1.0f, 1.0f, 1.0f, 1.0f};
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+            glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        }
+        glActiveTexture(GL_TEXTURE0 + SHADOW_STATIC_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, static_texture);
+        glActiveTexture(GL_TEXTURE0 + SHADOW_DYNAMIC_UNIT);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, dynamic_texture);
+        glActiveTexture(GL_TEXTURE0);
+
+        glGenFramebuffers(1, &framebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+        glGenBuffers(1, &uniform_buffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(shadow_uniforms), NULL, GL_DYNAMIC_DRAW);
+        glBindBufferBase(GL_UNIFORM_BUFFER, SHADOW_UNIFORM_BINDING, uniform_buffer);
+    }
+
+    /**
+     * \brief Fit the cascades to a camera and render whatever depth is out of date
+     * \param sun_direction toward the sun
+     * \param static_bounds world space bounds of the static geometry, a change redraws every cascade
+     * \param draw_static draw_static(view_projection) draws the static geometry's depth
+     * \param draw_dynamic draw_dynamic(view_projection) draws the dynamic geometry's depth, or nothing
+     * \param has_dynamic false skips the dynamic maps
+     * \param target_framebuffer bound again afterwards, with a viewport_width by viewport_height viewport
+     */
+    template <typename static_function, typename dynamic_function>
+    void render(const glm::mat4 &view, const glm::mat4 &projection, glm::vec3 sun_direction, const aabb &static_bounds,
+                static_function draw_static, dynamic_function draw_dynamic, bool has_dynamic, int viewport_width,
+                int viewport_height, GLuint target_framebuffer = 0) {
+        ++frames;
+        if (sun_direction != cached_sun || static_bounds.min != cached_bounds.min ||
+            static_bounds.max != cached_bounds.max) {
+            for (cascade &cascade : cascades)
+                cascade.static_valid = false;
+            cached_sun = sun_direction;
+            cached_bounds = static_bounds;
+        }
+        fit(view, projection);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+        glViewport(0, 0, RESOLUTION, RESOLUTION);
+        // push depth back by its slope so surfaces do not shadow themselves
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+        for (unsigned i = 0; i < CASCADE_COUNT; ++i) {
+            if (!cascades[i].static_valid) {
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, static_texture, 0, i);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                draw_static(cascades[i].view_projection);
+                cascades[i].static_valid = true;
+                ++static_renders;
+            }
+            if (has_dynamic) {
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, dynamic_texture, 0, i);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                draw_dynamic(cascades[i].view_projection);
+            }
+        }
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, target_framebuffer);
+        glViewport(0, 0, viewport_width, viewport_height);
+
+        shadow_uniforms uniforms;
+        // clip space to texture coordinates and depth
+        glm::mat4 bias = glm::scale(glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)), glm::vec3(0.5f));
+        for (unsigned i = 0; i < CASCADE_COUNT; ++i) {
+            uniforms.matrices[i] = bias * cascades[i].view_projection;
+            uniforms.splits[i] = cascades[i].end_depth;
+        }
+        uniforms.sun = glm::vec4(sun_direction, has_dynamic ? 1.0f : 0.0f);
+        glBindBuffer(GL_UNIFORM_BUFFER, uniform_buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(uniforms), &uniforms);
+        render_count().bytes_uploaded += sizeof(uniforms);
+    }
+
+  private:
+    // std140 layout of the shadow_data block in fragment.glsl
+    struct shadow_uniforms {
+        glm::mat4 matrices[CASCADE_COUNT]; // world to shadow map texture coordinates and depth
+        glm::vec4 splits{0.0f};            // view depth where each cascade ends
+        glm::vec4 sun{0.0f};               // toward the sun, w is 1 when the dynamic maps were drawn
+    };
+
+    glm::vec3 cached_sun{0.0f};
+    aabb cached_bounds;
+
+    void fit(const glm::mat4 &view, const glm::mat4 &projection) {
+        // glm::perspective puts -2 * far * near / (far - near) and -(far + near) / (far - near) here
+        float near_plane = projection[3][2] / (projection[2][2] - 1.0f);
+        float far_plane = std::min(max_distance, projection[3][2] / (projection[2][2] + 1.0f));
+
+        glm::vec3 up = std::abs(cached_sun.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 light_view = glm::lookAt(glm::vec3(0.0f), -cached_sun, up);
+        glm::mat4 camera_to_world = glm::inverse(view);
+
+        // the depth range has to take in every static caster, wherever it is in the cascade
+        float light_near = std::numeric_limits<float>::max(), light_far = std::numeric_limits<float>::lowest();
+        for (unsigned corner = 0; corner < 8; ++corner) {
+            glm::vec3 point(corner & 1 ? cached_bounds.max.x : cached_bounds.min.x,
+                            corner & 2 ? cached_bounds.max.y : cached_bounds.min.y,
+                            corner & 4 ? cached_bounds.max.z : cached_bounds.min.z);
+            float depth = -(light_view * glm::vec4(point, 1.0f)).z;
+            light_near = std::min(light_near, depth);
+            light_far = std::max(light_far, depth);
+        }
+        light_near -= 1.0f;
+        light_far += 1.0f;
+
+        float start = near_plane;
+        for (unsigned i = 0; i < CASCADE_COUNT; ++i) {
+            float fraction = float(i + 1) / CASCADE_COUNT;
+            float end = split_blend * near_plane * std::pow(far_plane / near_plane, fraction) +
+                        (1.0f - split_blend) * (near_plane + (far_plane - near_plane) * fraction);
+
+            // sphere around the corners of the view between start and end, the same size however the camera turns
+            glm::vec3 corners[8];
+            glm::vec3 center(0.0f);
+            for (unsigned corner = 0; corner < 8; ++corner) {
+                float depth = corner & 4 ? end : start;
+                glm::vec3 view_corner((corner & 1 ? 1.0f : -1.0f) * depth / projection[0][0],
+                                      (corner & 2 ? 1.0f : -1.0f) * depth / projection[1][1], -depth);
+                corners[corner] = glm::vec3(camera_to_world * glm::vec4(view_corner, 1.0f));
+                center += corners[corner] / 8.0f;
+            }
+            float radius = 0.0f;
+            for (const glm::vec3 &corner : corners)
+                radius = std::max(radius, glm::distance(corner, center));
+            radius = std::ceil(radius * 16.0f) / 16.0f; // so rounding errors do not change the size
+
+            // snapping moves the cascade by up to half a step, which the margin covers
+            float half_size = radius * 1.25f;
+            float texel = 2.0f * half_size / RESOLUTION;
+            float step = std::max(std::floor(radius * 0.25f / texel), 1.0f) * texel;
+            glm::vec2 light_center(light_view * glm::vec4(center, 1.0f));
+            glm::vec2 snapped = glm::floor(light_center / step + 0.5f) * step;
+
+            cascade &cascade = cascades[i];
+            if (snapped != cascade.snapped_center || half_size != cascade.half_size)
+                cascade.static_valid = false;
+            cascade.snapped_center = snapped;
+            cascade.half_size = half_size;
+            cascade.end_depth = end;
+            cascade.view_projection = glm::ortho(snapped.x - half_size, snapped.x + half_size, snapped.y - half_size,
+                                                 snapped.y + half_size, light_near, light_far) *
+                                      light_view;
+            start = end;
+        }
+    }
+};
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+
+// an index sorted by a 32 bit key
+struct sort_item {
+    uint32_t key;
+    uint32_t index;
+};
+
+/**
+ * \brief Map a float to an unsigned key with the same order, so floats can be radix sorted
+ */
+inline uint32_t float_sort_key(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    // negative floats sort backwards, so flip all of their bits, and move positive ones above them
+    return bits & 0x80000000u ? ~bits : bits | 0x80000000u;
+}
+
+/**
+ * \brief Stable least significant digit radix sort by key, one pass per byte
+ * Passes where every key has the same byte are skipped
+ */
+inline void radix_sort(std::vector<sort_item> &items, std::vector<sort_item> &scratch) {
+    if (items.size() < 2)
+        return;
+    scratch.resize(items.size());
+    for (unsigned shift = 0; shift < 32; shift += 8) {
+        size_t offsets[256] = {};
+        for (const sort_item &item : items)
+            ++offsets[(item.key >> shift) & 0xFF];
+        if (offsets[(items[0].key >> shift) & 0xFF] == items.size())
+            continue;
+
+        size_t total = 0;
+        for (size_t &offset : offsets) {
+            size_t count = offset;
+            offset = total;
+            total += count;
+        }
+        for (const sort_item &item : items)
+            scratch[offsets[(item.key >> shift) & 0xFF]++] = item;
+        items.swap(scratch);
+    }
+}
+
+/**
+ * \brief Sort items that were in order last frame and whose keys may have changed since
+ * A still camera leaves the order as it is, and small camera steps, which swap many neighbours but move
+ * each item only a few places, are fixed with an insertion sort. When items move so far that the insertion
+ * sort runs out of its move budget, a radix sort is cheaper and takes over. The budget is 2 moves per item, which
+ * is about where both take as long for 20000 draws, so camera steps that move items further than that, such as
+ * 1 unit per frame through the 1000 unit wide bench scene at about 17 moves per item, are radix sorted
+ * \return whether the radix sort was needed
+ */
+inline bool coherent_sort(std::vector<sort_item> &items, std::vector<sort_item> &scratch) {
+    // the items before the first descent are in order already, the insertion sort starts there
+    size_t first = 1;
+    while (first < items.size() && items[first].key >= items[first - 1].key)
+        ++first;
+    if (first >= items.size())
+        return false;
+
+    size_t move_budget = items.size() * 2 + 16;
+    for (size_t i = first; i < items.size(); ++i) {
+        sort_item item = items[i];
+        size_t j = i;
+        while (j > 0 && items[j - 1].key > item.key) {
+            items[j] = items[j - 1];
+            --j;
+            if (--move_budget == 0) {
+                items[j] = item;
+                radix_sort(items, scratch);
+                return true;
+            }
+        }
+        items[j] = item;
+    }
+    return false;
+}
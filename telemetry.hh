@@ -0,0 +1,226 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+
+/**
+ * \brief What the gl thread sent to the gpu in the current frame, counted where it is sent
+ */
+struct render_counters {
+    uint32_t draw_calls = 0;
+    uint32_t triangles = 0;
+    uint32_t state_changes = 0;  // program, texture and vertex array binds
+    uint32_t texture_binds = 0;  // the diffuse texture binds among them, which atlas pages save
+    uint32_t bytes_uploaded = 0; // buffer data streamed from the cpu
+
+    void draw(uint32_t vertex_count, uint32_t instance_count = 1) {
+        ++draw_calls;
+        triangles += vertex_count / 3 * instance_count;
+    }
+};
+
+/**
+ * \brief The counters of the current frame, reset when it begins
+ */
+inline render_counters &render_count() {
+    static render_counters counters;
+    return counters;
+}
+
+// one frame's measurements, every field is 32 bits so samples are stored as words
+struct frame_sample {
+    uint32_t frame = 0;
+    float frame_ms = 0.0f; // start of the frame until after it was swapped to the screen
+    float cpu_ms = 0.0f;   // start of the frame until it was submitted, without waiting on the swap
+    float gpu_ms = -1.0f;  // negative until its timer query is read back, a few frames later
+    uint32_t draw_calls = 0, triangles = 0, state_changes = 0, texture_binds = 0, bytes_uploaded = 0;
+    uint32_t tested = 0, visible = 0, occluded = 0, pvs_hidden = 0; // culling results of the drawn frame
+    uint32_t clusters_overflowed = 0; // light clusters that dropped their dimmest lights to fit the limit
+};
+
+struct frame_percentiles {
+    float p50 = 0.0f, p95 = 0.0f, p99 = 0.0f;
+};
+
+/**
+ * \brief Nearest rank percentiles of values, which are reordered
+ */
+inline frame_percentiles percentiles(std::vector<float> &values) {
+    frame_percentiles result;
+    if (values.empty())
+        return result;
+    auto rank = [&](float p) {
+        size_t index = std::min(size_t(p * values.size()), values.size() - 1);
+        std::nth_element(values.begin(), values.begin() + index, values.end());
+        return values[index];
+    };
+    result.p50 = rank(0.50f);
+    result.p95 = rank(0.95f);
+    result.p99 = rank(0.99f);
+    return result;
+}
+
+/**
+ * \brief Ring of the last CAPACITY frame samples
+ * Only the gl thread records, so recording takes no lock, and samples are stored as atomic words so
+ * other threads can copy them out while frames are still being recorded. Tail latency is what shows
+ * stutter, so the summaries are percentiles rather than averages
+ */
+struct frame_telemetry {
+    static const unsigned CAPACITY = 1 << 12;
+    static const unsigned WORDS = sizeof(frame_sample) / sizeof(uint32_t);
+    static_assert(sizeof(frame_sample) == WORDS * sizeof(uint32_t), "frame samples have to be whole words");
+
+    std::atomic<uint64_t> written{0};
+
+    void record(const frame_sample &sample) {
+        uint64_t index = written.load(std::memory_order_relaxed);
+        store(index, sample);
+        written.store(index + 1, std::memory_order_release);
+    }
+
+    /**
+     * \brief Fill in the gpu time of a frame recorded earlier, if it is still in the ring
+     */
+    void set_gpu_ms(uint32_t frame, float gpu_ms) {
+        uint64_t end = written.load(std::memory_order_relaxed);
+        for (uint64_t index = end; index > 0 && end - index < 16; --index) {
+            std::atomic<uint32_t> *slot = &words[(index - 1) % CAPACITY * WORDS];
+            if (slot[offsetof(frame_sample, frame) / sizeof(uint32_t)].load(std::memory_order_relaxed) != frame)
+                continue;
+            uint32_t bits;
+            std::memcpy(&bits, &gpu_ms, sizeof(bits));
+            slot[offsetof(frame_sample, gpu_ms) / sizeof(uint32_t)].store(bits, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    /**
+     * \brief Copy out the last count samples, oldest first
+     */
+    std::vector<frame_sample> snapshot(size_t count = CAPACITY) const {
+        // copy first and then drop whatever the recording thread may have overwritten meanwhile
+        uint64_t end = written.load(std::memory_order_acquire);
+        uint64_t first = end - std::min<uint64_t>({end, count, CAPACITY});
+        std::vector<frame_sample> samples;
+        samples.reserve(end - first);
+        for (uint64_t index = first; index < end; ++index)
+            samples.push_back(load(index));
+        uint64_t end_after = written.load(std::memory_order_acquire);
+        uint64_t valid = end_after > CAPACITY ? end_after - CAPACITY : 0;
+        if (valid > first)
+            samples.erase(samples.begin(), samples.begin() + std::min<uint64_t>(valid - first, samples.size()));
+        return samples;
+    }
+
+    /**
+     * \brief Frame time percentiles of the last count frames
+     */
+    frame_percentiles frame_time(size_t count = CAPACITY) const {
+        std::vector<float> times;
+        for (const frame_sample &sample : snapshot(count))
+            times.push_back(sample.frame_ms);
+        return percentiles(times);
+    }
+
+    /**
+     * \brief Gpu time percentiles of the last count frames that have one
+     */
+    frame_percentiles gpu_time(size_t count = CAPACITY) const {
+        std::vector<float> times;
+        for (const frame_sample &sample : snapshot(count))
+            if (sample.gpu_ms >= 0.0f)
+                times.push_back(sample.gpu_ms);
+        return percentiles(times);
+    }
+
+    /**
+     * \brief Write the samples in the ring, as JSON if the path ends in .json and as CSV otherwise
+     */
+    bool write(const std::string &path) const {
+        std::ofstream file(path);
+        if (!file.is_open()) {
+            std::cout << "Failed to open file: " << path << std::endl;
+            return false;
+        }
+        std::vector<frame_sample> samples = snapshot();
+        bool json = path.size() >= 5 && path.compare(path.size() - 5, 5, ".json") == 0;
+        // calls field(name, value) for every column of a sample
+        auto columns = [](const frame_sample &sample, auto &&field) {
+            field("frame", sample.frame);
+            field("frame_ms", sample.frame_ms);
+            field("cpu_ms", sample.cpu_ms);
+            field("gpu_ms", sample.gpu_ms);
+            field("draw_calls", sample.draw_calls);
+            field("triangles", sample.triangles);
+            field("state_changes", sample.state_changes);
+            field("texture_binds", sample.texture_binds);
+            field("bytes_uploaded", sample.bytes_uploaded);
+            field("tested", sample.tested);
+            field("visible", sample.visible);
+            field("occluded", sample.occluded);
+            field("pvs_hidden", sample.pvs_hidden);
+            field("clusters_overflowed", sample.clusters_overflowed);
+        };
+        bool first_field = true;
+        auto separate = [&] {
+            if (!first_field)
+                file << ",";
+            first_field = false;
+        };
+        if (json) {
+            file << "[\n";
+        } else {
+            columns(frame_sample(), [&](const char *name, auto) {
+                separate();
+                file << name;
+            });
+            file << "\n";
+        }
+        for (size_t i = 0; i < samples.size(); ++i) {
+            first_field = true;
+            if (json)
+                file << (i > 0 ? ",\n" : "") << "{";
+            columns(samples[i], [&](const char *name, auto value) {
+                separate();
+                if (json)
+                    file << "\"" << name << "\":";
+                file << value;
+            });
+            file << (json ? "}" : "\n");
+        }
+        if (json)
+            file << "\n]\n";
+        std::cout << "telemetry: wrote " << samples.size() << " frames to " << path << std::endl;
+        return file.good();
+    }
+
+  private:
+    std::unique_ptr<std::atomic<uint32_t>[]> words{new std::atomic<uint32_t>[CAPACITY * WORDS]()};
+
+    void store(uint64_t index, const frame_sample &sample) {
+        uint32_t bits[WORDS];
+        std::memcpy(bits, &sample, sizeof(bits));
+        std::atomic<uint32_t> *slot = &words[index % CAPACITY * WORDS];
+        for (unsigned i = 0; i < WORDS; ++i)
+            slot[i].store(bits[i], std::memory_order_relaxed);
+    }
+
+    frame_sample load(uint64_t index) const {
+        uint32_t bits[WORDS];
+        const std::atomic<uint32_t> *slot = &words[index % CAPACITY * WORDS];
+        for (unsigned i = 0; i < WORDS; ++i)
+            bits[i] = slot[i].load(std::memory_order_relaxed);
+        frame_sample sample;
+        std::memcpy(&sample, bits, sizeof(bits));
+        return sample;
+    }
+};